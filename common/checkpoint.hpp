@@ -0,0 +1,242 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+#ifndef COMMON_CHECKPOINT_HPP_
+#define COMMON_CHECKPOINT_HPP_
+
+#include <mpi.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "common/distutils.hpp"
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Binary checkpoint of the state of a distributed NMF or NTF. Factors are
+ * stored as global column major matrices, independent of the processor
+ * grid that wrote them. A restart can therefore run on the same or on a
+ * different grid as long as the global sizes and the rank k match.
+ * All integers are native uint64 and all values native double.
+ *
+ * | section | content |
+ * |---------|---------|
+ * | header  | CheckpointHeader |
+ * | rows    | num_factors global row counts |
+ * | lambda  | num_lambda weights of the CP model. Empty for NMF. |
+ * | times   | num_times accumulated timers of the run |
+ * | factors | global rows x k column major matrix of every factor |
+ *
+ * The iterations of the algorithms draw no random numbers after the
+ * initialization, so factors, lambda and the iteration count are the
+ * whole state needed to continue a run.
+ */
+struct CheckpointHeader {
+  char magic[8];
+  uint64_t version;
+  uint64_t iteration;
+  uint64_t k;
+  uint64_t num_factors;
+  uint64_t num_lambda;
+  uint64_t num_times;
+  uint64_t reserved;
+};
+
+class DistCheckpoint {
+ private:
+  MPI_Comm m_comm;
+  int m_rank;
+  CheckpointHeader m_header;
+  std::vector<uint64_t> m_global_rows;
+  VEC m_lambda;
+  std::vector<double> m_times;
+
+  /// Byte offset of the first entry of factor i
+  MPI_Offset factor_offset(const unsigned int i) const {
+    MPI_Offset off =
+        sizeof(CheckpointHeader) + sizeof(uint64_t) * m_header.num_factors +
+        sizeof(double) * (m_header.num_lambda + m_header.num_times);
+    for (unsigned int j = 0; j < i; j++) {
+      off += sizeof(double) * m_global_rows[j] * m_header.k;
+    }
+    return off;
+  }
+
+  /**
+   * Collective read or write of the local rows of factor i. The local
+   * rows are contiguous in the global matrix starting at row_start.
+   */
+  int factorIO(MPI_File fh, const unsigned int i, const UWORD row_start,
+               MAT *X, const bool write) const {
+    return subarrayIO(fh, factor_offset(i), m_global_rows[i], row_start, X,
+                      write);
+  }
+
+ public:
+  static const char *magic() { return "PLANCCKP"; }
+  static const uint64_t kVersion = 1;
+
+  explicit DistCheckpoint(MPI_Comm comm) : m_comm(comm) {
+    MPI_Comm_rank(comm, &m_rank);
+    std::memset(&m_header, 0, sizeof(m_header));
+    std::memcpy(m_header.magic, magic(), sizeof(m_header.magic));
+    m_header.version = kVersion;
+  }
+
+  /// Number of completed outer iterations
+  uint64_t iteration() const { return m_header.iteration; }
+  void iteration(const uint64_t it) { m_header.iteration = it; }
+  const VEC &lambda() const { return m_lambda; }
+  void lambda(const VEC &l) { m_lambda = l; }
+  const std::vector<double> &times() const { return m_times; }
+  void times(const std::vector<double> &t) { m_times = t; }
+  uint64_t k() const { return m_header.k; }
+  unsigned int num_factors() const { return m_global_rows.size(); }
+  uint64_t global_rows(const unsigned int i) const { return m_global_rows[i]; }
+
+  /**
+   * Collectively writes the checkpoint. The file is written to fname.tmp
+   * and renamed by the root once every rank wrote its part, so an
+   * interrupted or failed write never replaces the previous checkpoint.
+   * All ranks return the same value.
+   * @param[in] fname name of the checkpoint file
+   * @param[in] factors local rows of every factor
+   * @param[in] global_rows global row count of every factor
+   * @param[in] row_starts first global row of the local rows
+   */
+  bool write(const std::string &fname, const std::vector<MAT *> &factors,
+             const std::vector<UWORD> &global_rows,
+             const std::vector<UWORD> &row_starts) {
+    m_global_rows.assign(global_rows.begin(), global_rows.end());
+    m_header.k = factors.empty() ? 0 : factors[0]->n_cols;
+    m_header.num_factors = factors.size();
+    m_header.num_lambda = m_lambda.n_elem;
+    m_header.num_times = m_times.size();
+
+    std::string tmpname = fname + ".tmp";
+    MPI_File fh;
+    int ret = MPI_File_open(m_comm, tmpname.c_str(),
+                            MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL,
+                            &fh);
+    if (!allTrue(ret == MPI_SUCCESS, m_comm)) {
+      if (m_rank == 0) ERR << "Could not open file " << tmpname << std::endl;
+      return false;
+    }
+    // drop the tail of a larger leftover temporary file
+    MPI_File_set_size(fh, 0);
+    bool ok = true;
+    if (m_rank == 0) {
+      MPI_Status status;
+      MPI_Offset off = 0;
+      ok = MPI_File_write_at(fh, off, &m_header, sizeof(m_header), MPI_BYTE,
+                             &status) == MPI_SUCCESS;
+      off += sizeof(m_header);
+      if (!m_global_rows.empty()) {
+        ok = ok && MPI_File_write_at(fh, off, m_global_rows.data(),
+                                     sizeof(uint64_t) * m_global_rows.size(),
+                                     MPI_BYTE, &status) == MPI_SUCCESS;
+      }
+      off += sizeof(uint64_t) * m_global_rows.size();
+      if (m_lambda.n_elem > 0) {
+        ok = ok && MPI_File_write_at(fh, off, m_lambda.memptr(),
+                                     m_lambda.n_elem, MPI_DOUBLE,
+                                     &status) == MPI_SUCCESS;
+      }
+      off += sizeof(double) * m_lambda.n_elem;
+      if (!m_times.empty()) {
+        ok = ok && MPI_File_write_at(fh, off, &m_times[0], m_times.size(),
+                                     MPI_DOUBLE, &status) == MPI_SUCCESS;
+      }
+    }
+    for (unsigned int i = 0; i < factors.size(); i++) {
+      if (factorIO(fh, i, row_starts[i], factors[i], true) != MPI_SUCCESS) {
+        ok = false;
+      }
+    }
+    MPI_File_close(&fh);
+    // every rank has written and closed the file before it replaces the
+    // old one
+    ok = allTrue(ok, m_comm);
+    if (m_rank == 0 && ok && std::rename(tmpname.c_str(), fname.c_str())) {
+      ERR << "Could not rename " << tmpname << " to " << fname << std::endl;
+      ok = false;
+    }
+    return allTrue(ok, m_comm);
+  }
+
+  /**
+   * Collectively reads a checkpoint into the local rows of the given
+   * factors. The factors must already have their local sizes and the
+   * global row counts, rank, lambda and timer counts must match the file.
+   * Nothing is read into the factors otherwise. All ranks return the same
+   * value.
+   * @param[in] fname name of the checkpoint file
+   * @param[in] factors local rows of every factor. Overwritten.
+   * @param[in] global_rows expected global row count of every factor
+   * @param[in] row_starts first global row of the local rows
+   * @param[in] num_lambda expected size of lambda. k for NTF, 0 for NMF.
+   * @param[in] num_times expected number of timers
+   */
+  bool read(const std::string &fname, const std::vector<MAT *> &factors,
+            const std::vector<UWORD> &global_rows,
+            const std::vector<UWORD> &row_starts, const uint64_t num_lambda,
+            const uint64_t num_times) {
+    MPI_File fh;
+    int ret = MPI_File_open(m_comm, fname.c_str(), MPI_MODE_RDONLY,
+                            MPI_INFO_NULL, &fh);
+    if (!allTrue(ret == MPI_SUCCESS, m_comm)) {
+      if (m_rank == 0) ERR << "Could not open file " << fname << std::endl;
+      return false;
+    }
+    MPI_Status status;
+    MPI_Offset off = 0;
+    MPI_File_read_at_all(fh, off, &m_header, sizeof(m_header), MPI_BYTE,
+                         &status);
+    off += sizeof(m_header);
+    bool ok =
+        std::memcmp(m_header.magic, magic(), sizeof(m_header.magic)) == 0 &&
+        m_header.version == kVersion &&
+        m_header.num_factors == factors.size() &&
+        m_header.num_lambda == num_lambda && m_header.num_times == num_times;
+    if (ok) {
+      m_global_rows.resize(m_header.num_factors);
+      MPI_File_read_at_all(fh, off, m_global_rows.data(),
+                           sizeof(uint64_t) * m_global_rows.size(), MPI_BYTE,
+                           &status);
+      off += sizeof(uint64_t) * m_global_rows.size();
+      for (unsigned int i = 0; i < factors.size(); i++) {
+        ok = ok && m_global_rows[i] == global_rows[i] &&
+             m_header.k == factors[i]->n_cols;
+      }
+    }
+    if (!allTrue(ok, m_comm)) {
+      if (m_rank == 0) {
+        ERR << "Checkpoint " << fname << " does not match the problem"
+            << std::endl;
+      }
+      MPI_File_close(&fh);
+      return false;
+    }
+    m_lambda.set_size(m_header.num_lambda);
+    MPI_File_read_at_all(fh, off, m_lambda.memptr(), m_lambda.n_elem,
+                         MPI_DOUBLE, &status);
+    off += sizeof(double) * m_lambda.n_elem;
+    m_times.resize(m_header.num_times);
+    if (!m_times.empty()) {
+      MPI_File_read_at_all(fh, off, &m_times[0], m_times.size(), MPI_DOUBLE,
+                           &status);
+    }
+    for (unsigned int i = 0; i < factors.size(); i++) {
+      if (factorIO(fh, i, row_starts[i], factors[i], false) != MPI_SUCCESS) {
+        ok = false;
+      }
+    }
+    MPI_File_close(&fh);
+    return allTrue(ok, m_comm);
+  }
+};
+
+}  // namespace planc
+
+#endif  // COMMON_CHECKPOINT_HPP_
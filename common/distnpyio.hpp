@@ -0,0 +1,128 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+#ifndef COMMON_DISTNPYIO_HPP_
+#define COMMON_DISTNPYIO_HPP_
+
+#include <mpi.h>
+#include <string>
+#include <vector>
+#include "common/npyio.hpp"
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Reads blocks of a npy file of doubles on many processes. The root
+ * parses the header once and broadcasts it. Every process then reads
+ * only its block through an MPI subarray view, so the array is never
+ * held by one process and no conversion to the raw MPI-IO format is
+ * needed. Both C and Fortran ordered arrays are read into the column
+ * major layout of MAT and Tensor.
+ */
+class DistNumPyArray {
+ private:
+  MPI_Comm m_comm;
+  UVEC m_dims;
+  bool m_fortran_order;
+  bool m_big_endian;
+  MPI_Offset m_data_offset;
+
+ public:
+  explicit DistNumPyArray(MPI_Comm comm)
+      : m_comm(comm),
+        m_fortran_order(true),
+        m_big_endian(false),
+        m_data_offset(0) {}
+
+  /**
+   * Collectively parses the header of fname on the root.
+   * @return false on every process if fname is not a npy file of doubles
+   */
+  bool open(const std::string &fname) {
+    int rank;
+    MPI_Comm_rank(m_comm, &rank);
+    // ok, fortran order, big endian, data offset and number of modes
+    uint64_t meta[5] = {0, 0, 0, 0, 0};
+    NumPyArray npy;
+    if (rank == 0 && npy.read_header(fname)) {
+      meta[0] = 1;
+      meta[1] = npy.fortran_order();
+      meta[2] = npy.big_endian();
+      meta[3] = npy.data_offset();
+      meta[4] = npy.dims().n_elem;
+    }
+    MPI_Bcast(meta, 5, MPI_UINT64_T, 0, m_comm);
+    if (!meta[0]) return false;
+    std::vector<uint64_t> dims(meta[4]);
+    if (rank == 0) {
+      for (unsigned int i = 0; i < dims.size(); i++) dims[i] = npy.dims()[i];
+    }
+    MPI_Bcast(&dims[0], dims.size(), MPI_UINT64_T, 0, m_comm);
+    this->m_fortran_order = meta[1];
+    this->m_big_endian = meta[2];
+    this->m_data_offset = meta[3];
+    this->m_dims = arma::conv_to<UVEC>::from(dims);
+    return true;
+  }
+  /// Global shape of the array
+  const UVEC &dims() const { return m_dims; }
+  bool fortran_order() const { return m_fortran_order; }
+
+  /**
+   * Collectively reads the block of counts entries per mode that starts
+   * at starts into buf in column major order. A process with an empty
+   * block still takes part.
+   * @param[in] fname same file as open
+   * @param[in] starts first global index of the block in every mode
+   * @param[in] counts size of the block in every mode
+   * @param[out] buf counts.prod() doubles
+   */
+  bool read(const std::string &fname, const UVEC &starts, const UVEC &counts,
+            double *buf) {
+    int modes = m_dims.n_elem;
+    std::vector<int> gsizes(modes), lsizes(modes), lstarts(modes);
+    for (int i = 0; i < modes; i++) {
+      gsizes[i] = m_dims[i];
+      lsizes[i] = counts[i];
+      lstarts[i] = starts[i];
+    }
+    UWORD count = arma::prod(counts);
+    MPI_Datatype view;
+    if (count > 0) {
+      MPI_Type_create_subarray(
+          modes, &gsizes[0], &lsizes[0], &lstarts[0],
+          m_fortran_order ? MPI_ORDER_FORTRAN : MPI_ORDER_C, MPI_DOUBLE,
+          &view);
+    } else {  // nothing owned and subarray does not accept empty sizes
+      MPI_Type_contiguous(0, MPI_DOUBLE, &view);
+    }
+    MPI_Type_commit(&view);
+    MPI_File fh;
+    int ret = MPI_File_open(m_comm, fname.c_str(), MPI_MODE_RDONLY,
+                            MPI_INFO_NULL, &fh);
+    if (ret != MPI_SUCCESS) {
+      ERR << "Could not open the file " << fname << std::endl;
+      MPI_Type_free(&view);
+      return false;
+    }
+    MPI_File_set_view(fh, m_data_offset, MPI_DOUBLE, view, "native",
+                      MPI_INFO_NULL);
+    // a C ordered block arrives row major and is reordered below
+    std::vector<double> cbuf(m_fortran_order ? 0 : count);
+    double *dst = (m_fortran_order || count == 0) ? buf : &cbuf[0];
+    MPI_Status status;
+    ret = MPI_File_read_all(fh, dst, count, MPI_DOUBLE, &status);
+    MPI_File_close(&fh);
+    MPI_Type_free(&view);
+    if (ret != MPI_SUCCESS) {
+      ERR << "Could not read the file " << fname << std::endl;
+      return false;
+    }
+    if (m_big_endian) byteswapDoubles(dst, count);
+    if (!m_fortran_order) cToFortranOrder(dst, counts, buf);
+    return true;
+  }
+};
+
+}  // namespace planc
+
+#endif  // COMMON_DISTNPYIO_HPP_
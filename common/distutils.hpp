@@ -3,6 +3,8 @@
 #define COMMON_DISTUTILS_HPP_
 
 #include <mpi.h>
+#include <algorithm>
+#include <climits>
 #include <string>
 #include "common/distutils.h"
 #include "common/utils.h"
@@ -93,4 +95,163 @@ inline int startidx(int n, int p, int r) {
       (r < rem) ? r * (n / p + 1) : (rem * (n / p + 1) + ((r - rem) * (n / p)));
   return idx;
 }
+/**
+ * Returns the rank r whose split of n across p processes holds the
+ * index idx. Inverse of startidx.
+ * @param[in] idx is an index in [0, n)
+ * @param[in] n is the size of the tensor on that dimension
+ * @param[in] p is the number of splits of n.
+ */
+inline int owneridx(UWORD idx, UWORD n, int p) {
+  UWORD rem = n % p;
+  UWORD big = n / p + 1;
+  return (idx < rem * big) ? idx / big : rem + (idx - rem * big) / (n / p);
+}
+/**
+ * MPI_Allgatherv of double data that travels as float. Halves the
+ * message volume of the factor allgathers in the mixed precision mode.
+ * Only the allgathers are narrowed. The gathered factors are rounded to
+ * float once, but sums such as the reduce_scatter of the partial
+ * products would accumulate the rounding of every process, so those stay
+ * in double. The narrowing and widening passes are split over the
+ * OpenMP threads.
+ * @param[in] sendbuf is a sendrows x sendcols column major block with
+ *            leading dimension ld. The narrowing pass packs it, so rows
+ *            of a larger matrix are sent without another copy.
+ * @param[in] recvcnts and displs are as in MPI_Allgatherv with counts in
+ *            number of entries
+ * @param[out] recvbuf receives the gathered entries as double
+ * @param[in] fsend and frecv are float scratch buffers reused across
+ *            calls. They only grow.
+ */
+inline void allgathervFloat(const double *sendbuf, const int sendrows,
+                            const int sendcols, const int ld,
+                            double *recvbuf, const int *recvcnts,
+                            const int *displs, MPI_Comm comm, FVEC *fsend,
+                            FVEC *frecv) {
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
+  int recvtotal = 0;
+  for (int i = 0; i < comm_size; i++) {
+    recvtotal = std::max(recvtotal, displs[i] + recvcnts[i]);
+  }
+  const int sendcnt = sendrows * sendcols;
+  if (fsend->n_elem < (UWORD)sendcnt) fsend->set_size(sendcnt);
+  if (frecv->n_elem < (UWORD)recvtotal) frecv->set_size(recvtotal);
+  float *fs = fsend->memptr();
+#pragma omp parallel for simd collapse(2) schedule(static)
+  for (int j = 0; j < sendcols; j++) {
+    for (int i = 0; i < sendrows; i++) {
+      fs[j * sendrows + i] = static_cast<float>(sendbuf[j * ld + i]);
+    }
+  }
+  MPI_Allgatherv(fs, sendcnt, MPI_FLOAT, frecv->memptr(), recvcnts, displs,
+                 MPI_FLOAT, comm);
+  const float *fr = frecv->memptr();
+#pragma omp parallel for simd schedule(static)
+  for (int i = 0; i < recvtotal; i++) recvbuf[i] = fr[i];
+}
+/// allgathervFloat of sendcnt contiguous entries
+inline void allgathervFloat(const double *sendbuf, const int sendcnt,
+                            double *recvbuf, const int *recvcnts,
+                            const int *displs, MPI_Comm comm, FVEC *fsend,
+                            FVEC *frecv) {
+  allgathervFloat(sendbuf, sendcnt, 1, sendcnt, recvbuf, recvcnts, displs,
+                  comm, fsend, frecv);
+}
+
+/**
+ * Returns true only if local is true on every process of comm. The
+ * stopping decisions go through it so that all the processes leave the
+ * iteration loop together.
+ */
+inline bool allTrue(const bool local, MPI_Comm comm) {
+  int in = local ? 1 : 0;
+  int out = 0;
+  MPI_Allreduce(&in, &out, 1, MPI_INT, MPI_LAND, comm);
+  return out != 0;
+}
+/**
+ * Collectively reads or writes the local rows of a column major
+ * \f$global\_m \times k\f$ matrix stored at byte offset disp of an open
+ * file. X holds rows row_start to row_start + X.n_rows - 1 of every
+ * column. The file view strides over the columns with MPI_Aint byte
+ * strides, so global_m and row_start may exceed int. A column of X is one
+ * element of the transfer, so only the local rows and k must fit in int.
+ * @param[in] fh file opened collectively by every process
+ * @param[in] disp byte offset of the first element of the matrix
+ * @param[in] global_m global row count
+ * @param[in] row_start first global row of the local rows
+ * @param[in,out] X local rows. Read into when write is false.
+ * @param[in] write writes X if true and reads X otherwise
+ * @return MPI error code of the transfer. MPI_ERR_COUNT if the local rows
+ *         or k do not fit in int.
+ */
+inline int subarrayIO(MPI_File fh, const MPI_Offset disp, const UWORD global_m,
+                      const UWORD row_start, MAT *X, const bool write) {
+  // every process takes part in the collective calls, even on an error
+  bool fits = X->n_rows <= INT_MAX && X->n_cols <= INT_MAX;
+  int rows = fits ? static_cast<int>(X->n_rows) : 0;
+  int cols = fits ? static_cast<int>(X->n_cols) : 0;
+  MPI_Datatype column, view;
+  MPI_Type_contiguous(rows, MPI_DOUBLE, &column);
+  MPI_Type_commit(&column);
+  MPI_Type_create_hvector(cols, 1,
+                          static_cast<MPI_Aint>(global_m * sizeof(double)),
+                          column, &view);
+  MPI_Type_commit(&view);
+  MPI_File_set_view(fh, disp + row_start * sizeof(double), MPI_DOUBLE, view,
+                    "native", MPI_INFO_NULL);
+  MPI_Status status;
+  int ret = write ? MPI_File_write_all(fh, X->memptr(), cols, column,
+                                       &status)
+                  : MPI_File_read_all(fh, X->memptr(), cols, column, &status);
+  MPI_Type_free(&view);
+  MPI_Type_free(&column);
+  return fits ? ret : MPI_ERR_COUNT;
+}
+
+/**
+ * Collectively writes a row distributed matrix into a new file. Rank 0 of
+ * comm writes header at the start of the file and every process writes
+ * its rows behind it with subarrayIO. If the file cannot be opened on
+ * any process, no process touches it. All processes return the same
+ * value.
+ * @param[in] comm processes that hold the rows of the matrix
+ * @param[in] fname output file name
+ * @param[in] header bytes written before the matrix. Can be empty.
+ * @param[in] X local rows of the matrix
+ * @param[in] global_m global row count
+ * @param[in] row_start first global row of the local rows
+ */
+inline bool writeRowBlocks(MPI_Comm comm, const std::string &fname,
+                           const std::string &header, const MAT &X,
+                           const UWORD global_m, const UWORD row_start) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_File fh;
+  bool ok = MPI_File_open(comm, fname.c_str(),
+                          MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL,
+                          &fh) == MPI_SUCCESS;
+  if (!allTrue(ok, comm)) {
+    // the open is collective. It fails on all the processes of comm, so
+    // there is no handle to close.
+    if (rank == 0) ERR << "Could not open " << fname << std::endl;
+    return false;
+  }
+  // an older and larger file of the same name must not leave a tail
+  ok = MPI_File_set_size(fh, 0) == MPI_SUCCESS;
+  if (rank == 0 && !header.empty()) {
+    MPI_Status status;
+    ok = ok && MPI_File_write_at(fh, 0, header.data(), header.size(),
+                                 MPI_BYTE, &status) == MPI_SUCCESS;
+  }
+  ok = subarrayIO(fh, header.size(), global_m, row_start,
+                  const_cast<MAT *>(&X), true) == MPI_SUCCESS &&
+       ok;
+  MPI_File_close(&fh);
+  ok = allTrue(ok, comm);
+  if (rank == 0 && !ok) ERR << "Could not write " << fname << std::endl;
+  return ok;
+}
 #endif  // COMMON_DISTUTILS_HPP_
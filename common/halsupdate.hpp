@@ -0,0 +1,86 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+#ifndef COMMON_HALSUPDATE_HPP_
+#define COMMON_HALSUPDATE_HPP_
+
+#include <algorithm>
+#include "common/utils.h"
+
+namespace planc {
+
+/// Doubles in the tiles of X and Bt of a thread. Sized for the L2 cache.
+const UWORD kHALSTileDoubles = 32768;
+
+/**
+ * Cache blocked HALS update of all k columns of the factor X with the
+ * gram G and the transposed right hand side Bt. Column x of X is
+ *
+ * \f$X(:,x) = [X(:,x) + (B(:,x) - XG(:,x))/d_x]_+\f$
+ *
+ * in the order of x, with the columns before x already updated.
+ * \f$d_x = G(x,x)\f$ if scaled, else 1. Entries below
+ * EPSILON_1EMINUS16 are set to it, same as fixNumericalError.
+ *
+ * The update of a row only reads that row, so the column sweep is done
+ * row by row instead of column by column. A tile of rows is transposed
+ * into a buffer of the thread and all k columns of the tile are updated
+ * while it is in cache. X and Bt are read once per call instead of once
+ * per column, and no temporary column is allocated. Tiles are
+ * distributed over the OpenMP threads.
+ * @param[in] G \f$k \times k\f$ symmetric gram such as \f$W^TW\f$
+ * @param[in] Bt \f$k \times rows\f$ right hand side such as \f$W^TA\f$
+ * @param[in] scaled divides the step of column x by G(x,x)
+ * @param[in,out] X \f$rows \times k\f$ factor
+ * @param[out] sqnorms squared norms of the updated columns of X
+ */
+inline void halsUpdate(const MAT &G, const MAT &Bt, const bool scaled,
+                       MAT *X, VEC *sqnorms) {
+  const UWORD k = X->n_cols;
+  const UWORD rows = X->n_rows;
+  const UWORD tile = std::max<UWORD>(8, kHALSTileDoubles / (2 * k + 1));
+  const int ntiles = (rows + tile - 1) / tile;
+  VEC step = arma::ones<VEC>(k);
+  if (scaled) {
+    for (UWORD x = 0; x < k; x++) step[x] = G(x, x) > 0 ? 1.0 / G(x, x) : 0;
+  }
+  sqnorms->zeros(k);
+#pragma omp parallel
+  {
+    MAT Xt(k, tile);
+    VEC local_sqnorms = arma::zeros<VEC>(k);
+#pragma omp for schedule(static)
+    for (int t = 0; t < ntiles; t++) {
+      const UWORD start = t * tile;
+      const UWORD nrows = std::min(tile, rows - start);
+      for (UWORD x = 0; x < k; x++) {
+        const double *src = X->colptr(x) + start;
+        for (UWORD i = 0; i < nrows; i++) Xt(x, i) = src[i];
+      }
+      for (UWORD i = 0; i < nrows; i++) {
+        double *xr = Xt.colptr(i);
+        const double *b = Bt.colptr(start + i);
+        for (UWORD x = 0; x < k; x++) {
+          const double *g = G.colptr(x);
+          double dot = 0;
+          for (UWORD j = 0; j < k; j++) dot += g[j] * xr[j];
+          double val = xr[x] + (b[x] - dot) * step[x];
+          xr[x] = (val < EPSILON_1EMINUS16) ? EPSILON_1EMINUS16 : val;
+        }
+      }
+      for (UWORD x = 0; x < k; x++) {
+        double *dst = X->colptr(x) + start;
+        double sq = 0;
+        for (UWORD i = 0; i < nrows; i++) {
+          dst[i] = Xt(x, i);
+          sq += dst[i] * dst[i];
+        }
+        local_sqnorms[x] += sq;
+      }
+    }
+#pragma omp critical
+    (*sqnorms) += local_sqnorms;
+  }
+}
+
+}  // namespace planc
+
+#endif  // COMMON_HALSUPDATE_HPP_
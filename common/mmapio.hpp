@@ -0,0 +1,62 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+#ifndef COMMON_MMAPIO_HPP_
+#define COMMON_MMAPIO_HPP_
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "common/utils.h"
+
+namespace planc {
+/**
+ * Read only input file mapped into memory. The mapping is private, so
+ * in place updates of the input such as normalization fault in private
+ * copies of the touched pages and never reach the file. Pages are read
+ * from the file on first access instead of a full read at startup.
+ */
+class MappedFile {
+ private:
+  char *m_addr;
+  size_t m_size;
+  // not copyable. the mapping is released once in the destructor.
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+ public:
+  explicit MappedFile(const std::string &fname) : m_addr(NULL), m_size(0) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      ERR << "Could not open the file " << fname << std::endl;
+      return;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+      void *addr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                        fd, 0);
+      if (addr != MAP_FAILED) {
+        m_addr = static_cast<char *>(addr);
+        m_size = sb.st_size;
+      } else {
+        ERR << "Could not mmap the file " << fname << std::endl;
+      }
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+  }
+  ~MappedFile() {
+    if (m_addr != NULL) munmap(m_addr, m_size);
+  }
+  /// Returns true if the file is mapped
+  bool is_open() const { return m_addr != NULL; }
+  /// Start of the mapping
+  char *data() const { return m_addr; }
+  /// Size of the mapping in bytes
+  size_t size() const { return m_size; }
+  /// Returns the mapping as doubles starting at byte offset
+  double *doubles(const size_t offset = 0) const {
+    return reinterpret_cast<double *>(m_addr + offset);
+  }
+};
+}  // namespace planc
+#endif  // COMMON_MMAPIO_HPP_
@@ -3,7 +3,9 @@
 #ifndef COMMON_NCPFACTORS_HPP_
 #define COMMON_NCPFACTORS_HPP_
 
+#include <algorithm>
 #include <cassert>
+#include <vector>
 #include "common/tensor.hpp"
 #include "common/utils.h"
 #ifdef MPI_DISTNTF
@@ -19,6 +21,102 @@
 
 namespace planc {
 
+// rows of the khatri-rao product formed at a time
+const UWORD kKRPBlockRows = 1024;
+
+/**
+ * Khatri-rao product of some factors formed on demand in tiles of rows,
+ * so that its rows are used while in cache and the full product is
+ * never held. The first mode is the fastest, as in the unfolding of a
+ * tensor. A KRP row is the hadamard product of one row of every factor.
+ * The product of the slower modes is cached and only the levels whose
+ * subscript changed are recomputed, so a row costs about k multiplies.
+ * The object is read only once constructed. Threads share it and pass
+ * their own tile and scratch buffers.
+ */
+class KRPTiles {
+  std::vector<MAT> m_ut;      /// transposed factors. A row is contiguous.
+  std::vector<UWORD> m_dims;  /// rows of every factor
+  UWORD m_k;
+  UWORD m_rows;
+  UWORD m_tile_rows;
+
+ public:
+  /**
+   * @param[in] i_factors factor of every mode
+   * @param[in] i_modes modes of the KRP from the fastest to the slowest
+   * @param[in] i_tile_rows rows of a tile
+   */
+  KRPTiles(const MAT *i_factors, const UVEC &i_modes,
+           const UWORD i_tile_rows = kKRPBlockRows)
+      : m_k(i_factors[i_modes[0]].n_cols),
+        m_rows(1),
+        m_tile_rows(i_tile_rows) {
+    for (UWORD i = 0; i < i_modes.n_elem; i++) {
+      m_ut.push_back(i_factors[i_modes[i]].t());
+      m_dims.push_back(i_factors[i_modes[i]].n_rows);
+      m_rows *= m_dims.back();
+    }
+  }
+  /// rows of the full KRP
+  UWORD n_rows() const { return m_rows; }
+  UWORD tile_rows() const { return m_tile_rows; }
+  UWORD n_tiles() const { return (m_rows + m_tile_rows - 1) / m_tile_rows; }
+
+  /**
+   * Forms the KRP rows q0 to q1 - 1 transposed. Column q - q0 of o_krpt
+   * is the KRP row q.
+   * @param[in] q0 first row
+   * @param[in] q1 one past the last row
+   * @param[out] o_krpt k x (q1 - q0) with leading dimension k
+   * @param[in,out] scratch buffer of the calling thread
+   */
+  void rows_t(const UWORD q0, const UWORD q1, double *o_krpt,
+              MAT *scratch) const {
+    const int nkrp = m_dims.size();
+    const UWORD k = m_k;
+    // column t is the hadamard of the rows of the modes t..nkrp-1
+    scratch->set_size(k, nkrp + 1);
+    scratch->col(nkrp).ones();
+    std::vector<UWORD> sub(nkrp);
+    UWORD q = q0;
+    for (int t = 0; t < nkrp; t++) {
+      sub[t] = q % m_dims[t];
+      q /= m_dims[t];
+    }
+    int changed = nkrp - 1;
+    for (q = q0; q < q1; q++) {
+      // refresh the slower levels that changed. level 0 goes straight
+      // into the output.
+      for (int t = changed; t >= 0; t--) {
+        const double *u = m_ut[t].colptr(sub[t]);
+        const double *p = scratch->colptr(t + 1);
+        double *out = (t == 0) ? o_krpt + (q - q0) * k : scratch->colptr(t);
+#pragma omp simd
+        for (UWORD r = 0; r < k; r++) out[r] = u[r] * p[r];
+      }
+      // odometer increment of the subscripts
+      changed = 0;
+      while (++sub[changed] == m_dims[changed] && changed < nkrp - 1) {
+        sub[changed++] = 0;
+      }
+    }
+  }
+  /**
+   * Forms tile t transposed into o_krpt.
+   * @param[in] t tile index
+   * @param[out] o_krpt k x tile_rows
+   * @param[in,out] scratch buffer of the calling thread
+   * @return number of rows of the tile
+   */
+  UWORD tile_t(const UWORD t, MAT *o_krpt, MAT *scratch) const {
+    UWORD q0 = t * m_tile_rows;
+    UWORD q1 = std::min(q0 + m_tile_rows, m_rows);
+    rows_t(q0, q1, o_krpt->memptr(), scratch);
+    return q1 - q0;
+  }
+};
+
 class NCPFactors {
   MAT *ncp_factors;   /// Array of factors .One factor for every mode.
   unsigned int m_modes;        /// Number of modes in tensor
@@ -102,6 +200,14 @@ ncp_factors[i].clear();
   int modes() const { return m_modes; }
   /// returns the lambda vector
   VEC lambda() const { return m_lambda; }
+  /// all the modes except i_n in increasing order
+  UVEC leave_out_one(const unsigned int i_n) const {
+    UVEC modes(this->m_modes - 1);
+    for (unsigned int i = 0, j = 0; i < this->m_modes; i++) {
+      if (i != i_n) modes(j++) = i;
+    }
+    return modes;
+  }
 
   // setters
   /**
@@ -158,107 +264,47 @@ ncp_factors[i].clear();
     krp_leave_out_one(i_n, &krp);
     return krp;
   }
-  // construct low rank tensor using the factors
   /**
-   * khatrirao leaving out one. we are using the implementation
-   * from tensor toolbox. Always krp for mttkrp is computed in
-   * reverse. Hence assuming the same. The order of the computation
-   * is same a tensor tool box.
+   * KRP tiles of all modes leaving out i_n. Same row order as
+   * krp_leave_out_one.
+   * @param[in] i_n mode that will be excluded
+   */
+  KRPTiles krp_tiles_leave_out_one(const unsigned int i_n) const {
+    return KRPTiles(ncp_factors, leave_out_one(i_n));
+  }
+  /**
+   * khatrirao leaving out one. Same order as the tensor toolbox, that is
+   * the last mode is the slowest.
    * size of krp must be product of all dimensions leaving out nxk
    * @param[in] i_n mode that will be excluded
-   * @param[out] m_dimensions[i_n]xk
+   * @param[out] product of dimensions except i_n x k
    */
   void krp_leave_out_one(const unsigned int i_n, MAT *o_krp) {
-    // matorder = length(A):-1:1;
-    // Always krp for mttkrp is computed in
-    // reverse. Hence assuming the same.
-    UVEC matorder = arma::zeros<UVEC>(this->m_modes - 1);
-    int j = 0;
-    for (int i = this->m_modes - 1; i >= 0; i--) {
-      if (i != i_n) {
-        matorder(j++) = i;
-      }
-    }
-#ifdef NTF_VERBOSE
-    INFO << "::" << __PRETTY_FUNCTION__ << "::" << __LINE__
-         << "::matorder::" << matorder << std::endl;
-#endif
-    o_krp->zeros();
-    // N = ncols(1);
-    // This is our k. So keep N = k in our case.
-    // P = A{matorder(1)};
-    // take the first factor of matorder
-    /*UWORD current_nrows = ncp_factors[matorder(0)].n_rows - 1;
-(*o_krp).rows(0, current_nrows) = ncp_factors[matorder(0)];
-// this is factor by factor
-for (int i = 1; i < this->m_modes - 1; i++) {
-// remember always krp in reverse order.
-// That is if A krp B krp C, we compute as
-// C krp B krp A.
-// prev_nrows = current_nrows;
-// rightkrp.n_rows;
-// we are populating column by column
-MAT& rightkrp = ncp_factors[matorder[i]];
-for (int j = 0; j < this->m_k; j++) {
-VEC krpcol = (*o_krp)(arma::span(0, current_nrows), j);
-// krpcol.each_rows*rightkrp.col(i);
-for (int k = 0; k < rightkrp.n_rows; k++) {
-    (*o_krp)(arma::span(k * krpcol.n_rows, (k + 1)*krpcol.n_rows -
-1), j) = krpcol * rightkrp(k, j);
-}
-}
-current_nrows *= rightkrp.n_rows;
-}*/
-    // Loop through all the columns
-    // for n = 1:N
-    //     % Loop through all the matrices
-    //     ab = A{matorder(1)}(:,n);
-    //     for i = matorder(2:end)
-    //        % Compute outer product of nth columns
-    //        ab = A{i}(:,n) * ab(:).';
-    //     end
-    //     % Fill nth column of P with reshaped result
-    //     P(:,n) = ab(:);
-    // end
-    for (unsigned int n = 0; n < this->m_k; n++) {
-      MAT ab = ncp_factors[matorder[0]].col(n);
-      for (unsigned int i = 1; i < this->m_modes - 1; i++) {
-        VEC oldabvec = arma::vectorise(ab);
-        VEC currentvec = ncp_factors[matorder[i]].col(n);
-        ab.clear();
-        ab = currentvec * oldabvec.t();
-      }
-      (*o_krp).col(n) = arma::vectorise(ab);
-    }
+    krp(leave_out_one(i_n), o_krp);
   }
   /**
    * KRP of the given vector of modes. It can be any subset of the modes.
+   * The first given mode is the fastest. Tiles of rows are formed in
+   * parallel and written straight into o_krp.
    * @param[in] Subset of modes
    * @param[out] KRP of product of dimensions of the given modes by k
    */
   void krp(const UVEC i_modes, MAT *o_krp) {
-    // matorder = length(A):-1:1;
-    // Always krp for mttkrp is computed in
-    // reverse. Hence assuming the same.
-    UVEC matorder = arma::zeros<UVEC>(i_modes.n_rows - 1);    
-    int j = 0;
-    for (int i = i_modes.n_rows - 1; i >= 0; i--) {
-      matorder(j++) = i_modes[i];
-    }
-#ifdef NTF_VERBOSE
-    INFO << "::" << __PRETTY_FUNCTION__ << "::" << __LINE__
-         << "::matorder::" << matorder << std::endl;
-#endif
-    (*o_krp).zeros();
-    for (unsigned int n = 0; n < this->m_k; n++) {
-      MAT ab = ncp_factors[matorder[0]].col(n);
-      for (unsigned int i = 1; i < i_modes.n_rows - 1; i++) {
-        VEC oldabvec = arma::vectorise(ab);
-        VEC currentvec = ncp_factors[matorder[i]].col(n);
-        ab.clear();
-        ab = currentvec * oldabvec.t();
+    KRPTiles tiles(ncp_factors, i_modes);
+    const int ntiles = tiles.n_tiles();
+#pragma omp parallel
+    {
+      MAT krpt(this->m_k, tiles.tile_rows());
+      MAT scratch;
+#pragma omp for schedule(static)
+      for (int t = 0; t < ntiles; t++) {
+        UWORD q0 = t * tiles.tile_rows();
+        UWORD len = tiles.tile_t(t, &krpt, &scratch);
+        for (unsigned int n = 0; n < this->m_k; n++) {
+          double *dst = o_krp->colptr(n) + q0;
+          for (UWORD q = 0; q < len; q++) dst[q] = krpt(n, q);
+        }
       }
-      (*o_krp).col(n) = arma::vectorise(ab);
     }
   }
 
@@ -43,6 +43,7 @@ class NMF {
   std::string input_file_name;
   MAT errMtx;       // used for error computation.
   T A_err_sub_mtx;  // used for error computation.
+  MAT errWt, errHt;  // transposed factors of the sparse error. Reused.
   /// The regularization is a vector of two values. The first value specifies
   /// L2 regularization values and the second is L1 regularization.
   FVEC m_regW;
@@ -187,73 +188,6 @@ class NMF {
   /// Returns the right low rank factor matrix H
   MAT getRightLowRankFactor() { return H; }
 
-  /*
-   * A is mxn
-   * Wr is mxk will be overwritten. Must be passed with values of W.
-   * Hr is nxk will be overwritten. Must be passed with values of H.
-   * All MATrices are in row major forMAT
-   * ||A-WH||_F^2 = over all nnz (a_ij - w_i h_j)^2 +
-   *           over all zeros (w_i h_j)^2
-   *         = over all nnz (a_ij - w_i h_j)^2 +
-   ||WH||_F^2 - over all nnz (w_i h_j)^2
-   *
-   */
-#if 0
-    void computeObjectiveError() {
-        // 1. over all nnz (a_ij - w_i h_j)^2
-        // 2. over all nnz (w_i h_j)^2
-        // 3. Compute R of W ahd L of H through QR
-        // 4. use sgemm to compute RL
-        // 5. use slange to compute ||RL||_F^2
-        // 6. return nnzsse+nnzwh-||RL||_F^2
-        tic();
-        float nnzsse = 0;
-        float nnzwh  = 0;
-        MAT  Rw(this->k, this->k);
-        MAT  Rh(this->k, this->k);
-        MAT  Qw(this->m, this->k);
-        MAT  Qh(this->n, this->k);
-        MAT  RwRh(this->k, this->k);
-
-        // #pragma omp parallel for reduction (+ : nnzsse,nnzwh)
-        for (UWORD jj = 1; jj <= this->A.n_cols; jj++) {
-            UWORD startIdx  = this->A.col_ptrs[jj - 1];
-            UWORD endIdx    = this->A.col_ptrs[jj];
-            UWORD col       = jj - 1;
-            float nnzssecol = 0;
-            float nnzwhcol  = 0;
-
-            for (UWORD ii = startIdx; ii < endIdx; ii++) {
-                UWORD row     = this->A.row_indices[ii];
-                float tempsum = 0;
-
-                for (UWORD kk = 0; kk < k; kk++) {
-                    tempsum += (this->W(row, kk) * this->H(col, kk));
-                }
-                nnzwhcol  += tempsum * tempsum;
-                nnzssecol += (this->A.values[ii] - tempsum)
-                             * (this->A.values[ii] - tempsum);
-            }
-            nnzsse += nnzssecol;
-            nnzwh  += nnzwhcol;
-        }
-        qr_econ(Qw, Rw, this->W);
-        qr_econ(Qh, Rh, this->H);
-        RwRh = Rw * Rh.t();
-        float normWH = arma::norm(RwRh, "fro");
-        Rw.clear();
-        Rh.clear();
-        Qw.clear();
-        Qh.clear();
-        RwRh.clear();
-        INFO << "error compute time " << toc() << std::endl;
-        float fastErr = sqrt(nnzsse + (normWH * normWH - nnzwh));
-        this->objective_err = fastErr;
-
-        // return (fastErr);
-    }
-
-#else  // ifdef BUILD_SPARSE
   // Removing blk error calculations as default method
   void computeObjectiveError_blk() {
     // (init.norm_A)^2 - 2*trace(H'*(A'*W))+trace((W'*W)*(H*H'))
@@ -346,8 +280,29 @@ class NMF {
     this->objective_err = arma::sum(splitErr);
   }
 
+  /// Computes the squared error \f$\|A-WH^T\|_F^2\f$ into objective_err
   void computeObjectiveError() {
-    MAT AtW = this->A.t() * this->W;
+    this->objective_err = this->squaredError(this->A);
+  }
+
+ private:
+  /*
+   * ||A-WH||_F^2 = over all nnz (a_ij - w_i h_j)^2 +
+   *                over all zeros (w_i h_j)^2
+   *              = over all nnz (a_ij - w_i h_j)^2 +
+   *                ||WH||_F^2 - over all nnz (w_i h_j)^2
+   * One fused pass over the non zeros. Avoids forming A^T and A^T W.
+   * The transposes are assigned into the same buffers every call, so
+   * they are only allocated the first time.
+   */
+  double squaredError(const SP_MAT &X) {
+    this->errWt = this->W.t();
+    this->errHt = this->H.t();
+    return sparseSquaredError(X, this->errWt, this->errHt);
+  }
+  /// (init.norm_A)^2 - 2*trace(H'*(A'*W))+trace((W'*W)*(H*H'))
+  double squaredError(const MAT &X) {
+    MAT AtW = X.t() * this->W;
     MAT WtW = this->W.t() * this->W;
     MAT HtH = this->H.t() * this->H;
 
@@ -357,9 +312,10 @@ class NMF {
 
     double raw_err = sqnormA - (2 * TrHtAtW) + TrWtWHtH;
 
-    this->objective_err = (raw_err > 0)? raw_err : 0.0;
+    return (raw_err > 0) ? raw_err : 0.0;
   }
-#endif  // ifdef BUILD_SPARSE
+
+ public:
   void computeObjectiveError(const T &At, const MAT &WtW, const MAT &HtH) {
     MAT AtW = At * this->W;
 
@@ -2,74 +2,203 @@
 #ifndef COMMON_NPYIO_HPP_
 #define COMMON_NPYIO_HPP_
 #include <armadillo>
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
+#include "common/mmapio.hpp"
 #include "common/tensor.hpp"
 #include "common/utils.h"
 
 namespace planc {
+/**
+ * Header of a version 1.0 npy file of little endian doubles with the
+ * given shape. It is padded with spaces so that the data starts at a
+ * multiple of 64 bytes and can be written at that offset directly.
+ * @param[in] dims shape of the array
+ * @param[in] fortran_order true for column major data
+ */
+inline std::string npyHeader(const UVEC& dims, const bool fortran_order) {
+  std::stringstream ss;
+  ss << "{'descr': '<f8', 'fortran_order': "
+     << (fortran_order ? "True" : "False") << ", 'shape': (";
+  for (UWORD i = 0; i < dims.n_elem; i++) {
+    ss << dims[i] << (dims.n_elem == 1 || i + 1 < dims.n_elem ? "," : "");
+    if (i + 1 < dims.n_elem) ss << " ";
+  }
+  ss << "), }";
+  std::string dict = ss.str();
+  // magic, version and the header length take 10 bytes
+  size_t total = 10 + dict.size() + 1;
+  total = (total + 63) / 64 * 64;
+  dict.append(total - 10 - dict.size() - 1, ' ');
+  dict.push_back('\n');
+  uint16_t len = dict.size();
+  std::string header("\x93NUMPY\x01\x00", 8);
+  header.push_back(static_cast<char>(len & 0xff));
+  header.push_back(static_cast<char>(len >> 8));
+  return header + dict;
+}
+
+/// Reverses the bytes of n doubles of the other endianness in place
+inline void byteswapDoubles(double* x, const UWORD n) {
+  for (UWORD i = 0; i < n; i++) {
+    char* c = reinterpret_cast<char*>(x + i);
+    std::reverse(c, c + sizeof(double));
+  }
+}
+
+/**
+ * Copies a C ordered (row major) array of the given shape into the
+ * Fortran (column major) order used by MAT and Tensor.
+ * @param[in] in C ordered data
+ * @param[in] dims shape of the array
+ * @param[out] out Fortran ordered data of the same size
+ */
+inline void cToFortranOrder(const double* in, const UVEC& dims,
+                            double* out) {
+  const UWORD modes = dims.n_elem;
+  if (modes == 0) return;
+  std::vector<UWORD> strides(modes, 1);
+  for (UWORD i = 1; i < modes; i++) strides[i] = strides[i - 1] * dims[i - 1];
+  UWORD numel = arma::prod(dims);
+  std::vector<UWORD> sub(modes, 0);
+  UWORD off = 0;
+  for (UWORD l = 0; l < numel; l++) {
+    out[off] = in[l];
+    // the last mode runs fastest in C order
+    for (UWORD d = modes; d-- > 0;) {
+      off += strides[d];
+      if (++sub[d] < dims[d]) break;
+      off -= strides[d] * dims[d];
+      sub[d] = 0;
+    }
+  }
+}
+
+/**
+ * Writes column major doubles of the given shape as a npy file.
+ * @param[in] fname output file name
+ * @param[in] dims shape of the array
+ * @param[in] data dims.prod() doubles in Fortran order
+ */
+inline bool writeNpy(const std::string& fname, const UVEC& dims,
+                     const double* data) {
+  FILE* fp = fopen(fname.c_str(), "wb");
+  if (fp == NULL) {
+    ERR << "Could not open the file " << fname << std::endl;
+    return false;
+  }
+  std::string header = npyHeader(dims, true);
+  UWORD numel = arma::prod(dims);
+  bool ok = fwrite(header.data(), 1, header.size(), fp) == header.size() &&
+            fwrite(data, sizeof(double), numel, fp) == numel;
+  fclose(fp);
+  if (!ok) ERR << "Could not write the file " << fname << std::endl;
+  return ok;
+}
+/// Writes X as a 2D Fortran ordered npy file
+inline bool writeNpy(const std::string& fname, const MAT& X) {
+  UVEC dims(2);
+  dims[0] = X.n_rows;
+  dims[1] = X.n_cols;
+  return writeNpy(fname, dims, X.memptr());
+}
+/// Writes X as a Fortran ordered npy file with the modes of X
+inline bool writeNpy(const std::string& fname, const Tensor& X) {
+  return writeNpy(fname, X.dimensions(), X.data());
+}
+
 class NumPyArray {
  private:
   int64_t m_word_size;
   bool m_fortran_order;
+  bool m_big_endian;
   int64_t m_modes;
   UVEC m_dims;
-  void parse_npy_header(FILE* fp) {
-    char buffer[256];
-    int64_t res = fread(buffer, sizeof(char), 11, fp);
-    if (res != 11) {
-      ERR << "Something wrong. Could not read header " << std::endl;
-      exit(-1);
-    }
-    buffer[11] = 0;
-    std::cout << "first 11 characters::" << buffer << std::endl;
-
-    std::string header = fgets(buffer, 256, fp);
-    assert(header[header.size() - 1] == '\n');
+  std::shared_ptr<MappedFile> m_mapping;
+  int64_t m_data_offset;
 
+  /**
+   * Parses the header dictionary. The keys may come in any order and
+   * with any spacing.
+   * @return false if the dictionary does not describe an array of doubles
+   */
+  bool parse_header_dict(const std::string& header) {
+    // descr is a quoted type string such as '<f8'
+    size_t loc = header.find("'descr'");
+    if (loc == std::string::npos) return false;
+    size_t q1 = header.find_first_of("'\"", header.find(':', loc) + 1);
+    size_t q2 = header.find_first_of("'\"", q1 + 1);
+    if (q1 == std::string::npos || q2 == std::string::npos || q2 < q1 + 3) {
+      return false;
+    }
+    std::string descr = header.substr(q1 + 1, q2 - q1 - 1);
+    // byte order code | stands for not applicable and = for native
+    this->m_big_endian = descr[0] == '>';
+    this->m_word_size = atoi(descr.c_str() + 2);
+    if (descr[1] != 'f' || this->m_word_size != sizeof(double)) {
+      ERR << "only arrays of doubles are supported. descr::" << descr
+          << std::endl;
+      return false;
+    }
     // fortran order is column major order
     // C order is row major order
-    int64_t loc1 = header.find("fortran_order");
-    loc1 += 16;
-    this->m_fortran_order = (header.substr(loc1, 4) == "True" ? true : false);
-
-    // obtain dimensions
-    loc1 = header.find("(");
-    int64_t loc2 = header.find(")");
-    if (loc1 < 0 || loc2 < 0) {
+    loc = header.find("'fortran_order'");
+    if (loc == std::string::npos) return false;
+    loc = header.find_first_not_of(" ", header.find(':', loc) + 1);
+    this->m_fortran_order = header.compare(loc, 4, "True") == 0;
+    // obtain dimensions. (n,) is a vector and () a scalar.
+    loc = header.find("'shape'");
+    if (loc == std::string::npos) return false;
+    size_t loc1 = header.find('(', loc);
+    size_t loc2 = header.find(')', loc1);
+    if (loc1 == std::string::npos || loc2 == std::string::npos) {
       ERR << "could not find ()" << std::endl;
-      exit(-1);
-    }
-
-    std::string str_shape = header.substr(loc1 + 1, loc2 - loc1 - 1);
-    if (str_shape[str_shape.size() - 1] == ',') {
-      this->m_modes = 1;
-    } else {
-      this->m_modes = std::count(str_shape.begin(), str_shape.end(), ',') + 1;
+      return false;
     }
-    this->m_dims = arma::zeros<UVEC>(m_modes);
-
-    std::stringstream ss(str_shape);
+    std::stringstream ss(header.substr(loc1 + 1, loc2 - loc1 - 1));
+    std::vector<UWORD> dims;
     std::string s;
-    ss.str(str_shape);
-    int64_t i = 0;
     while (getline(ss, s, ',')) {
-      this->m_dims[i++] = ::atoi(s.c_str());
+      if (s.find_first_of("0123456789") != std::string::npos) {
+        dims.push_back(strtoull(s.c_str(), NULL, 10));
+      }
     }
-    // endian, word size, data type
-    // byte order code | stands for not applicable.
-    // not sure when this applies except for byte array
-    loc1 = header.find("descr");
-    loc1 += 9;
-    bool littleEndian =
-        (header[loc1] == '<' || header[loc1] == '|' ? true : false);
-    assert(littleEndian);
-
-    std::string word_size = header.substr(loc1 + 2);
-    loc2 = word_size.find("'");
-    this->m_word_size = atoi(word_size.substr(0, loc2).c_str());
+    if (dims.empty()) dims.push_back(1);
+    this->m_modes = dims.size();
+    this->m_dims = arma::conv_to<UVEC>::from(dims);
+    return true;
+  }
+  /**
+   * Reads the magic string, the version and the header dictionary and
+   * leaves fp at the first element. Versions 1.0 to 3.0 are understood.
+   */
+  bool parse_npy_header(FILE* fp) {
+    unsigned char preamble[8];
+    if (fread(preamble, 1, 8, fp) != 8 ||
+        std::memcmp(preamble, "\x93NUMPY", 6) != 0) {
+      ERR << "Something wrong. Could not read header " << std::endl;
+      return false;
+    }
+    // version 1.0 has a 2 byte header length. later versions 4 bytes.
+    int lenbytes = preamble[6] == 1 ? 2 : 4;
+    unsigned char len_le[4] = {0, 0, 0, 0};
+    if (fread(len_le, 1, lenbytes, fp) != static_cast<size_t>(lenbytes)) {
+      return false;
+    }
+    uint32_t len = len_le[0] | (len_le[1] << 8) | (len_le[2] << 16) |
+                   (static_cast<uint32_t>(len_le[3]) << 24);
+    std::string header(len, ' ');
+    if (fread(&header[0], 1, len, fp) != len) return false;
+    this->m_data_offset = 8 + lenbytes + len;
+    return parse_header_dict(header);
   }
 
  public:
@@ -77,31 +206,120 @@ class NumPyArray {
   NumPyArray() {
     this->m_word_size = 0;
     this->m_fortran_order = false;
+    this->m_big_endian = false;
     this->m_modes = 0;
+    this->m_data_offset = 0;
+    this->m_input_tensor = NULL;
+  }
+  /**
+   * Parses only the header of fname. dims, fortran_order, big_endian and
+   * data_offset describe the array afterwards.
+   * @return false if fname is not a npy file of doubles
+   */
+  bool read_header(std::string fname) {
+    FILE* fp = fopen(fname.c_str(), "rb");
+    if (fp == NULL) {
+      ERR << "Could not load the file " << fname << std::endl;
+      return false;
+    }
+    bool ok = parse_npy_header(fp);
+    fclose(fp);
+    return ok;
   }
+  /// Reads the whole array into m_input_tensor in Fortran order
   void load(std::string fname) {
     FILE* fp = fopen(fname.c_str(), "rb");
     if (fp == NULL) {
       ERR << "Could not load the file " << fname << std::endl;
       exit(-1);
     }
-    parse_npy_header(fp);
+    if (!parse_npy_header(fp)) exit(-1);
     this->m_input_tensor = new Tensor(this->m_dims);
-    int64_t nread = fread(&m_input_tensor->m_data[0],
-                          sizeof(std::vector<double>::value_type),
+    std::vector<double> cbuf;
+    double* dst = m_input_tensor->data();
+    if (!this->m_fortran_order) {
+      cbuf.resize(m_input_tensor->numel());
+      dst = &cbuf[0];
+    }
+    int64_t nread = fread(dst, sizeof(std::vector<double>::value_type),
                           m_input_tensor->numel(), fp);
+    fclose(fp);
     if (nread != m_input_tensor->numel()) {
       WARN << "something wrong ::read::" << nread
            << "::numel::" << this->m_input_tensor->numel()
            << "::word_size::" << this->m_word_size << std::endl;
     }
+    if (this->m_big_endian) byteswapDoubles(dst, nread);
+    if (!this->m_fortran_order) {
+      cToFortranOrder(dst, this->m_dims, m_input_tensor->data());
+    }
+  }
+  /**
+   * Maps the array into memory instead of reading it. m_input_tensor
+   * becomes a view of the mapping that stays valid until the tensor is
+   * deleted. Only little endian, Fortran ordered doubles can be mapped.
+   * @param[in] fname of the npy file
+   * @return false if the file could not be opened, parsed or mapped. The
+   *         caller decides whether to load it instead or to fail.
+   */
+  bool map(std::string fname) {
+    FILE* fp = fopen(fname.c_str(), "rb");
+    if (fp == NULL) {
+      ERR << "Could not load the file " << fname << std::endl;
+      return false;
+    }
+    bool parsed = parse_npy_header(fp);
+    fclose(fp);
+    if (!parsed) return false;
+    if (this->m_big_endian || !this->m_fortran_order) {
+      WARN << "cannot map big endian or C ordered " << fname << std::endl;
+      return false;
+    }
+    // the header is padded so the data offset is aligned for doubles
+    int64_t offset = this->m_data_offset;
+    std::shared_ptr<MappedFile> mapping(new MappedFile(fname));
+    UWORD numel = arma::prod(this->m_dims);
+    if (!mapping->is_open() ||
+        mapping->size() < offset + numel * sizeof(double)) {
+      WARN << "could not map " << fname << "::numel::" << numel << std::endl;
+      return false;
+    }
+    this->m_mapping = mapping;
+    this->m_input_tensor =
+        new Tensor(this->m_dims, mapping->doubles(offset), false, mapping);
+    return true;
   }
+  /// mapping of the last map call. Keeps mapped_data alive.
+  std::shared_ptr<MappedFile> mapping() const { return this->m_mapping; }
+  /// first element of the mapped array
+  double* mapped_data() const {
+    return this->m_mapping->doubles(this->m_data_offset);
+  }
+  /// true if the array is stored in column major order
+  bool fortran_order() const { return this->m_fortran_order; }
+  /// true if the doubles are stored big endian
+  bool big_endian() const { return this->m_big_endian; }
+  /// byte offset of the first element in the file
+  int64_t data_offset() const { return this->m_data_offset; }
+  /// dimensions of the array
+  const UVEC& dims() const { return this->m_dims; }
   void printInfo() {
     INFO << "modes::" << this->m_modes << "::dims::" << std::endl
          << this->m_dims << "::fortran_order::" << this->m_fortran_order
          << "::word_size::" << this->m_word_size << std::endl;
   }
 };
+
+/**
+ * Shape of the npy file fname read from its header only. Empty if fname
+ * is not a npy file of doubles. Uses plain file IO, so the drivers can
+ * take the global sizes before MPI is initialized and the grid is set up.
+ */
+inline UVEC npyShape(const std::string& fname) {
+  NumPyArray npy;
+  if (!npy.read_header(fname)) return UVEC();
+  return npy.dims();
+}
 }  // namespace planc
 
 #endif  // COMMON_NPYIO_HPP_
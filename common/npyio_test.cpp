@@ -0,0 +1,178 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+
+#include <mpi.h>
+#include <armadillo>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include "common/distnpyio.hpp"
+#include "common/npyio.hpp"
+#include "common/utils.h"
+
+/**
+ * Checks the npy header parser, cToFortranOrder and the block read of
+ * DistNumPyArray. Run with any number of MPI processes.
+ */
+
+static int failures = 0;
+
+static void check(const bool ok, const std::string &what) {
+  if (!ok) {
+    INFO << "FAILED::" << what << std::endl;
+    failures++;
+  }
+}
+
+/// Header of a version 2.0 file, which has a 4 byte header length
+static std::string npyHeaderV2(std::string dict) {
+  size_t total = (12 + dict.size() + 1 + 63) / 64 * 64;
+  dict.append(total - 12 - dict.size() - 1, ' ');
+  dict.push_back('\n');
+  uint32_t len = dict.size();
+  std::string header("\x93NUMPY\x02\x00", 8);
+  for (int i = 0; i < 4; i++) header.push_back((len >> (8 * i)) & 0xff);
+  return header + dict;
+}
+
+static void writeFile(const std::string &fname, const std::string &header,
+                      const std::vector<double> &data) {
+  std::ofstream out(fname.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(header.data(), header.size());
+  out.write(reinterpret_cast<const char *>(&data[0]),
+            data.size() * sizeof(double));
+}
+
+int main(int argc, char *argv[]) {
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  std::string cfile = "npyio_test_c.npy";
+  std::string v2file = "npyio_test_v2.npy";
+  std::string vecfile = "npyio_test_vec.npy";
+  std::string scalarfile = "npyio_test_scalar.npy";
+  std::string f4file = "npyio_test_f4.npy";
+
+  // 3 x 4 in C order with the value 10i + j at (i, j)
+  UVEC shape(2);
+  shape[0] = 3;
+  shape[1] = 4;
+  std::string cheader = planc::npyHeader(shape, false);
+  std::vector<double> cdata(12);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) cdata[i * 4 + j] = 10 * i + j;
+  }
+  if (rank == 0) {
+    writeFile(cfile, cheader, cdata);
+    writeFile(v2file,
+              npyHeaderV2("{'shape':(2,3,4) ,'descr' : '<f8',"
+                          "  'fortran_order':True}"),
+              std::vector<double>(24, 1.0));
+    writeFile(vecfile,
+              npyHeaderV2("{'descr': '<f8', 'fortran_order': False, "
+                          "'shape': (5,), }"),
+              std::vector<double>(5, 1.0));
+    writeFile(scalarfile,
+              npyHeaderV2("{'descr': '<f8', 'fortran_order': False, "
+                          "'shape': (), }"),
+              std::vector<double>(1, 1.0));
+    writeFile(f4file,
+              npyHeaderV2("{'descr': '<f4', 'fortran_order': False, "
+                          "'shape': (2,), }"),
+              std::vector<double>(1, 1.0));
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  // header written by npyHeader
+  check(cheader.size() % 64 == 0, "npyHeader pads to 64 bytes");
+  planc::NumPyArray c;
+  check(c.read_header(cfile), "read_header of npyHeader");
+  check(c.dims().n_elem == 2 && c.dims()[0] == 3 && c.dims()[1] == 4,
+        "shape of npyHeader");
+  check(!c.fortran_order() && !c.big_endian(), "order of npyHeader");
+  check(c.data_offset() == static_cast<int64_t>(cheader.size()),
+        "data offset of npyHeader");
+  UVEC cshape = planc::npyShape(cfile);
+  check(cshape.n_elem == 2 && cshape[0] == 3 && cshape[1] == 4, "npyShape");
+
+  // version 2.0, other key order and spacing
+  planc::NumPyArray v2;
+  check(v2.read_header(v2file), "read_header of version 2.0");
+  check(v2.dims().n_elem == 3 && v2.dims()[0] == 2 && v2.dims()[1] == 3 &&
+            v2.dims()[2] == 4,
+        "shape of version 2.0");
+  check(v2.fortran_order(), "order of version 2.0");
+  check(v2.data_offset() % 64 == 0, "data offset of version 2.0");
+
+  // (5,) is a vector and () a scalar
+  UVEC vshape = planc::npyShape(vecfile);
+  check(vshape.n_elem == 1 && vshape[0] == 5, "shape of a vector");
+  UVEC sshape = planc::npyShape(scalarfile);
+  check(sshape.n_elem == 1 && sshape[0] == 1, "shape of a scalar");
+  check(planc::npyShape(f4file).n_elem == 0, "floats are rejected");
+
+  // cToFortranOrder of a 2 x 3 x 4 array with 100i + 10j + l at (i, j, l)
+  UVEC dims(3);
+  dims[0] = 2;
+  dims[1] = 3;
+  dims[2] = 4;
+  std::vector<double> in(24), out(24, -1);
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 3; j++) {
+      for (int l = 0; l < 4; l++) {
+        in[(i * 3 + j) * 4 + l] = 100 * i + 10 * j + l;
+      }
+    }
+  }
+  planc::cToFortranOrder(&in[0], dims, &out[0]);
+  bool reordered = true;
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 3; j++) {
+      for (int l = 0; l < 4; l++) {
+        reordered = reordered && out[i + 2 * (j + 3 * l)] ==
+                                     100 * i + 10 * j + l;
+      }
+    }
+  }
+  check(reordered, "cToFortranOrder");
+
+  // load of a C ordered file gives the column major array
+  planc::NumPyArray loaded;
+  loaded.load(cfile);
+  const double *ld = loaded.m_input_tensor->data();
+  bool load_ok = true;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) {
+      load_ok = load_ok && ld[i + 3 * j] == 10 * i + j;
+    }
+  }
+  check(load_ok, "load of C order");
+  delete loaded.m_input_tensor;
+
+  // block (1:2, 1:2) of the C ordered file on every process
+  planc::DistNumPyArray dnpy(MPI_COMM_WORLD);
+  check(dnpy.open(cfile), "DistNumPyArray open");
+  check(dnpy.dims().n_elem == 2 && dnpy.dims()[0] == 3 && dnpy.dims()[1] == 4,
+        "DistNumPyArray shape");
+  UVEC starts(2), counts(2);
+  starts.fill(1);
+  counts.fill(2);
+  double block[4] = {0, 0, 0, 0};
+  check(dnpy.read(cfile, starts, counts, block), "DistNumPyArray read");
+  check(block[0] == 11 && block[1] == 21 && block[2] == 12 && block[3] == 22,
+        "DistNumPyArray block in column major order");
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (rank == 0) {
+    std::remove(cfile.c_str());
+    std::remove(v2file.c_str());
+    std::remove(vecfile.c_str());
+    std::remove(scalarfile.c_str());
+    std::remove(f4file.c_str());
+  }
+  int all_failures = 0;
+  MPI_Allreduce(&failures, &all_failures, 1, MPI_INT, MPI_SUM,
+                MPI_COMM_WORLD);
+  if (rank == 0) INFO << (all_failures ? "FAILED" : "PASSED") << std::endl;
+  MPI_Finalize();
+  return all_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -3,9 +3,21 @@
 #ifndef COMMON_NTF_UTILS_HPP_
 #define COMMON_NTF_UTILS_HPP_
 
+#include <omp.h>
+#include <algorithm>
+#include <vector>
 #include "common/ncpfactors.hpp"
+#include "common/sparsetensor.hpp"
 #include "common/tensor.hpp"
 
+// input tensor of AUNTF and DistAUNTF. sparse builds factorize a
+// SparseTensor with the same update algorithms.
+#ifdef BUILD_SPARSE
+#define NTFTENSOR planc::SparseTensor
+#else
+#define NTFTENSOR planc::Tensor
+#endif
+
 /**
  * Returns the khatri-rao product between two matrices.
  * @param[in] A is of size m x k matrix
@@ -52,4 +64,78 @@ void mttkrp(const int i_n, const planc::Tensor &X, planc::NCPFactors &i_F,
   X.mttkrp(i_n, krp, o_mttkrp);
 }
 
+/**
+ * Same as mttkrp without forming the KRP leaving out i_n. The KRP rows
+ * are generated by KRPTiles in tiles of kKRPBlockRows rows per thread
+ * and every tile is multiplied with the matching columns of the
+ * unfolding right away. Threads accumulate private outputs that are
+ * summed.
+ * @param[in] mode i_n
+ * @param[in] Tensor X
+ * @param[in] NCPFactors
+ * @param[out] MTTKRP of factor mode i_n of size k x X.dimensions(i_n)
+ */
+void mttkrp_fused(const int i_n, const planc::Tensor &X,
+                  const planc::NCPFactors &i_F, MAT *o_mttkrp) {
+  const int k = i_F.rank();
+  const int dn = X.dimensions()(i_n);
+  int ncols = 1;
+  for (int i = 0; i < i_n; i++) ncols *= X.dimensions()(i);
+  const planc::KRPTiles tiles = i_F.krp_tiles_leave_out_one(i_n);
+  const UWORD nblocks = tiles.n_tiles();
+  const double *Xdata = X.data();
+  o_mttkrp->zeros(k, dn);
+  // every thread runs its own dgemm. keep BLAS single threaded inside.
+  int blasThreads = get_blas_num_threads();
+  set_blas_num_threads(1);
+#pragma omp parallel
+  {
+    MAT local_mttkrp = arma::zeros<MAT>(k, dn);
+    // transposed KRP block. column q is the KRP row q0 + q.
+    MAT krpt_blk(k, tiles.tile_rows());
+    MAT scratch;
+#pragma omp for schedule(static)
+    for (UWORD b = 0; b < nblocks; b++) {
+      UWORD q0 = b * tiles.tile_rows();
+      UWORD len = tiles.tile_t(b, &krpt_blk, &scratch);
+      UWORD q1 = q0 + len;
+      if (i_n == 0) {
+        // KRP rows are the columns of the mode 0 unfolding
+        cblas_dgemm(CblasColMajor, CblasNoTrans, CblasTrans, k, dn, len, 1.0,
+                    krpt_blk.memptr(), k, Xdata + q0 * dn, dn, 1.0,
+                    local_mttkrp.memptr(), k);
+      } else {
+        // a slice of the modes after i_n is a ncols x dn matrix. split
+        // the block at the slice boundaries.
+        for (UWORD s0 = q0; s0 < q1;) {
+          UWORD slice = s0 / ncols;
+          UWORD c0 = s0 % ncols;
+          UWORD seglen = std::min<UWORD>(q1 - s0, ncols - c0);
+          cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, k, dn,
+                      seglen, 1.0, krpt_blk.colptr(s0 - q0), k,
+                      Xdata + slice * ncols * dn + c0, ncols, 1.0,
+                      local_mttkrp.memptr(), k);
+          s0 += seglen;
+        }
+      }
+    }
+#pragma omp critical
+    (*o_mttkrp) += local_mttkrp;
+  }
+  set_blas_num_threads(blasThreads);
+}
+
+/**
+ * Sparse overload of mttkrp_fused. The sparse MTTKRP walks the CSF
+ * tree of mode i_n and never forms the KRP either.
+ * @param[in] mode i_n
+ * @param[in] SparseTensor X
+ * @param[in] NCPFactors
+ * @param[out] MTTKRP of factor mode i_n of size k x X.dimensions(i_n)
+ */
+void mttkrp_fused(const int i_n, const planc::SparseTensor &X,
+                  const planc::NCPFactors &i_F, MAT *o_mttkrp) {
+  X.mttkrp(i_n, i_F, o_mttkrp);
+}
+
 #endif // COMMON_NTF_UTILS_HPP_
@@ -24,6 +24,14 @@
 #define ADJRAND 2008
 #define NUMLUCITERS 2009
 #define INITSEED 2010
+#define OVERLAPCOMM 2011
+#define MIXEDPRECISION 2012
+#define STOPPOLICY 2013
+#define STOPWINDOW 2014
+#define CHECKPOINT 2015
+#define CHECKPOINTEVERY 2016
+#define RESTART 2017
+#define CORESPERNODE 2018
 
 // enum factorizationtype{FT_NMF, FT_DISTNMF, FT_NTF, FT_DISTNTF};
 
@@ -93,6 +101,14 @@ struct option plancopts[] = {
     {"adjrand", no_argument, 0, ADJRAND},
     {"luciters", required_argument, 0, NUMLUCITERS},
     {"seed", required_argument, 0, INITSEED},
+    {"overlap", required_argument, 0, OVERLAPCOMM},
+    {"mixedprec", required_argument, 0, MIXEDPRECISION},
+    {"stop", required_argument, 0, STOPPOLICY},
+    {"stopwindow", required_argument, 0, STOPWINDOW},
+    {"checkpoint", required_argument, 0, CHECKPOINT},
+    {"checkpointevery", required_argument, 0, CHECKPOINTEVERY},
+    {"restart", required_argument, 0, RESTART},
+    {"corespernode", required_argument, 0, CORESPERNODE},
     {0, 0, 0, 0}};
 
 #endif  // COMMON_PARSECOMMANDLINE_H_
@@ -19,15 +19,23 @@ class ParseCommandLine {
   // common to all algorithms.
   algotype m_lucalgo;
   normtype m_input_normalization;
+  stoptype m_stop_policy;
+  int m_stop_window;
   bool m_compute_error;
   int m_num_it;
   int m_num_k_blocks;
+  bool m_overlap_comm;
+  bool m_mixed_precision;
   bool m_dim_tree;
   bool m_adj_rand;
 
   // file names
   std::string m_Afile_name;
   std::string m_outputfile_name;
+  std::string m_checkpoint_file_name;
+  std::string m_restart_file_name;
+  int m_cores_per_node;
+  int m_checkpoint_every;
   // std::string m_init_file_name;
 
   // nmf related values
@@ -51,6 +59,7 @@ class ParseCommandLine {
   int m_num_modes;
   UVEC m_dimensions;
   UVEC m_proc_grids;
+  bool m_proc_grids_given;
   FVEC m_regularizers;
 
   // LUC params (optional)
@@ -103,9 +112,12 @@ class ParseCommandLine {
     this->m_num_modes = 0;
     this->m_pr = 1;
     this->m_pc = 1;
+    this->m_proc_grids_given = false;
     this->m_regW = arma::zeros<FVEC>(2);
     this->m_regH = arma::zeros<FVEC>(2);
     this->m_num_k_blocks = 1;
+    this->m_overlap_comm = false;
+    this->m_mixed_precision = false;
     this->m_k = 20;
     this->m_num_it = 20;
     this->m_lucalgo = ANLSBPP;
@@ -116,6 +128,10 @@ class ParseCommandLine {
     this->m_adj_rand = false;
     this->m_max_luciters = -1;
     this->m_tolerance = -1;
+    this->m_stop_policy = STOP_RELERR;
+    this->m_stop_window = 5;
+    this->m_checkpoint_every = 10;
+    this->m_cores_per_node = 0;
     this->m_initseed = 193957;  // Random 6 digit prime
   }
   /// parses the command line parameters
@@ -147,9 +163,10 @@ class ParseCommandLine {
           this->m_outputfile_name = temp;
           break;
         }
+        case 'p':
+          this->m_proc_grids_given = true;  // fall through
         case 'd':
         case 'r':
-        case 'p':
           parseArrayofString(opt, optarg);
           break;
         case 's':
@@ -188,6 +205,48 @@ class ParseCommandLine {
         case INITSEED:
           this->m_initseed = atoi(optarg);
           break;
+        case OVERLAPCOMM:
+          this->m_overlap_comm = atoi(optarg);
+          break;
+        case MIXEDPRECISION:
+          this->m_mixed_precision = atoi(optarg);
+          break;
+        case STOPPOLICY: {
+          std::string temp = std::string(optarg);
+          if (temp.compare("relerr") == 0) {
+            this->m_stop_policy = stoptype::STOP_RELERR;
+          } else if (temp.compare("pgrad") == 0) {
+            this->m_stop_policy = stoptype::STOP_PGRAD;
+          } else if (temp.compare("stall") == 0) {
+            this->m_stop_policy = stoptype::STOP_STALL;
+          } else {
+            ERR << "unknown stopping policy " << temp << std::endl;
+            print_usage();
+            exit(EXIT_FAILURE);
+          }
+          break;
+        }
+        case STOPWINDOW:
+          this->m_stop_window = atoi(optarg);
+          if (this->m_stop_window <= 0) {
+            ERR << "stopwindow must be positive. given " << optarg
+                << std::endl;
+            print_usage();
+            exit(EXIT_FAILURE);
+          }
+          break;
+        case CHECKPOINT:
+          this->m_checkpoint_file_name = std::string(optarg);
+          break;
+        case CHECKPOINTEVERY:
+          this->m_checkpoint_every = atoi(optarg);
+          break;
+        case RESTART:
+          this->m_restart_file_name = std::string(optarg);
+          break;
+        case CORESPERNODE:
+          this->m_cores_per_node = atoi(optarg);
+          break;
         case 'h':  // fall through intentionally
           print_usage();
           exit(0);
@@ -230,11 +289,19 @@ class ParseCommandLine {
               << "::n::" << this->m_globaln << "::t::" << this->m_num_it
               << "::pr::" << this->m_pr << "::pc::" << this->m_pc
               << "::error::" << this->m_compute_error  << "::tol::" << this->m_tolerance
+              << "::stop::" << this->m_stop_policy
+              << "::stopwindow::" << this->m_stop_window
+              << "::checkpoint::" << this->m_checkpoint_file_name
+              << "::checkpointevery::" << this->m_checkpoint_every
+              << "::restart::" << this->m_restart_file_name
+              << "::corespernode::" << this->m_cores_per_node
               << "::regW::"
               << "l2::" << this->m_regW(0) << "::l1::" << this->m_regW(1)
               << "::regH::"
               << "l2::" << this->m_regH(0) << "::l1::" << this->m_regH(1)
               << "::num_k_blocks::" << m_num_k_blocks
+              << "::overlap::" << this->m_overlap_comm
+              << "::mixedprec::" << this->m_mixed_precision
               << "::dimensions::" << this->m_dimensions
               << "::procs::" << this->m_proc_grids
               << "::regularizers::" << this->m_regularizers
@@ -344,7 +411,17 @@ class ParseCommandLine {
          << "\t\t -p \"4 1\" is a processor grid of size 4x1"
          << " and is appropriate for matrices." << std::endl
          << "\t\t -p \"5 3 2\" is a processor grid of size 5x3x2"
-         << " and is appropriate for a 3D tensor." << std::endl;
+         << " and is appropriate for a 3D tensor." << std::endl
+         << "\t\t Without -p distnmf, distntf and hiernmf choose the grid"
+         << " that communicates the least for the given -d and -k. This"
+         << " needs -d and an input that can be read on any grid, that"
+         << " is rand_, .npy or sparse2bin files. Otherwise the grid is"
+         << " all ones. A 0 entry such as -p \"4 0\" is chosen the same"
+         << " way and the others are kept." << std::endl;
+    INFO << "\t--corespernode c" << std::endl
+         << "\t\t MPI processes on a node for choosing the grid. Grids"
+         << " whose communicators stay on a node are preferred. Detected"
+         << " if not given." << std::endl;
     INFO << "\t-e [0/1], --error [0/1]" << std::endl
          << "\t\t Flag to compute error after every inner iteration."
          << " This flag is always set to true for shared memory computations"
@@ -372,6 +449,41 @@ class ParseCommandLine {
     INFO << "\t--numkblocks numk" << std::endl
          << "\t\t Compute matrix multiply with blocks of the factor matrix to"
          << " save memory in distnmf. Default is set to 1." << std::endl;
+    INFO << "\t--overlap [0/1]" << std::endl
+         << "\t\t Overlap the allgather and reduce_scatter of one block"
+         << " with the matrix multiply of another in distnmf."
+         << " Needs numkblocks > 1. In distntf, pipelines the mttkrp"
+         << " reduce_scatter, NNLS and factor allgather over numkblocks"
+         << " row chunks (4 if not given). Default is 0." << std::endl;
+    INFO << "\t--mixedprec [0/1]" << std::endl
+         << "\t\t Allgather the factor blocks as float in distnmf and"
+         << " distntf. Reductions, local computations, grams and errors"
+         << " stay in double. Only the allgather volume halves. There is"
+         << " no float build, so the factors and the input use as much"
+         << " memory as without it. Default is 0." << std::endl;
+    INFO << "\t-l tol, --tolerance tol" << std::endl
+         << "\t\t Stop before maxiters once the stopping policy is met"
+         << " with relative tolerance tol. Default is -1, off." << std::endl;
+    INFO << "\t--stop [\"relerr\"/\"pgrad\"/\"stall\"]" << std::endl
+         << "\t\t relerr stops on a small relative change of the error."
+         << " pgrad stops when the projected gradient norm falls below tol"
+         << " times the first one. stall stops when the error does not"
+         << " improve by tol over stopwindow iterations. Applies to"
+         << " distnmf, ntf and distntf. Default is relerr." << std::endl;
+    INFO << "\t--stopwindow w" << std::endl
+         << "\t\t Iterations considered by --stop stall. Default is 5."
+         << std::endl;
+    INFO << "\t--checkpoint file" << std::endl
+         << "\t\t Periodically write the factors, lambda, iteration count"
+         << " and timers of distnmf and distntf to file with MPI-IO."
+         << std::endl;
+    INFO << "\t--checkpointevery n" << std::endl
+         << "\t\t Outer iterations between checkpoints. Default is 10."
+         << std::endl;
+    INFO << "\t--restart file" << std::endl
+         << "\t\t Continue distnmf or distntf from a checkpoint file. The"
+         << " processor grid may differ from the one that wrote it."
+         << std::endl;
     INFO << "\t--normalization [\"l2\"/\"max\"]" << std::endl
          << "\t\t Normalizes the synthetic input matrices in NMF." << std::endl
          << "\t\t\t l2: Normalizes the columns of the input matrix" << std::endl
@@ -440,10 +552,35 @@ class ParseCommandLine {
    */
   UVEC dimensions() { return m_dimensions; }
   int num_k_blocks() { return m_num_k_blocks; }
+  /**
+   * Use nonblocking collectives to overlap the communication of the
+   * k blocks with the matrix multiplies. Passed as --overlap 1
+   */
+  bool overlap_comm() { return m_overlap_comm; }
+  /**
+   * Allgather the factors as float. A run time communication mode only.
+   * The storage precision stays double. Passed as --mixedprec 1
+   */
+  bool mixed_precision() { return m_mixed_precision; }
   /// Returns number of iterations. passed as -t or --iter
   int iterations() { return m_num_it; }
   /// Returns error tolerance for stopping NMF iterations. Passed as -l or --tolerance
   double tolerance() { return m_tolerance; }
+  /**
+   * Stopping policy applied with the tolerance. Passed as
+   * --stop relerr, pgrad or stall
+   */
+  stoptype stop_policy() { return m_stop_policy; }
+  /// Iterations without progress for --stop stall. Passed as --stopwindow
+  int stop_window() { return m_stop_window; }
+  /// Checkpoint file written periodically. Passed as --checkpoint
+  std::string checkpoint_file_name() { return m_checkpoint_file_name; }
+  /// Outer iterations between checkpoints. Passed as --checkpointevery
+  int checkpoint_every() { return m_checkpoint_every; }
+  /// Checkpoint file to continue from. Passed as --restart
+  std::string restart_file_name() { return m_restart_file_name; }
+  /// MPI processes on a node. 0 if not given. Passed as --corespernode
+  int cores_per_node() { return m_cores_per_node; }
   /// Returns number of nodes to compute in a H2NMF tree. Passed as -n or --nodes
   int nodes() { return m_num_nodes; }
   /// Input parameter for generating sparse matrix. Passed as -s or --sparsity
@@ -465,6 +602,8 @@ class ParseCommandLine {
    * Used for distributed NMF. The second parameter of -p. 
    */
   int pc() { return m_pc; }
+  /// Returns true if the processor grid was passed as -p
+  bool proc_grids_given() { return m_proc_grids_given; }
   /// Returns number of modes in tensors. For matrix it is two.
   int num_modes() { return m_num_modes; }
   /**
@@ -0,0 +1,225 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+#ifndef COMMON_PROCGRID_HPP_
+#define COMMON_PROCGRID_HPP_
+
+#include <mpi.h>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "common/sparsebinary.hpp"
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Cost of a word exchanged between processes of one node relative to a
+ * word sent over the network. Makes grids whose communicators stay on a
+ * node cheaper.
+ */
+const double kIntraNodeWordCost = 0.25;
+
+/**
+ * Number of processes on every node if the ranks of comm are placed in
+ * blocks, that is node i holds ranks \f$[ic, (i+1)c)\f$ for the same c
+ * on every node. gridCommCost relies on this placement. Returns 0 if the
+ * launcher placed the ranks in any other way, such as round robin.
+ * Collective over comm so that every process chooses the same grid.
+ */
+inline int ranksPerNode(MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm node;
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+  int local_size, first;
+  MPI_Comm_size(node, &local_size);
+  MPI_Allreduce(&rank, &first, 1, MPI_INT, MPI_MIN, node);
+  MPI_Comm_free(&node);
+  // the local_size ranks of a node are a block if they all lie within
+  // local_size of the first. Equal sizes over the nodes align the blocks.
+  int sizes[2] = {local_size, -local_size};
+  int blocked = (first % local_size == 0) && (rank - first < local_size);
+  int all_blocked;
+  MPI_Allreduce(MPI_IN_PLACE, sizes, 2, MPI_INT, MPI_MIN, comm);
+  MPI_Allreduce(&blocked, &all_blocked, 1, MPI_INT, MPI_LAND, comm);
+  if (!all_blocked || sizes[0] != -sizes[1]) return 0;
+  return local_size;
+}
+
+/**
+ * Modelled communication of one outer iteration on grid per process,
+ * following the MPI-FAUN cost model. The factor of mode n is
+ * allgathered and its product with the input reduce-scattered among the
+ * \f$p/p_n\f$ processes of the slice of mode n. Each collective moves
+ * \f$\frac{I_n}{p_n} k (1 - \frac{p_n}{p})\f$ words, that is
+ * \f$2k \sum_n I_n (\frac{1}{p_n} - \frac{1}{p})\f$ in total. NMF is the
+ * two mode case with \f$p_r \times p_c\f$.
+ *
+ * The Cartesian communicators are created without reordering, so they
+ * number the ranks of MPI_COMM_WORLD in row major order. The slice of
+ * the first mode is therefore a run of consecutive ranks. It stays on
+ * one node if its size divides ranks_per_node and the ranks are placed
+ * in blocks of ranks_per_node, see ranksPerNode. Its words are weighted
+ * by kIntraNodeWordCost then.
+ * @param[in] global_dims global size of every mode
+ * @param[in] grid processes of every mode
+ * @param[in] k low rank
+ * @param[in] ranks_per_node size of the blocks of consecutive ranks on
+ *            a node. 0 if unknown or not blocked.
+ */
+inline double gridCommCost(const UVEC &global_dims, const UVEC &grid,
+                           const int k, const int ranks_per_node) {
+  double p = arma::prod(grid);
+  double cost = 0;
+  for (UWORD n = 0; n < grid.n_elem; n++) {
+    double words = 2.0 * k * global_dims[n] * (1.0 / grid[n] - 1.0 / p);
+    UWORD slice_size = p / grid[n];
+    if (n == 0 && ranks_per_node > 0 && ranks_per_node % slice_size == 0) {
+      words *= kIntraNodeWordCost;
+    }
+    cost += words;
+  }
+  return cost;
+}
+
+/**
+ * Appends every grid of remaining processes over the modes from mode
+ * on to grids. Positive entries of grid are kept as they are.
+ */
+inline void enumerateGrids(const UWORD mode, const UWORD remaining,
+                           UVEC *grid, std::vector<UVEC> *grids) {
+  if (mode == grid->n_elem) {
+    if (remaining == 1) grids->push_back(*grid);
+    return;
+  }
+  if ((*grid)[mode] > 0) {
+    if (remaining % (*grid)[mode] == 0) {
+      enumerateGrids(mode + 1, remaining / (*grid)[mode], grid, grids);
+    }
+    return;
+  }
+  for (UWORD d = 1; d <= remaining; d++) {
+    if (remaining % d != 0) continue;
+    (*grid)[mode] = d;
+    enumerateGrids(mode + 1, remaining / d, grid, grids);
+  }
+  (*grid)[mode] = 0;
+}
+
+/// true if global_dims has a positive size for each of the modes
+inline bool knownDims(const UVEC &global_dims, const UWORD modes) {
+  return global_dims.n_elem == modes && arma::all(global_dims > 0);
+}
+
+/**
+ * True if the input can be read on any processor grid. These are the
+ * generated rand_ inputs, npy arrays and the binary sparse container of
+ * utilities/sparse2bin. The other files, such as the A_p_rank text
+ * blocks, were split for the grid they were written on.
+ */
+inline bool gridAgnosticInput(const std::string &file_name) {
+  if (file_name.compare(0, 5, "rand_") == 0) return true;
+  if (file_name.size() > 4 &&
+      file_name.compare(file_name.size() - 4, 4, ".npy") == 0) {
+    return true;
+  }
+  std::ifstream in(file_name.c_str(), std::ios::binary);
+  SparseBinaryHeader header;
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+    return false;
+  }
+  return SparseBinaryLayout(header).valid();
+}
+
+/**
+ * The grid to set up from the command line. A grid is only chosen when
+ * the global dimensions are known and the input can be read on any
+ * grid. Then a grid that was not given is chosen entirely, and the 0
+ * entries of a given grid are chosen. The result has 0 for the entries
+ * to choose. Otherwise the 0 entries become 1, which is the default
+ * grid when -p is not given.
+ * @param[in] given grid of the command line. All ones if not given.
+ * @param[in] was_given true if the grid was passed as -p
+ * @param[in] global_dims global size of every mode. 0 if unknown.
+ * @param[in] any_grid_input input can be read on any grid
+ */
+inline UVEC requestedGrid(const UVEC &given, const bool was_given,
+                          const UVEC &global_dims,
+                          const bool any_grid_input) {
+  UVEC grid = given;
+  if (!any_grid_input || !knownDims(global_dims, grid.n_elem)) {
+    grid.elem(arma::find(grid == 0)).ones();
+  } else if (!was_given) {
+    grid.zeros();
+  }
+  return grid;
+}
+
+/**
+ * Chooses the processor grid with the least gridCommCost. Grids that give
+ * a mode more processes than it has rows are only used if nothing else
+ * fits.
+ * @param[in] global_dims global size of every mode
+ * @param[in] k low rank
+ * @param[in] nprocs number of MPI processes
+ * @param[in] ranks_per_node consecutive ranks on a node. 0 if unknown.
+ * @param[in] fixed processes of every mode. Zero entries are chosen.
+ * @param[in] equal only grids with the same processes in every mode
+ * @return the grid, or an empty vector if none multiplies to nprocs
+ */
+inline UVEC chooseProcGrid(const UVEC &global_dims, const int k,
+                           const int nprocs, const int ranks_per_node,
+                           const UVEC &fixed, const bool equal = false) {
+  UVEC grid = fixed;
+  std::vector<UVEC> grids;
+  enumerateGrids(0, nprocs, &grid, &grids);
+  UVEC best_fit, best_any;
+  double cost_fit = std::numeric_limits<double>::max();
+  double cost_any = cost_fit;
+  for (unsigned int i = 0; i < grids.size(); i++) {
+    if (equal && arma::any(grids[i] != grids[i][0])) continue;
+    double cost = gridCommCost(global_dims, grids[i], k, ranks_per_node);
+    if (cost < cost_any) {
+      cost_any = cost;
+      best_any = grids[i];
+    }
+    if (arma::all(grids[i] <= global_dims) && cost < cost_fit) {
+      cost_fit = cost;
+      best_fit = grids[i];
+    }
+  }
+  return best_fit.n_elem > 0 ? best_fit : best_any;
+}
+
+/**
+ * Collectively chooses the grid of comm with chooseProcGrid. The root
+ * reports the grid and its modelled cost.
+ * @param[in] ranks_per_node processes on a node. 0 detects it. A given
+ *            value asserts that the ranks are placed in blocks.
+ */
+inline UVEC autoProcGrid(MPI_Comm comm, const UVEC &global_dims,
+                         const int k, int ranks_per_node, const UVEC &fixed,
+                         const bool equal = false) {
+  int rank, nprocs;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nprocs);
+  if (ranks_per_node <= 0) ranks_per_node = ranksPerNode(comm);
+  UVEC grid = chooseProcGrid(global_dims, k, nprocs, ranks_per_node, fixed,
+                             equal);
+  if (rank == 0) {
+    if (grid.n_elem == 0) {
+      ERR << "no processor grid of " << nprocs << " processes fits "
+          << fixed.t();
+    } else {
+      INFO << "chosen processor grid::" << grid.t()
+           << "ranks per node::" << ranks_per_node << "::modelled words::"
+           << gridCommCost(global_dims, grid, k, ranks_per_node)
+           << std::endl;
+    }
+  }
+  return grid;
+}
+
+}  // namespace planc
+
+#endif  // COMMON_PROCGRID_HPP_
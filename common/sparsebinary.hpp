@@ -0,0 +1,92 @@
+/* Copyright 2016 Ramakrishnan Kannan */
+#ifndef COMMON_SPARSEBINARY_HPP_
+#define COMMON_SPARSEBINARY_HPP_
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace planc {
+
+/**
+ * Binary container of a sparse matrix in global coordinate form. The file
+ * does not depend on the processor grid. It is a header followed by nnz
+ * entries of global row, global column and value in any order. All
+ * integers are native uint64 and all values native double.
+ *
+ * | section | content |
+ * |---------|---------|
+ * | header  | SparseBinaryHeader |
+ * | entries | nnz SparseBinaryEntry |
+ *
+ * Every rank reads one contiguous \f$nnz/p\f$ range of entries and sends
+ * every entry to the rank that owns its itersplit/startidx block. A file
+ * can therefore be read on any grid, and is written in one pass over the
+ * coordinate input with constant memory.
+ */
+struct SparseBinaryHeader {
+  char magic[8];
+  uint64_t version;
+  uint64_t m;
+  uint64_t n;
+  uint64_t nnz;
+  uint64_t reserved[3];
+};
+
+struct SparseBinaryEntry {
+  uint64_t row;
+  uint64_t col;
+  double value;
+};
+
+class SparseBinaryLayout {
+ private:
+  SparseBinaryHeader m_header;
+
+ public:
+  static const char *magic() { return "PLANCSPB"; }
+  static const uint64_t kVersion = 2;
+
+  explicit SparseBinaryLayout(const SparseBinaryHeader &header)
+      : m_header(header) {}
+  /// Header of a new file for an m x n matrix with nnz non zeros
+  static SparseBinaryHeader header(uint64_t m, uint64_t n, uint64_t nnz) {
+    SparseBinaryHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, magic(), sizeof(h.magic));
+    h.version = kVersion;
+    h.m = m;
+    h.n = n;
+    h.nnz = nnz;
+    return h;
+  }
+  /// Returns true if the header was written by this layout
+  bool valid() const {
+    return std::memcmp(m_header.magic, magic(), sizeof(m_header.magic)) == 0 &&
+           m_header.version == kVersion;
+  }
+  const SparseBinaryHeader &header() const { return m_header; }
+
+  /// Same as itersplit. Size of split r of n into p.
+  static uint64_t split(uint64_t n, uint64_t p, uint64_t r) {
+    return (r < n % p) ? n / p + 1 : n / p;
+  }
+  /// Same as startidx. First index of split r of n into p.
+  static uint64_t start(uint64_t n, uint64_t p, uint64_t r) {
+    uint64_t rem = n % p;
+    return (r < rem) ? r * (n / p + 1) : rem * (n / p + 1) + (r - rem) * (n / p);
+  }
+  /// Split of n into p that holds index i. Inverse of start.
+  static uint64_t owner(uint64_t i, uint64_t n, uint64_t p) {
+    uint64_t rem = n % p;
+    uint64_t big = n / p + 1;
+    return (i < rem * big) ? i / big : rem + (i - rem * big) / (n / p);
+  }
+
+  /// Byte offset of the entry at position nzidx
+  uint64_t entry_offset(uint64_t nzidx) const {
+    return sizeof(SparseBinaryHeader) + nzidx * sizeof(SparseBinaryEntry);
+  }
+};
+
+}  // namespace planc
+#endif  // COMMON_SPARSEBINARY_HPP_
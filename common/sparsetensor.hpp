@@ -0,0 +1,408 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef COMMON_SPARSETENSOR_HPP_
+#define COMMON_SPARSETENSOR_HPP_
+
+#include <omp.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/ncpfactors.hpp"
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Compressed sparse fiber tree of a sparse tensor. Level 0 is the root
+ * mode and every level below is one of the other modes. A fiber at
+ * level l owns the fibers fptr[l][f] to fptr[l][f+1]-1 of level l+1.
+ * The last level has one entry per non zero.
+ */
+struct CSFTree {
+  std::vector<int> order;                  /// mode of every level
+  std::vector<std::vector<UWORD> > fptr;   /// children of every fiber
+  std::vector<std::vector<UWORD> > fids;   /// subscript of every fiber
+  std::vector<double> vals;                /// values of the leaves
+};
+
+/**
+ * Sparse tensor for count data that cannot be densified. The non zeros
+ * are kept as coordinates (COO) for I/O and the error. For the MTTKRP
+ * one CSF tree is built per mode with that mode as the root, so the
+ * MTTKRP of any mode runs over independent root slices without atomics.
+ * This costs modes copies of the subscripts and values.
+ * It has the same accessors as the dense Tensor that AUNTF and
+ * DistAUNTF use.
+ */
+class SparseTensor {
+ private:
+  int m_modes;
+  UVEC m_dimensions;
+  UVEC m_global_idx;
+  // column j holds the subscripts of the non zero j
+  UMAT m_subs;
+  VEC m_vals;
+  std::vector<CSFTree> m_csf;
+
+  /// Builds the CSF tree with mode i_root as the root.
+  void build_csf(const int i_root, CSFTree *o_tree) const {
+    CSFTree &t = *o_tree;
+    const UWORD nnz = m_vals.n_elem;
+    t.order.clear();
+    t.order.push_back(i_root);
+    for (int i = 0; i < m_modes; i++) {
+      if (i != i_root) t.order.push_back(i);
+    }
+    const int nlevels = m_modes;
+    std::vector<UWORD> perm(nnz);
+    for (UWORD j = 0; j < nnz; j++) perm[j] = j;
+    const UMAT &subs = m_subs;
+    const std::vector<int> &order = t.order;
+    std::sort(perm.begin(), perm.end(), [&subs, &order](UWORD a, UWORD b) {
+      for (unsigned int l = 0; l < order.size(); l++) {
+        if (subs(order[l], a) != subs(order[l], b)) {
+          return subs(order[l], a) < subs(order[l], b);
+        }
+      }
+      return false;
+    });
+    t.fptr.assign(nlevels - 1, std::vector<UWORD>());
+    t.fids.assign(nlevels, std::vector<UWORD>());
+    t.vals.resize(nnz);
+    t.fids[nlevels - 1].reserve(nnz);
+    for (UWORD j = 0; j < nnz; j++) {
+      UWORD p = perm[j];
+      // first level where this non zero leaves the fibers of the
+      // previous one. Every level below it starts a new fiber.
+      int first = 0;
+      if (j > 0) {
+        UWORD prev = perm[j - 1];
+        while (first < nlevels - 1 &&
+               subs(order[first], p) == subs(order[first], prev)) {
+          first++;
+        }
+      }
+      for (int l = first; l < nlevels - 1; l++) {
+        t.fids[l].push_back(subs(order[l], p));
+        t.fptr[l].push_back(t.fids[l + 1].size());
+      }
+      t.fids[nlevels - 1].push_back(subs(order[nlevels - 1], p));
+      t.vals[j] = m_vals(p);
+    }
+    for (int l = 0; l < nlevels - 1; l++) {
+      t.fptr[l].push_back(t.fids[l + 1].size());
+    }
+  }
+
+  /**
+   * Sums the fibers [i_begin, i_end) of level i_level. Every fiber
+   * contributes its factor row hadamard with the sum of its children.
+   * @param[in] Ut transposed factors of every mode
+   * @param[out] o_sum k vector. scratch holds one k vector per level.
+   */
+  void csf_sum(const CSFTree &t, const std::vector<MAT> &Ut, int i_level,
+               UWORD i_begin, UWORD i_end, double *scratch,
+               double *o_sum) const {
+    const int k = Ut[0].n_rows;
+    const MAT &U = Ut[t.order[i_level]];
+    const std::vector<UWORD> &fids = t.fids[i_level];
+    for (int r = 0; r < k; r++) o_sum[r] = 0;
+    if (i_level == m_modes - 1) {
+      for (UWORD f = i_begin; f < i_end; f++) {
+        const double *u = U.colptr(fids[f]);
+        const double v = t.vals[f];
+        for (int r = 0; r < k; r++) o_sum[r] += v * u[r];
+      }
+      return;
+    }
+    double *child = scratch;
+    const std::vector<UWORD> &fptr = t.fptr[i_level];
+    for (UWORD f = i_begin; f < i_end; f++) {
+      csf_sum(t, Ut, i_level + 1, fptr[f], fptr[f + 1], scratch + k, child);
+      const double *u = U.colptr(fids[f]);
+      for (int r = 0; r < k; r++) o_sum[r] += u[r] * child[r];
+    }
+  }
+
+ public:
+  SparseTensor() : m_modes(0) {}
+  /**
+   * Constructs the tensor from coordinates.
+   * @param[in] i_dimensions of every mode
+   * @param[in] i_subs modes x nnz subscripts
+   * @param[in] i_vals nnz values
+   */
+  SparseTensor(const UVEC &i_dimensions, const UMAT &i_subs,
+               const VEC &i_vals)
+      : m_modes(i_dimensions.n_rows),
+        m_dimensions(i_dimensions),
+        m_global_idx(arma::zeros<UVEC>(i_dimensions.n_rows)),
+        m_subs(i_subs),
+        m_vals(i_vals) {
+    build();
+  }
+  /**
+   * Random sparse tensor with about density * prod(dims) uniform non
+   * zeros. The same seed gives the same tensor.
+   * @param[in] i_dimensions of every mode
+   * @param[in] i_density fraction of non zeros
+   * @param[in] i_seed of the random generator
+   */
+  SparseTensor(const UVEC &i_dimensions, const double i_density,
+               const int i_seed)
+      : m_modes(i_dimensions.n_rows),
+        m_dimensions(i_dimensions),
+        m_global_idx(arma::zeros<UVEC>(i_dimensions.n_rows)) {
+    UWORD numel = arma::prod(i_dimensions);
+    UWORD nnz = std::max<UWORD>(1, i_density * numel);
+    std::mt19937_64 gen(i_seed);
+    std::uniform_int_distribution<UWORD> idx(0, numel - 1);
+    std::uniform_real_distribution<> val(0, 1);
+    std::vector<UWORD> lin(nnz);
+    for (UWORD j = 0; j < nnz; j++) lin[j] = idx(gen);
+    std::sort(lin.begin(), lin.end());
+    lin.erase(std::unique(lin.begin(), lin.end()), lin.end());
+    m_subs.set_size(m_modes, lin.size());
+    m_vals.set_size(lin.size());
+    for (UWORD j = 0; j < lin.size(); j++) {
+      UWORD q = lin[j];
+      for (int i = 0; i < m_modes; i++) {
+        m_subs(i, j) = q % i_dimensions(i);
+        q /= i_dimensions(i);
+      }
+      m_vals(j) = val(gen);
+    }
+    build();
+  }
+  /// Builds the CSF tree of every mode. Call after changing the non zeros.
+  void build() {
+    m_csf.assign(m_modes, CSFTree());
+    for (int i = 0; i < m_modes; i++) build_csf(i, &m_csf[i]);
+  }
+
+  /// Returns the number of modes
+  int modes() const { return m_modes; }
+  /// Returns the vector of dimensions on every mode
+  UVEC dimensions() const { return m_dimensions; }
+  /// Returns the dimension of mode i
+  int dimension(int i) const { return m_dimensions[i]; }
+  /// Returns the number of non zeros
+  UWORD nnz() const { return m_vals.n_elem; }
+  /// Returns the subscripts. Column j is the non zero j.
+  const UMAT &subs() const { return m_subs; }
+  /// Returns the non zero values
+  const VEC &vals() const { return m_vals; }
+  /// Returns the starting global multi-index of the local block
+  UVEC global_idx() const { return m_global_idx; }
+  /// Sets the starting global multi-index of the local block
+  void set_idx(const UVEC &i_start_idx) { m_global_idx = i_start_idx; }
+  /// Returns the sum of squares of the non zeros like Tensor::norm
+  double norm() const { return arma::dot(m_vals, m_vals); }
+  void clear() {
+    m_subs.clear();
+    m_vals.clear();
+    m_csf.clear();
+  }
+  void swap(SparseTensor &in) {
+    using std::swap;
+    swap(m_modes, in.m_modes);
+    swap(m_dimensions, in.m_dimensions);
+    swap(m_global_idx, in.m_global_idx);
+    swap(m_subs, in.m_subs);
+    swap(m_vals, in.m_vals);
+    swap(m_csf, in.m_csf);
+  }
+  /// prints the non zeros
+  void print() const {
+    INFO << "Dimensions: " << m_dimensions << "nnz: " << nnz() << std::endl;
+    for (UWORD j = 0; j < nnz(); j++) {
+      INFO << m_subs.col(j).t() << " : " << m_vals(j) << std::endl;
+    }
+  }
+
+  /**
+   * MTTKRP of mode i_n on the CSF tree rooted at i_n. Every root slice
+   * writes its own column of the output, so slices run in parallel.
+   * @param[in] i_n mode
+   * @param[in] i_F factors of every mode. lambda is not applied.
+   * @param[out] o_mttkrp k x dimension(i_n)
+   */
+  void mttkrp(const int i_n, const NCPFactors &i_F, MAT *o_mttkrp) const {
+    const int k = i_F.rank();
+    const CSFTree &t = m_csf[i_n];
+    std::vector<MAT> Ut(m_modes);
+    for (int i = 0; i < m_modes; i++) {
+      if (i != i_n) Ut[i] = i_F.factor(i).t();
+    }
+    o_mttkrp->zeros(k, m_dimensions(i_n));
+    if (m_vals.n_elem == 0) return;
+    if (m_modes == 1) {
+      for (UWORD j = 0; j < t.vals.size(); j++) {
+        o_mttkrp->col(t.fids[0][j]).fill(t.vals[j]);
+      }
+      return;
+    }
+    const UWORD nroots = t.fids[0].size();
+#pragma omp parallel
+    {
+      std::vector<double> scratch(k * m_modes);
+#pragma omp for schedule(dynamic, 16)
+      for (UWORD f = 0; f < nroots; f++) {
+        csf_sum(t, Ut, 1, t.fptr[0][f], t.fptr[0][f + 1], &scratch[0],
+                o_mttkrp->colptr(t.fids[0][f]));
+      }
+    }
+  }
+
+  /**
+   * Squared error with the model \f$Y = [\lambda; U_1, \ldots, U_N]\f$
+   * evaluated only on the non zeros as
+   * \f$\sum_{nnz} (x - y)^2 + \|Y\|_F^2 - \sum_{nnz} y^2\f$.
+   * \f$\|Y\|_F^2 = \lambda^T (U_1^TU_1 * \cdots * U_N^TU_N) \lambda\f$
+   * @param[in] i_F factors with lambda
+   * @return squared frobenius norm of the residual
+   */
+  double err(const NCPFactors &i_F) const {
+    const int k = i_F.rank();
+    const VEC lambda = i_F.lambda();
+    MAT grams = arma::ones<MAT>(k, k);
+    std::vector<MAT> Ut(m_modes);
+    for (int i = 0; i < m_modes; i++) {
+      grams %= i_F.factor(i).t() * i_F.factor(i);
+      Ut[i] = i_F.factor(i).t();
+    }
+    double model_sq = arma::as_scalar(lambda.t() * grams * lambda);
+    double nnzsse = 0;
+    double nnzyy = 0;
+    const UWORD nnz = m_vals.n_elem;
+#pragma omp parallel
+    {
+      VEC row(k);
+#pragma omp for reduction(+ : nnzsse, nnzyy)
+      for (UWORD j = 0; j < nnz; j++) {
+        row = lambda;
+        for (int i = 0; i < m_modes; i++) {
+          row %= Ut[i].col(m_subs(i, j));
+        }
+        double y = arma::accu(row);
+        double diff = m_vals(j) - y;
+        nnzsse += diff * diff;
+        nnzyy += y * y;
+      }
+    }
+    return nnzsse + model_sq - nnzyy;
+  }
+
+  /**
+   * Replaces the value of every non zero with the model value. Keeps
+   * the sparsity pattern. Used to generate rand_lowrank inputs.
+   * @param[in] i_F factors with lambda
+   */
+  void rankk_values(const NCPFactors &i_F) {
+    const VEC lambda = i_F.lambda();
+#pragma omp parallel for
+    for (UWORD j = 0; j < m_vals.n_elem; j++) {
+      VEC row = lambda;
+      for (int i = 0; i < m_modes; i++) {
+        row %= i_F.factor(i).row(m_subs(i, j)).t();
+      }
+      m_vals(j) = arma::accu(row);
+    }
+    build();
+  }
+
+  /**
+   * Parses the non zeros of a coordinate file with one non zero per line
+   * as the subscripts followed by the value. ".tns" files are one based
+   * as in FROSTT and everything else is zero based. Only the lines that
+   * start in the byte range [i_begin, i_end) are parsed. A line that
+   * starts before i_begin belongs to the range before it, so ranges
+   * that cover the file parse every line exactly once.
+   * @param[in] filename of the coordinate file
+   * @param[in] i_begin first byte of the range
+   * @param[in] i_end one past the last byte of the range
+   * @param[out] o_subs modes x nnz zero based global subscripts
+   * @param[out] o_vals nnz values
+   * @return largest subscript + 1 of every mode of the parsed non zeros.
+   *         Empty if the range holds no non zero.
+   */
+  static UVEC parse(const std::string &filename, const std::streamoff i_begin,
+                    const std::streamoff i_end, UMAT *o_subs, VEC *o_vals) {
+    std::ifstream ifs(filename.c_str());
+    UVEC dims;
+    o_subs->set_size(0, 0);
+    o_vals->set_size(0);
+    if (!ifs.is_open()) {
+      ERR << "Could not open the file " << filename << std::endl;
+      return dims;
+    }
+    std::string line;
+    if (i_begin > 0) {
+      ifs.seekg(i_begin - 1);
+      // the line holding i_begin belongs to the previous range unless
+      // it starts exactly at i_begin.
+      if (ifs.get() != '\n') std::getline(ifs, line);
+    }
+    const UWORD base = is_one_based(filename) ? 1 : 0;
+    int modes = 0;
+    std::vector<UWORD> subs;
+    std::vector<double> vals;
+    std::streamoff pos = ifs.tellg();
+    while (pos >= 0 && pos < i_end && std::getline(ifs, line)) {
+      pos = ifs.tellg();
+      if (line.empty() || line[0] == '#') continue;
+      std::vector<double> tokens = parse_line(line);
+      if (modes == 0) {
+        modes = tokens.size() - 1;
+        if (modes <= 0) continue;
+        dims = arma::zeros<UVEC>(modes);
+      }
+      if (static_cast<int>(tokens.size()) != modes + 1) continue;
+      for (int i = 0; i < modes; i++) {
+        UWORD sub = static_cast<UWORD>(tokens[i]) - base;
+        subs.push_back(sub);
+        if (sub + 1 > dims(i)) dims(i) = sub + 1;
+      }
+      vals.push_back(tokens[modes]);
+    }
+    if (!vals.empty()) {
+      *o_subs = UMAT(&subs[0], modes, vals.size());
+      *o_vals = VEC(vals);
+    }
+    return dims;
+  }
+  /**
+   * Reads the whole coordinate file in one pass. The dimensions are the
+   * largest subscripts + 1. See parse for the format.
+   * @param[in] filename of the coordinate file
+   */
+  void read(const std::string &filename) {
+    UMAT subs;
+    VEC vals;
+    UVEC dims = parse(filename, 0, std::numeric_limits<std::streamoff>::max(),
+                      &subs, &vals);
+    SparseTensor rc(dims, subs, vals);
+    this->swap(rc);
+  }
+
+ private:
+  static bool is_one_based(const std::string &filename) {
+    return filename.size() > 4 &&
+           filename.compare(filename.size() - 4, 4, ".tns") == 0;
+  }
+  static std::vector<double> parse_line(const std::string &line) {
+    std::vector<double> tokens;
+    std::istringstream iss(line);
+    double token;
+    while (iss >> token) tokens.push_back(token);
+    return tokens;
+  }
+};  // class SparseTensor
+}  // namespace planc
+
+#endif  // COMMON_SPARSETENSOR_HPP_
@@ -0,0 +1,116 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+#ifndef COMMON_SPDSOLVER_HPP_
+#define COMMON_SPDSOLVER_HPP_
+
+#include <cblas.h>
+#include <limits>
+#include "common/utils.h"
+
+namespace planc {
+
+/// Diagonal shift relative to the mean diagonal of a rank deficient gram
+const double kSPDShift = 1e-10;
+
+/**
+ * Solves \f$GX = B\f$ for a small symmetric positive semidefinite gram G,
+ * such as the \f$k \times k\f$ hadamard of the grams in CP-ALS or
+ * \f$H^TH\f$ in unconstrained NMF. G is factorized once with factorize
+ * and the factorization is applied to any number of right hand sides.
+ *
+ * G is Cholesky factorized as \f$R^TR\f$ and solve runs the two
+ * triangular solves of LAPACK dpotrs with BLAS dtrsm on B in place. A
+ * G that is numerically rank deficient is first shifted by a small
+ * multiple of its mean diagonal. If that still fails, the solve falls
+ * back to the pseudo inverse from the eigen decomposition of G.
+ */
+class SPDSolver {
+ private:
+  enum solvetype { CHOLESKY, SHIFTED_CHOLESKY, EIGEN };
+  solvetype m_type;
+  /// R with \f$G = R^TR\f$, or the eigenvectors of G for EIGEN
+  MAT m_factor;
+  /// inverse eigenvalues of G. Zero for its null space.
+  VEC m_inv_evals;
+  double m_shift;
+
+  /**
+   * Cholesky factor of gram into m_factor. Rejects a factor whose
+   * smallest pivot is too small relative to the largest, as the solve
+   * with it would mostly amplify rounding errors.
+   */
+  bool cholesky(const MAT &gram) {
+    if (!arma::chol(m_factor, gram)) return false;
+    VEC pivots = m_factor.diag();
+    double tol = gram.n_rows * std::numeric_limits<double>::epsilon();
+    return arma::min(pivots) > 0 &&
+           arma::min(pivots) * arma::min(pivots) >
+               tol * arma::max(pivots) * arma::max(pivots);
+  }
+
+ public:
+  SPDSolver() : m_type(CHOLESKY), m_shift(0) {}
+
+  /**
+   * Factorizes the symmetric gram. Only its upper triangle is read.
+   * @param[in] gram \f$k \times k\f$ symmetric positive semidefinite
+   * @return false if gram is rank deficient and was regularized
+   */
+  bool factorize(const MAT &gram) {
+    m_shift = 0;
+    m_type = CHOLESKY;
+    if (cholesky(gram)) return true;
+    double mean_diag = arma::trace(gram) / gram.n_rows;
+    if (mean_diag > 0) {
+      m_shift = kSPDShift * mean_diag;
+      MAT shifted = gram;
+      shifted.diag() += m_shift;
+      m_type = SHIFTED_CHOLESKY;
+      if (cholesky(shifted)) return false;
+    }
+    m_shift = 0;
+    m_type = EIGEN;
+    VEC evals;
+    arma::eig_sym(evals, m_factor, arma::symmatu(gram));
+    double tol = gram.n_rows * std::numeric_limits<double>::epsilon() *
+                 arma::max(arma::abs(evals));
+    m_inv_evals.zeros(evals.n_elem);
+    for (UWORD i = 0; i < evals.n_elem; i++) {
+      if (evals[i] > tol) m_inv_evals[i] = 1.0 / evals[i];
+    }
+    return false;
+  }
+
+  /// true if the last factorize had to regularize the gram
+  bool regularized() const { return m_type != CHOLESKY; }
+  /// diagonal shift of the last factorize. Zero if none was added.
+  double shift() const { return m_shift; }
+
+  /**
+   * Overwrites the k x ncols column major B with \f$G^{-1}B\f$. Safe to
+   * call concurrently on disjoint right hand sides.
+   * @param[in,out] rhs k x ncols column major with leading dimension k
+   * @param[in] ncols number of right hand sides
+   */
+  void solve(double *rhs, const UWORD ncols) const {
+    const int k = m_factor.n_rows;
+    if (ncols == 0 || k == 0) return;
+    if (m_type == EIGEN) {
+      MAT B(rhs, k, ncols, false, true);
+      MAT coeffs = m_factor.t() * B;
+      coeffs.each_col() %= m_inv_evals;
+      B = m_factor * coeffs;
+      return;
+    }
+    // dpotrs. \f$R^TY = B\f$ and then \f$RX = Y\f$.
+    cblas_dtrsm(CblasColMajor, CblasLeft, CblasUpper, CblasTrans,
+                CblasNonUnit, k, ncols, 1.0, m_factor.memptr(), k, rhs, k);
+    cblas_dtrsm(CblasColMajor, CblasLeft, CblasUpper, CblasNoTrans,
+                CblasNonUnit, k, ncols, 1.0, m_factor.memptr(), k, rhs, k);
+  }
+  /// Overwrites B with \f$G^{-1}B\f$
+  void solve(MAT *rhs) const { solve(rhs->memptr(), rhs->n_cols); }
+};
+
+}  // namespace planc
+
+#endif  // COMMON_SPDSOLVER_HPP_
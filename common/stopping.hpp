@@ -0,0 +1,113 @@
+/* Copyright 2018 Ramakrishnan Kannan */
+#ifndef COMMON_STOPPING_HPP_
+#define COMMON_STOPPING_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Squared norm of the gradient G projected on the bound \f$X \ge 0\f$.
+ * An entry counts if it can move, that is if X is positive or the
+ * gradient points into the feasible region.
+ * @param[in] X current iterate
+ * @param[in] G gradient at X of the same size
+ */
+inline double projectedGradSqNorm(const MAT &X, const MAT &G) {
+  double sqnorm = 0;
+  const double *x = X.memptr();
+  const double *g = G.memptr();
+  for (UWORD i = 0; i < X.n_elem; i++) {
+    if (x[i] > 0 || g[i] < 0) sqnorm += g[i] * g[i];
+  }
+  return sqnorm;
+}
+
+/**
+ * Decides when the outer iterations of NMF and NTF have converged. The
+ * drivers add one value per outer iteration. It is the relative error
+ * for STOP_RELERR and STOP_STALL and the squared projected gradient
+ * norm for STOP_PGRAD.
+ *
+ * | policy | stops when |
+ * |--------|------------|
+ * | STOP_RELERR | \f$|e_{t-1} - e_t| \le tol \cdot e_{t-1}\f$ |
+ * | STOP_PGRAD | \f$\|P[\nabla f]_t\| \le tol \|P[\nabla f]_0\|\f$ |
+ * | STOP_STALL | best error of the last window iterations improves the best before them by less than a relative tol |
+ *
+ * A tolerance \f$\le 0\f$ disables stopping. The distributed drivers add
+ * globally reduced values and still agree on the decision with an
+ * allreduce, so that all the processes leave the loop together.
+ */
+class StoppingCriterion {
+ private:
+  stoptype m_policy;
+  double m_tol;
+  unsigned int m_window;
+  std::vector<double> m_values;
+
+ public:
+  StoppingCriterion() : m_policy(STOP_RELERR), m_tol(-1), m_window(5) {}
+  /**
+   * @param[in] policy one of stoptype
+   * @param[in] tol relative tolerance. Disabled if not positive.
+   * @param[in] window number of iterations without progress for STOP_STALL
+   */
+  StoppingCriterion(const stoptype policy, const double tol,
+                    const int window)
+      : m_policy(policy), m_tol(tol), m_window(window > 0 ? window : 1) {}
+
+  bool enabled() const { return m_tol > 0; }
+  /// The policy is evaluated on the relative error
+  bool needs_error() const { return enabled() && m_policy != STOP_PGRAD; }
+  /// The policy is evaluated on the projected gradient
+  bool needs_gradient() const { return enabled() && m_policy == STOP_PGRAD; }
+  /// Adds the value of the last completed outer iteration
+  void add(const double value) { m_values.push_back(value); }
+  void clear() { m_values.clear(); }
+  /// Last value added
+  double last() const { return m_values.empty() ? -1 : m_values.back(); }
+
+  std::string name() const {
+    switch (m_policy) {
+      case STOP_PGRAD:
+        return "pgrad";
+      case STOP_STALL:
+        return "stall";
+      default:
+        return "relerr";
+    }
+  }
+
+  /// Returns true if the values added so far meet the policy
+  bool converged() const {
+    if (!enabled()) return false;
+    size_t n = m_values.size();
+    switch (m_policy) {
+      case STOP_PGRAD:
+        if (n < 2) return false;
+        return std::sqrt(m_values[n - 1]) <= m_tol * std::sqrt(m_values[0]);
+      case STOP_STALL: {
+        if (n <= m_window) return false;
+        double before = *std::min_element(m_values.begin(),
+                                          m_values.end() - m_window);
+        double recent =
+            *std::min_element(m_values.end() - m_window, m_values.end());
+        return before - recent <= m_tol * before;
+      }
+      default: {
+        if (n < 2) return false;
+        double prev = m_values[n - 2];
+        return std::abs(prev - m_values[n - 1]) <= m_tol * prev;
+      }
+    }
+  }
+};
+
+}  // namespace planc
+
+#endif  // COMMON_STOPPING_HPP_
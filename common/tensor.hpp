@@ -4,15 +4,19 @@
 #define COMMON_TENSOR_HPP_
 
 #include <cblas.h>
+#include <omp.h>
 #include <armadillo>
 #include <fstream>
 #include <ios>
+#include <memory>
 #include <random>
 #include <string>
 #include <type_traits>
 #include <utility>
 #include <vector>
+#include "common/mmapio.hpp"
 #include "common/utils.h"
+#include "common/utils.hpp"
 
 namespace planc {
 /**
@@ -36,6 +40,10 @@ class Tensor {
   UWORD m_numel;
   UVEC m_global_idx;
   unsigned int rand_seed;
+  // non owning view of external memory such as a file mapping.
+  // m_data is empty when m_view is set. m_view_owner keeps it alive.
+  double *m_view;
+  std::shared_ptr<void> m_view_owner;
 
   // for the time being it is used for debugging purposes
   size_t sub2ind(UVEC sub, UVEC dimensions) {
@@ -75,6 +83,7 @@ class Tensor {
   Tensor() {
     this->m_modes = 0;
     this->m_numel = 0;
+    this->m_view = NULL;
   }
   /**
    * Constructor that takes only dimensions of every mode as a vector
@@ -83,7 +92,8 @@ class Tensor {
       : m_modes(i_dimensions.n_rows),
         m_dimensions(i_dimensions),
         m_numel(arma::prod(i_dimensions)),
-        rand_seed(103) {
+        rand_seed(103),
+        m_view(NULL) {
     m_data.resize(m_numel);
     randu();
   }
@@ -92,7 +102,8 @@ class Tensor {
         m_dimensions(i_dimensions),
         m_numel(arma::prod(i_dimensions)),
         m_global_idx(i_start_idx),
-        rand_seed(103) {
+        rand_seed(103),
+        m_view(NULL) {
     m_data.resize(m_numel);
     randu();
   }
@@ -105,23 +116,48 @@ class Tensor {
       : m_modes(i_dimensions.n_rows),
         m_dimensions(i_dimensions),
         m_numel(arma::prod(i_dimensions)),
-        rand_seed(103) {
+        rand_seed(103),
+        m_view(NULL) {
     m_data.resize(m_numel);
-    memcpy(&this->m_data[0], i_data, sizeof(double) * this->m_numel);
+    memcpy(this->m_data.data(), i_data, sizeof(double) * this->m_numel);
+  }
+  /**
+   * Same as arma's copy_aux_mem. With copy_aux_mem=false the tensor is
+   * a non owning view of i_data and never allocates or frees it.
+   * @param[in] i_dimensions of every mode
+   * @param[in] i_data in the same order as the other constructor
+   * @param[in] copy_aux_mem false to use i_data in place
+   * @param[in] i_owner optional handle that keeps i_data alive as long
+   *            as the tensor, e.g. the MappedFile of an input file
+   */
+  Tensor(const UVEC &i_dimensions, double *i_data, const bool copy_aux_mem,
+         std::shared_ptr<void> i_owner = std::shared_ptr<void>())
+      : m_modes(i_dimensions.n_rows),
+        m_dimensions(i_dimensions),
+        m_numel(arma::prod(i_dimensions)),
+        rand_seed(103),
+        m_view(NULL) {
+    if (copy_aux_mem) {
+      m_data.assign(i_data, i_data + m_numel);
+    } else {
+      m_view = i_data;
+      m_view_owner = i_owner;
+    }
   }
   ~Tensor() {}
 
   /**
-   *  copy constructor
+   *  copy constructor. A copy of a view owns its data.
    */
   Tensor(const Tensor &src) {
+    this->m_view = NULL;
     clear();
     this->m_numel = src.numel();
     this->m_modes = src.modes();
     this->m_dimensions = src.dimensions();
     this->m_global_idx = src.global_idx();
     this->rand_seed = 103;
-    this->m_data = src.m_data;
+    this->m_data.assign(src.data(), src.data() + src.numel());
   }
 
   Tensor &operator=(const Tensor &other) {  // copy assignment
@@ -132,7 +168,7 @@ class Tensor {
       this->m_modes = other.modes();
       this->m_dimensions = other.dimensions();
       this->m_global_idx = other.global_idx();
-      this->m_data = other.m_data;
+      this->m_data.assign(other.data(), other.data() + other.numel());
     }
     return *this;
   }
@@ -145,6 +181,8 @@ class Tensor {
     swap(m_global_idx, in.m_global_idx);
     swap(rand_seed, in.rand_seed);
     swap(m_data, in.m_data);
+    swap(m_view, in.m_view);
+    swap(m_view_owner, in.m_view_owner);
   }
   /**
    * Clears the data and also destroys the storage
@@ -153,8 +191,16 @@ class Tensor {
   void clear() {
     this->m_numel = 0;
     this->m_data.clear();
+    this->m_view = NULL;
+    this->m_view_owner.reset();
   }
 
+  /// Returns the raw data. Either owned or the external view.
+  double *data() { return m_view ? m_view : m_data.data(); }
+  const double *data() const { return m_view ? m_view : m_data.data(); }
+  /// Returns true if the tensor does not own its data
+  bool is_view() const { return m_view != NULL; }
+
   /// Return the number of modes. It is a scalar value.
   int modes() const { return m_modes; }
   /// Returns a vector of dimensions on every mode
@@ -184,7 +230,7 @@ class Tensor {
   /// Zeros out the entire tensor
   void zeros() {
     for (UWORD i = 0; i < this->m_numel; i++) {
-      this->m_data[i] = 0;
+      this->data()[i] = 0;
     }
   }
   /// set the tensor with uniform random.
@@ -192,7 +238,7 @@ class Tensor {
 #pragma omp parallel for
     for (UWORD i = 0; i < this->m_numel; i++) {
       unsigned int *temp = const_cast<unsigned int *>(&rand_seed);
-      this->m_data[i] =
+      this->data()[i] =
           static_cast<double>(rand_r(temp)) / static_cast<double>(RAND_MAX);
     }
   }
@@ -204,7 +250,7 @@ class Tensor {
     std::uniform_int_distribution<> dis(0, max_randi);
 #pragma omp parallel for
     for (UWORD i = 0; i < this->m_numel; i++) {
-      this->m_data[i] = dis(gen);
+      this->data()[i] = dis(gen);
     }
   }
   /**
@@ -219,13 +265,13 @@ class Tensor {
       std::mt19937 gen(rand_seed);
 #pragma omp parallel for
       for (unsigned int i = 0; i < this->m_numel; i++) {
-        m_data[i] = dis(gen);
+        this->data()[i] = dis(gen);
       }
     } else {
       std::mt19937 gen(i_seed);
 #pragma omp parallel for
       for (unsigned int i = 0; i < this->m_numel; i++) {
-        m_data[i] = dis(gen);
+        this->data()[i] = dis(gen);
       }
     }
   }
@@ -273,7 +319,7 @@ class Tensor {
       // printf("mode=%d,i=%d,m=%d,n=%d,k=%d,alpha=%lf,T_stride=%d,lda=%d,krp_stride=%d,ldb=%d,beat=%lf,mttkrp=!!!,ldc=%d\n",0,
       // 0, m, n, k,alpha,0*k*m,m,0*n*k,i_krp.n_rows,beta,n);
       cblas_dgemm(CblasRowMajor, CblasTrans, CblasTrans, m, n, k, alpha,
-                  &this->m_data[0], m, i_krp.memptr(), k, beta,
+                  this->data(), m, i_krp.memptr(), k, beta,
                   o_mttkrp->memptr(), n);
 
     } else {
@@ -290,34 +336,44 @@ class Tensor {
       for (int i = i_n + 1; i < this->m_modes; i++) {
         nmats *= this->m_dimensions[i];
       }
-      // For each matrix...
-      for (int i = 0; i < nmats; i++) {
-        // char transa = 'T';
-        // char transb = 'N';
-        int m = this->m_dimensions[i_n];
-        int n = lowrankk;
-        int k = ncols;
-        // int lda = k;  // not sure. could be m. higher confidence on k.
-        // int ldb = i_krp.n_rows;
-        // int ldc = m;
-        double alpha = 1;
-        double beta = (i == 0) ? 0 : 1;
-        // double *A = this->m_data + i * k * m;
-        // double *B = const_cast<double *>(i_krp.memptr()) + i * k;
-
-        // for KRP move ncols*lowrankk
-        // for tensor X move as n_cols*blas_n
-        // For output matrix don't move anything as beta=1;
-        // for reference from gram while moving input tensor like
-        // Y->data()+i*nrows*ncols sgemm (TRANSA, TRANSB, M, N, K, ALPHA, A,
-        // LDA, B, LDB, BETA, C, LDC)
-        // dgemm_(&transa, &transb, &m, &n, &k, &alpha, A,
-        // &lda, B , &ldb, &beta, (*o_mttkrp).memptr() , &ldc);
-        // printf("mode=%d,i=%d,m=%d,n=%d,k=%d,alpha=%lf,T_stride=%d,lda=%d,krp_stride=%d,ldb=%d,beat=%lf,mttkrp=!!!,ldc=%d\n",i_n,
-        // i, m, n, k,alpha,i*k*m,k,i*n*k,nmats*ncols,beta,n);
-        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m, n, k, alpha,
-                    &this->m_data[0] + i * k * m, ncols, i_krp.memptr() + i * k,
-                    ncols * nmats, beta, o_mttkrp->memptr(), n);
+      // Every slice of the modes after i_n is an independent GEMM into
+      // the same output. With enough slices every thread accumulates
+      // its slices into a private output and the outputs are summed.
+      // Otherwise the slices stay sequential and BLAS threads each GEMM.
+      // The threaded slices run single threaded BLAS to not oversubscribe.
+      int m = this->m_dimensions[i_n];
+      int n = lowrankk;
+      int k = ncols;
+      double alpha = 1;
+      // for KRP move ncols*lowrankk
+      // for tensor X move as n_cols*blas_n
+      // For output matrix don't move anything as beta=1;
+      if (nmats >= omp_get_max_threads() && nmats > 1) {
+        int blasThreads = get_blas_num_threads();
+        set_blas_num_threads(1);
+#pragma omp parallel
+        {
+          MAT local_mttkrp = arma::zeros<MAT>(o_mttkrp->n_rows,
+                                              o_mttkrp->n_cols);
+#pragma omp for schedule(static)
+          for (int i = 0; i < nmats; i++) {
+            cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m, n, k,
+                        alpha, this->data() + i * k * m, ncols,
+                        i_krp.memptr() + i * k, ncols * nmats, 1.0,
+                        local_mttkrp.memptr(), n);
+          }
+#pragma omp critical
+          (*o_mttkrp) += local_mttkrp;
+        }
+        set_blas_num_threads(blasThreads);
+      } else {
+        for (int i = 0; i < nmats; i++) {
+          double beta = (i == 0) ? 0 : 1;
+          cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m, n, k,
+                      alpha, this->data() + i * k * m, ncols,
+                      i_krp.memptr() + i * k, ncols * nmats, beta,
+                      o_mttkrp->memptr(), n);
+        }
       }
     }
   }
@@ -325,7 +381,7 @@ class Tensor {
   void print() const {
     INFO << "Dimensions: " << this->m_dimensions;
     for (unsigned int i = 0; i < this->m_numel; i++) {
-      std::cout << i << " : " << this->m_data[i] << std::endl;
+      std::cout << i << " : " << this->data()[i] << std::endl;
     }
   }
 
@@ -338,7 +394,7 @@ class Tensor {
       local_sub = ind2sub(this->m_dimensions, i);
       global_sub = global_start_sub + local_sub;
       global_idx = sub2ind(global_sub, global_dims);
-      std::cout << i << " : " << global_idx << " : " << this->m_data[i]
+      std::cout << i << " : " << global_idx << " : " << this->data()[i]
                 << std::endl;
     }
   }
@@ -346,7 +402,7 @@ class Tensor {
   double norm() const {
     double norm_fro = 0;
     for (unsigned int i = 0; i < this->m_numel; i++) {
-      norm_fro += (this->m_data[i] * this->m_data[i]);
+      norm_fro += (this->data()[i] * this->data()[i]);
     }
     return norm_fro;
   }
@@ -358,7 +414,7 @@ class Tensor {
     double norm_fro = 0;
     double err_diff;
     for (unsigned int i = 0; i < this->m_numel; i++) {
-      err_diff = this->m_data[i] - b.m_data[i];
+      err_diff = this->data()[i] - b.data()[i];
       norm_fro += err_diff * err_diff;
     }
     return norm_fro;
@@ -373,7 +429,7 @@ class Tensor {
     // static_assert(std::is_arithmetic<NumericType>::value,
     //               "NumericType for scale operation must be numeric");
     for (unsigned int i = 0; i < this->m_numel; i++) {
-      this->m_data[i] = this->m_data[i] * scale;
+      this->data()[i] = this->data()[i] * scale;
     }
   }
   /**
@@ -386,7 +442,7 @@ class Tensor {
     // static_assert(std::is_arithmetic<NumericType>::value,
     //               "NumericType for shift operation must be numeric");
     for (unsigned int i = 0; i < this->m_numel; i++) {
-      this->m_data[i] = this->m_data[i] + i_shift;
+      this->data()[i] = this->data()[i] + i_shift;
     }
   }
   /**
@@ -400,8 +456,8 @@ class Tensor {
     // static_assert(std::is_arithmetic<NumericType>::value,
     //               "NumericType for bound operation must be numeric");
     for (unsigned int i = 0; i < this->m_numel; i++) {
-      if (this->m_data[i] < min) this->m_data[i] = min;
-      if (this->m_data[i] > max) this->m_data[i] = max;
+      if (this->data()[i] < min) this->data()[i] = min;
+      if (this->data()[i] > max) this->data()[i] = max;
     }
   }
   /**
@@ -414,7 +470,7 @@ class Tensor {
     // static_assert(std::is_arithmetic<NumericType>::value,
     //               "NumericType for bound operation must be numeric");
     for (unsigned int i = 0; i < this->m_numel; i++) {
-      if (this->m_data[i] < min) this->m_data[i] = min;
+      if (this->data()[i] < min) this->data()[i] = min;
     }
   }
 
@@ -443,7 +499,7 @@ class Tensor {
     INFO << "size of the outputfile in GB "
          << (this->m_numel * 8.0) / (1024 * 1024 * 1024) << std::endl;
     size_t nwrite =
-        fwrite(&this->m_data[0], sizeof(std::vector<double>::value_type),
+        fwrite(this->data(), sizeof(std::vector<double>::value_type),
                this->numel(), fp);
     if (nwrite != this->numel()) {
       WARN << "something wrong ::write::" << nwrite
@@ -459,11 +515,8 @@ class Tensor {
 
   void read(std::string filename,
             std::ios_base::openmode mode = std::ios_base::in) {
-    // clear existing tensor
-    if (this->m_numel > 0) {
-      this->m_data.clear();  // destroy storage in this
-      this->m_numel = 0;
-    }
+    // clear existing tensor or view
+    this->clear();
     std::string filename_no_extension =
         filename.substr(0, filename.find_last_of("."));
     filename_no_extension.append(".info");
@@ -488,7 +541,7 @@ class Tensor {
     // }
     // ifs.read(reinterpret_cast<char *>(this->m_data), sizeof(this->m_data));
     size_t nread =
-        fread(&this->m_data[0], sizeof(std::vector<double>::value_type),
+        fread(this->m_data.data(), sizeof(std::vector<double>::value_type),
               this->numel(), fp);
     if (nread != this->numel()) {
       WARN << "something wrong ::write::" << nread
@@ -497,6 +550,51 @@ class Tensor {
     // Close the file
     fclose(fp);
   }
+  /**
+   * Same as read but maps the raw file into memory instead of reading
+   * it. The tensor becomes a view of the mapping and pages are loaded
+   * on first touch. Updates of the tensor are private to the process
+   * and never written back to the file.
+   * @param[in] filename as std::string
+   * @return false if the .info file is missing or malformed or the file
+   *         could not be mapped. The tensor is left empty.
+   */
+  bool map(std::string filename) {
+    this->clear();
+    std::string filename_no_extension =
+        filename.substr(0, filename.find_last_of("."));
+    filename_no_extension.append(".info");
+    std::ifstream ifs;
+    ifs.open(filename_no_extension, std::ios_base::in);
+    int modes = 0;
+    if (!ifs.is_open() || !(ifs >> modes) || modes <= 0) {
+      WARN << "could not read modes from " << filename_no_extension
+           << std::endl;
+      return false;
+    }
+    UVEC dimensions = arma::zeros<UVEC>(modes);
+    for (int i = 0; i < modes; i++) {
+      if (!(ifs >> dimensions[i])) {
+        WARN << "could not read dimension " << i << " from "
+             << filename_no_extension << std::endl;
+        return false;
+      }
+    }
+    ifs.close();
+    std::shared_ptr<MappedFile> mapping(new MappedFile(filename));
+    UWORD numel = arma::prod(dimensions);
+    if (!mapping->is_open() || mapping->size() < numel * sizeof(double)) {
+      WARN << "could not map " << filename << "::numel::" << numel
+           << std::endl;
+      return false;
+    }
+    this->m_modes = modes;
+    this->m_dimensions = dimensions;
+    this->m_numel = numel;
+    this->m_view = mapping->doubles();
+    this->m_view_owner = mapping;
+    return true;
+  }
 
   /**
    * Given a vector of subscripts, it return the linear index
@@ -513,7 +611,7 @@ class Tensor {
     size_t idx = arma::dot(cumprod_dims_shifted, sub);
     return idx;
   }
-  double at(UVEC sub) { return m_data[sub2ind(sub)]; }
+  double at(UVEC sub) { return data()[sub2ind(sub)]; }
 };  // class Tensor
 }  // namespace planc
 
@@ -11,12 +11,34 @@ enum algotype { MU, HALS, ANLSBPP, NAIVEANLSBPP, AOADMM, NESTEROV, CPALS, GNSYM,
 
 enum normtype { NONE, L2NORM, MAXNORM };
 
+enum stoptype { STOP_RELERR, STOP_PGRAD, STOP_STALL };
+
 // #if !defined(ARMA_64BIT_WORD)
 // #define ARMA_64BIT_WORD
 #define ARMA_DONT_USE_WRAPPER
 #define ARMA_USE_BLAS
 #define ARMA_USE_LAPACK
 // #endif
+// Debug only. Counts every heap allocation of armadillo. Matrices too
+// small for the local buffer of armadillo are not allocated and not
+// counted. Must be seen before the first include of armadillo.
+#ifdef COUNT_ARMA_ALLOCS
+#include <atomic>
+#include <cstdlib>
+namespace planc {
+/// heap allocations made by armadillo so far by all the threads
+inline std::atomic<unsigned long> &armaAllocations() {
+  static std::atomic<unsigned long> count(0);
+  return count;
+}
+inline void *countedArmaAlloc(size_t n_bytes) {
+  armaAllocations()++;
+  return std::malloc(n_bytes);
+}
+}  // namespace planc
+#define ARMA_ALIEN_MEM_ALLOC_FUNCTION planc::countedArmaAlloc
+#define ARMA_ALIEN_MEM_FREE_FUNCTION std::free
+#endif
 #include <armadillo>
 #include <cmath>
 #include <iostream>
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <omp.h>
 #include <stdio.h>
+#include <algorithm>
 #include <chrono>
 #include <ctime>
 #include <stack>
@@ -54,6 +55,50 @@ inline double toc() {
   return rc;
 }
 
+/**
+ * Returns the number of threads the BLAS/LAPACK library is allowed to use.
+ * Returns 1 when the library gives no way to query it.
+ */
+inline int get_blas_num_threads() {
+#if defined(MKL_FOUND)
+  return mkl_get_max_threads();
+#elif defined(OPENBLAS_VERSION)
+  return openblas_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+/**
+ * Sets the number of threads the BLAS/LAPACK library is allowed to use.
+ * Call with 1 before an OpenMP region whose iterations call BLAS, so
+ * that the threaded BLAS does not oversubscribe the cores.
+ */
+inline void set_blas_num_threads(const int nthreads) {
+#if defined(MKL_FOUND)
+  mkl_set_num_threads(nthreads);
+#elif defined(OPENBLAS_VERSION)
+  openblas_set_num_threads(nthreads);
+#endif
+}
+
+/**
+ * Number of right hand sides given to one task when a multiple RHS
+ * NNLS problem is split across OpenMP threads. We keep a few chunks per
+ * thread so that the dynamic schedule can balance the uneven pivot
+ * counts of BPP, but never more than maxchunk columns per chunk.
+ * @param[in] total number of right hand sides
+ * @param[in] upper bound on the columns of one chunk
+ */
+inline UINT nnls_chunk_size(const UINT nrhs, const UINT maxchunk) {
+  const UINT kChunksPerThread = 4;
+  const UINT kMinChunkSize = 64;
+  UINT nchunks = kChunksPerThread * omp_get_max_threads();
+  UINT chunk = (nrhs + nchunks - 1) / nchunks;
+  chunk = std::max(chunk, kMinChunkSize);
+  return std::min(chunk, maxchunk);
+}
+
 template <class T>
 void fixNumericalError(T *X, const double prec = EPSILON_1EMINUS16,
                        const double repl = 0.0) {
@@ -182,59 +227,142 @@ std::vector<std::vector<size_t>> cartesian_product(
   return s;
 }
 
-/*
- * can be called by external people for sparse input matrix.
+/**
+ * denseSpMM for X with two rows, as in the rank 2 splits of hierarchical
+ * NMF. The two rows of C are a pair of SpMVs fused into one pass over
+ * the non zeros of S. Both sums stay in registers and the two entries
+ * of a column of X are loaded together.
+ * @param[in] X dense matrix of size \f$2 \times m\f$
+ * @param[in] S sparse matrix of size \f$m \times n\f$
+ * @param[out] C dense matrix of size \f$2 \times n\f$. Must be allocated.
+ */
+template <class SPMATTYPE>
+void denseSpMM2(const MAT &X, const SPMATTYPE &S, MAT *C) {
+  const double *x = X.memptr();
+  double *c = C->memptr();
+#pragma omp parallel for schedule(dynamic, 256)
+  for (UWORD col = 0; col < S.n_cols; col++) {
+    double c0 = 0, c1 = 0;
+    const UWORD endIdx = S.col_ptrs[col + 1];
+    for (UWORD ii = S.col_ptrs[col]; ii < endIdx; ii++) {
+      const double *xcol = x + 2 * S.row_indices[ii];
+      const double val = S.values[ii];
+      c0 += val * xcol[0];
+      c1 += val * xcol[1];
+    }
+    c[2 * col] = c0;
+    c[2 * col + 1] = c1;
+  }
+}
+
+/**
+ * Dense times sparse product \f$C = XS\f$ written into a preallocated C.
+ * Column j of C only depends on column j of S, so the columns are split
+ * across the threads without any reduction or temporary. For
+ * \f$XS^T\f$ pass the CSC form of \f$S^T\f$, which is the CSR form
+ * of S.
+ * @param[in] X dense matrix of size \f$k \times m\f$
+ * @param[in] S sparse matrix of size \f$m \times n\f$
+ * @param[out] C dense matrix of size \f$k \times n\f$. Must be allocated.
+ */
+template <class SPMATTYPE>
+void denseSpMM(const MAT &X, const SPMATTYPE &S, MAT *C) {
+  const UWORD k = X.n_rows;
+  if (k == 2) {
+    denseSpMM2(X, S, C);
+    return;
+  }
+#pragma omp parallel for schedule(dynamic, 64)
+  for (UWORD col = 0; col < S.n_cols; col++) {
+    double *ccol = C->colptr(col);
+    for (UWORD kk = 0; kk < k; kk++) ccol[kk] = 0;
+    const UWORD endIdx = S.col_ptrs[col + 1];
+    for (UWORD ii = S.col_ptrs[col]; ii < endIdx; ii++) {
+      const double *xcol = X.colptr(S.row_indices[ii]);
+      const double val = S.values[ii];
+#pragma omp simd
+      for (UWORD kk = 0; kk < k; kk++) {
+        ccol[kk] += val * xcol[kk];
+      }
+    }
+  }
+}
+
+/**
+ * Fused single pass over the non zeros of the sparse matrix A.
+ * The factors are passed transposed so that the k entries of every row
+ * of W and H are contiguous, \f$W^T\f$ is \f$k \times m\f$ and
+ * \f$H^T\f$ is \f$k \times n\f$. Every \f$w_i^T h_j\f$ is computed
+ * once and used for both the sums below.
+ * @param[in] A sparse input matrix of size \f$m \times n\f$
+ * @param[in] Wt transpose of the left low rank factor
+ * @param[in] Ht transpose of the right low rank factor
+ * @param[out] nnzsse over all nnz \f$(a_{ij} - w_i^T h_j)^2\f$
+ * @param[out] nnzwh over all nnz \f$(w_i^T h_j)^2\f$
  */
 template <class INPUTTYPE, class LRTYPE>
-double computeObjectiveError(const INPUTTYPE &A, const LRTYPE &W,
-                             const LRTYPE &H) {
-  // 1. over all nnz (a_ij - w_i h_j)^2
-  // 2. over all nnz (w_i h_j)^2
-  // 3. Compute R of W ahd L of H through QR
-  // 4. use sgemm to compute RL
-  // 5. use slange to compute ||RL||_F^2
-  // 6. return nnzsse+nnzwh-||RL||_F^2
-  UWORD k = W.n_cols;
-  UWORD m = A.n_rows;
-  UWORD n = A.n_cols;
-  tic();
-  double nnzsse = 0;
-  double nnzwh = 0;
-  LRTYPE Rw(k, k);
-  LRTYPE Rh(k, k);
-  LRTYPE Qw(m, k);
-  LRTYPE Qh(n, k);
-  LRTYPE RwRh(k, k);
-#pragma omp parallel for reduction(+ : nnzsse, nnzwh)
-  for (UWORD jj = 1; jj <= A.n_cols; jj++) {
-    UWORD startIdx = A.col_ptrs[jj - 1];
-    UWORD endIdx = A.col_ptrs[jj];
-    UWORD col = jj - 1;
-    double nnzssecol = 0;
-    double nnzwhcol = 0;
-    for (UWORD ii = startIdx; ii < endIdx; ii++) {
-      UWORD row = A.row_indices[ii];
+void sparseErrorTerms(const INPUTTYPE &A, const LRTYPE &Wt, const LRTYPE &Ht,
+                      double *nnzsse, double *nnzwh) {
+  const UWORD k = Wt.n_rows;
+  double sse = 0;
+  double wh = 0;
+  // columns of A are uneven in nnz. small dynamic chunks balance them
+  // and keep the column of Ht in cache for all its non zeros.
+#pragma omp parallel for schedule(dynamic, 64) reduction(+ : sse, wh)
+  for (UWORD col = 0; col < A.n_cols; col++) {
+    const double *hcol = Ht.colptr(col);
+    const UWORD endIdx = A.col_ptrs[col + 1];
+    for (UWORD ii = A.col_ptrs[col]; ii < endIdx; ii++) {
+      const double *wrow = Wt.colptr(A.row_indices[ii]);
       double tempsum = 0;
+#pragma omp simd reduction(+ : tempsum)
       for (UWORD kk = 0; kk < k; kk++) {
-        tempsum += (W(row, kk) * H(col, kk));
+        tempsum += wrow[kk] * hcol[kk];
       }
-      nnzwhcol += tempsum * tempsum;
-      nnzssecol += (A.values[ii] - tempsum) * (A.values[ii] - tempsum);
+      const double diff = A.values[ii] - tempsum;
+      wh += tempsum * tempsum;
+      sse += diff * diff;
     }
-    nnzsse += nnzssecol;
-    nnzwh += nnzwhcol;
   }
-  qr_econ(Qw, Rw, W);
-  qr_econ(Qh, Rh, H);
-  RwRh = Rw * Rh.t();
-  double normWH = arma::norm(RwRh, "fro");
-  Rw.clear();
-  Rh.clear();
-  Qw.clear();
-  Qh.clear();
-  RwRh.clear();
+  *nnzsse = sse;
+  *nnzwh = wh;
+}
+
+/**
+ * Returns the squared error \f$\|A-WH^T\|_F^2\f$ of a sparse A as
+ * over all nnz \f$(a_{ij} - w_i^T h_j)^2\f$ +
+ * \f$\|WH^T\|_F^2\f$ - over all nnz \f$(w_i^T h_j)^2\f$.
+ * \f$\|WH^T\|_F^2 = trace(W^TW H^TH)\f$ only needs the two
+ * \f$k \times k\f$ Gram matrices. The factors are taken transposed as
+ * in sparseErrorTerms, so that callers in an iteration loop can keep the
+ * transposes instead of forming them on every call.
+ * @param[in] A sparse input matrix of size \f$m \times n\f$
+ * @param[in] Wt transpose of the left low rank factor, \f$k \times m\f$
+ * @param[in] Ht transpose of the right low rank factor, \f$k \times n\f$
+ */
+template <class INPUTTYPE, class LRTYPE>
+double sparseSquaredError(const INPUTTYPE &A, const LRTYPE &Wt,
+                          const LRTYPE &Ht) {
+  double nnzsse = 0;
+  double nnzwh = 0;
+  sparseErrorTerms(A, Wt, Ht, &nnzsse, &nnzwh);
+  // trace(WtW * HtH) of two symmetric matrices
+  double normWH = arma::accu((Wt * Wt.t()) % (Ht * Ht.t()));
+  double sqerr = nnzsse + (normWH - nnzwh);
+  return (sqerr > 0) ? sqerr : 0.0;
+}
+
+/*
+ * can be called by external people for sparse input matrix.
+ */
+template <class INPUTTYPE, class LRTYPE>
+double computeObjectiveError(const INPUTTYPE &A, const LRTYPE &W,
+                             const LRTYPE &H) {
+  tic();
+  LRTYPE Wt = W.t();
+  LRTYPE Ht = H.t();
+  double fastErr = sqrt(sparseSquaredError(A, Wt, Ht));
   INFO << "error compute time " << toc() << std::endl;
-  double fastErr = sqrt(nnzsse + (normWH * normWH - nnzwh));
   return (fastErr);
 }
 
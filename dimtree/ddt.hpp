@@ -3,11 +3,54 @@
 #ifndef DIMTREE_DDT_HPP_
 #define DIMTREE_DDT_HPP_
 
+#include <omp.h>
+#include <algorithm>
+#include <climits>
+#include <vector>
 #include "common/ncpfactors.hpp"
 #include "common/tensor.hpp"
 #include "dimtree/ddttensor.hpp"
 #include "dimtree/dimtrees.hpp"
 
+/// Number of modes from which the full binary tree replaces the chains
+const long int kBinaryTreeModes = 5;
+
+/**
+ * Node on the path of the full binary dimension tree to the current mode.
+ * projection is the tensor contracted with the factors of every mode
+ * outside [first, last], stored as a
+ * \f$I_{first} \cdots I_{last} \times R\f$ column major matrix with
+ * mode first the fastest. It was computed after the factor update
+ * numbered stamp.
+ */
+struct DimTreeNode {
+  long int first;
+  long int last;
+  unsigned long stamp;
+  MAT projection;
+  DimTreeNode() : first(-1), last(-1), stamp(0) {}
+};
+
+/**
+ * Dimension tree for the in order MTTKRPs of an outer iteration. The
+ * modes 0 to s form the left subtree and s+1 to N-1 the right one. A
+ * partial MTTKRP over the whole tensor gives the projection of each
+ * side, so the tensor is read twice per outer iteration.
+ *
+ * Below the root, tensors of fewer than kBinaryTreeModes modes use a
+ * chain per side. Every mode of a side contracts one more mode out of
+ * the projection computed for the previous mode and then contracts the
+ * rest of the side. The rest of the side is contracted again for every
+ * mode, so the multi-TTV work of a side of n modes of size I is about
+ * \f$nI^nR\f$.
+ *
+ * From kBinaryTreeModes modes on, every side is a full binary tree that
+ * halves its modes at every level. A node is contracted once per outer
+ * iteration into each of its two children, so the multi-TTV work of a
+ * level is about twice the projections of that level and drops
+ * geometrically with the depth. That is about \f$2I^nR\f$ for the side.
+ * Only the projections on the path to the current mode are kept.
+ */
 class DenseDimensionTree {
   ktensor *m_local_Y;
   tensor *m_local_T;
@@ -19,8 +62,235 @@ class DenseDimensionTree {
   long int s;
   long int ldp;
   long int rdp;
+  // full binary tree of kBinaryTreeModes or more modes. m_path[l] is the
+  // node at depth l + 1 on the path to the last mode. m_set_stamp[i] is
+  // the number of the last update of the factor of mode i.
+  bool m_binary;
+  std::vector<DimTreeNode> m_path;
+  std::vector<unsigned long> m_set_stamp;
+  unsigned long m_stamp;
+
+  /// Factor of mode i as an \f$I_i \times R\f$ matrix
+  MAT factor(const long int i) const {
+    MAT factor_t(m_local_Y->factors[i], m_local_Y->rank, m_local_Y->dims[i],
+                 false, true);
+    return factor_t.t();
+  }
+  /**
+   * Khatri-Rao product of the factors of the modes first to last with
+   * mode first the fastest, the order of the rows of a projection.
+   */
+  void krp_range(const long int first, const long int last,
+                 MAT *o_krp) const {
+    const long int rank = m_local_Y->rank;
+    *o_krp = factor(first);
+    for (long int i = first + 1; i <= last; i++) {
+      MAT u = factor(i);
+      const UWORD krows = o_krp->n_rows;
+      MAT next(krows * u.n_rows, rank);
+#pragma omp parallel for schedule(static)
+      for (long int r = 0; r < rank; r++) {
+        const double *k = o_krp->colptr(r);
+        const double *ur = u.colptr(r);
+        double *dst = next.colptr(r);
+        for (UWORD j = 0; j < u.n_rows; j++) {
+          for (UWORD q = 0; q < krows; q++) dst[j * krows + q] = ur[j] * k[q];
+        }
+      }
+      o_krp->swap(next);
+    }
+  }
+  /// Product of the local dimensions of the modes first to last
+  UWORD dims_product(const long int first, const long int last) const {
+    UWORD rc = 1;
+    for (long int i = first; i <= last; i++) rc *= m_local_T->dims[i];
+    return rc;
+  }
+  /// n as a BLAS dimension. Exits if n does not fit the int of BLAS.
+  static int blas_dim(const UWORD n) {
+    if (n > static_cast<UWORD>(INT_MAX)) {
+      ERR << "dimension " << n << " exceeds the int range of BLAS"
+          << std::endl;
+      exit(-1);
+    }
+    return static_cast<int>(n);
+  }
+  /// True if no factor outside the node changed after it was computed
+  bool valid(const DimTreeNode &node) const {
+    for (long int i = 0; i < m_local_T->nmodes; i++) {
+      if ((i < node.first || i > node.last) && m_set_stamp[i] > node.stamp) {
+        return false;
+      }
+    }
+    return true;
+  }
+  /**
+   * Partial MTTKRP of the whole tensor into the left child [0, s] or the
+   * right child [s + 1, N - 1] of the root.
+   */
+  void contract_tensor(const bool left, MAT *o_projection) const {
+    const long int nmodes = m_local_T->nmodes;
+    const int rank = m_local_Y->rank;
+    const int L = blas_dim(dims_product(0, s));
+    const int Rt = blas_dim(dims_product(s + 1, nmodes - 1));
+    MAT krp;
+    if (left) {
+      krp_range(s + 1, nmodes - 1, &krp);
+      o_projection->set_size(L, rank);
+      cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, L, rank, Rt, 1.0,
+                  m_local_T->data, L, krp.memptr(), Rt, 0.0,
+                  o_projection->memptr(), L);
+    } else {
+      krp_range(0, s, &krp);
+      o_projection->set_size(Rt, rank);
+      cblas_dgemm(CblasColMajor, CblasTrans, CblasNoTrans, Rt, rank, L, 1.0,
+                  m_local_T->data, L, krp.memptr(), L, 0.0,
+                  o_projection->memptr(), Rt);
+    }
+  }
+  /**
+   * Multi-TTV of the projection of the node [first, last] with the
+   * factors of one of its halves. Gives the left child [first, mid] or
+   * the right child [mid + 1, last]. Column r of the projection is a
+   * \f$I_{first} \cdots I_{mid} \times I_{mid+1} \cdots I_{last}\f$
+   * matrix that is multiplied with column r of the Khatri-Rao product of
+   * the other half.
+   */
+  void contract_node(const DimTreeNode &parent, const long int mid,
+                     const bool left, MAT *o_projection) const {
+    const long int rank = m_local_Y->rank;
+    const int La = blas_dim(dims_product(parent.first, mid));
+    const int Lb = blas_dim(dims_product(mid + 1, parent.last));
+    MAT krp;
+    if (left) {
+      krp_range(mid + 1, parent.last, &krp);
+    } else {
+      krp_range(parent.first, mid, &krp);
+    }
+    o_projection->set_size(left ? La : Lb, rank);
+    const CBLAS_TRANSPOSE trans = left ? CblasNoTrans : CblasTrans;
+    if (rank >= num_threads) {
+      // one column per thread with single threaded BLAS
+      int blasThreads = get_blas_num_threads();
+      set_blas_num_threads(1);
+#pragma omp parallel for schedule(static)
+      for (long int r = 0; r < rank; r++) {
+        cblas_dgemv(CblasColMajor, trans, La, Lb, 1.0,
+                    parent.projection.colptr(r), La, krp.colptr(r), 1, 0.0,
+                    o_projection->colptr(r), 1);
+      }
+      set_blas_num_threads(blasThreads);
+    } else {
+      for (long int r = 0; r < rank; r++) {
+        cblas_dgemv(CblasColMajor, trans, La, Lb, 1.0,
+                    parent.projection.colptr(r), La, krp.colptr(r), 1, 0.0,
+                    o_projection->colptr(r), 1);
+      }
+    }
+  }
+  /**
+   * Walks the binary tree from the root to the leaf of mode n. Every
+   * node on the path is recomputed from its parent only if a factor
+   * outside of it changed since it was last computed. In the in order
+   * sweep of an outer iteration that happens once per node.
+   * @return depth - 1 of the leaf of mode n in m_path
+   */
+  size_t binary_tree_MTTKRP(const long int n, double &multittv_time,
+                            double &mttkrp_time) {
+    const long int nmodes = m_local_T->nmodes;
+    long int first = 0;
+    long int last = nmodes - 1;
+    for (size_t level = 0;; level++) {
+      const long int mid = (level == 0) ? s : (first + last) / 2;
+      const bool left = n <= mid;
+      const long int child_first = left ? first : mid + 1;
+      const long int child_last = left ? mid : last;
+      if (m_path.size() <= level) m_path.resize(level + 1);
+      if (m_path[level].first != child_first ||
+          m_path[level].last != child_last || !valid(m_path[level])) {
+        DimTreeNode &node = m_path[level];
+        node.first = child_first;
+        node.last = child_last;
+        node.stamp = m_stamp;
+        tic();
+        if (level == 0) {
+          contract_tensor(left, &node.projection);
+          mttkrp_time += toc();
+        } else {
+          contract_node(m_path[level - 1], mid, left, &node.projection);
+          multittv_time += toc();
+        }
+        // the nodes below depend on this one
+        for (size_t l = level + 1; l < m_path.size(); l++) {
+          m_path[l].first = -1;
+        }
+      }
+      if (child_first == child_last) return level;
+      first = child_first;
+      last = child_last;
+    }
+  }
+
+  /**
+   * Multi-TTV work of one subtree from mode a to mode b in units of
+   * rank. The first mode contracts the whole projection, every further
+   * mode reduces the previous projection by one mode and contracts the
+   * rest. The last mode is a single contraction.
+   */
+  static double chain_cost(const UVEC &dims, const long int a,
+                           const long int b) {
+    if (a >= b) return 0;  // partial MTTKRP outputs the factor directly
+    double projection = 1;
+    for (long int i = a; i <= b; i++) projection *= dims[i];
+    double cost = projection;
+    for (long int n = a + 1; n <= b; n++) {
+      cost += projection;  // contract mode n-1
+      projection /= dims[n - 1];
+      if (n < b) cost += projection;
+    }
+    return cost;
+  }
 
  public:
+  /**
+   * Returns the split mode with the least work per outer iteration.
+   * Both partial MTTKRPs multiply the whole tensor whatever the split,
+   * so only the KRPs of the two sides and their multi-TTV chains
+   * depend on it. On a tie the smaller projection buffer wins.
+   * @param[in] dims local dimensions of the tensor
+   */
+  static long int optimal_split(const UVEC &dims) {
+    long int nmodes = dims.n_elem;
+    long int best = 0;
+    double best_cost = -1;
+    double best_buffer = 0;
+    for (long int split = 0; split + 1 < nmodes; split++) {
+      double left = 1, right = 1;
+      for (long int i = 0; i < nmodes; i++) {
+        if (i <= split) {
+          left *= dims[i];
+        } else {
+          right *= dims[i];
+        }
+      }
+      double cost = left + right + chain_cost(dims, 0, split) +
+                    chain_cost(dims, split + 1, nmodes - 1);
+      double buffer = std::max(left, right);
+      if (best_cost < 0 || cost < best_cost ||
+          (cost == best_cost && buffer < best_buffer)) {
+        best = split;
+        best_cost = cost;
+        best_buffer = buffer;
+      }
+    }
+    return best;
+  }
+
+  DenseDimensionTree(const planc::Tensor &i_input_tensor,
+                     const planc::NCPFactors &i_ncp_factors)
+      : DenseDimensionTree(i_input_tensor, i_ncp_factors,
+                           optimal_split(i_input_tensor.dimensions())) {}
+
   DenseDimensionTree(const planc::Tensor &i_input_tensor,
                      const planc::NCPFactors &i_ncp_factors,
                      long int split_mode) {
@@ -31,7 +301,7 @@ class DenseDimensionTree {
     buffer_Tensor = reinterpret_cast<tensor *>(malloc(sizeof *buffer_Tensor));
     projection_Ktensor =
         reinterpret_cast<ktensor *>(malloc(sizeof *projection_Ktensor));
-    m_local_T->data = const_cast<double *>(&i_input_tensor.m_data[0]);
+    m_local_T->data = const_cast<double *>(i_input_tensor.data());
     m_local_T->nmodes = i_input_tensor.modes();
     m_local_T->dims_product = i_input_tensor.numel();
     m_local_Y->factors = reinterpret_cast<double **>(
@@ -50,11 +320,18 @@ class DenseDimensionTree {
       m_local_Y->factors[i] = reinterpret_cast<double *>(
           malloc(sizeof(double) * i_ncp_factors.rank() * m_local_T->dims[i]));
     }
-    num_threads = 16;
+    num_threads = omp_get_max_threads();
     s = split_mode;
-    // Allocate memory for the larger of two partial MTTKRP
+    m_binary = m_local_T->nmodes >= kBinaryTreeModes;
+    m_set_stamp.assign(m_local_T->nmodes, 0);
+    m_stamp = 0;
+    // Allocate memory for the larger of two partial MTTKRP. The binary
+    // tree keeps its projections in m_path instead.
     set_left_right_product(s);
-    if (ldp <= rdp) {
+    if (m_binary) {
+      projection_Tensor->data = NULL;
+      buffer_Tensor->data = NULL;
+    } else if (ldp <= rdp) {
       projection_Tensor->data = reinterpret_cast<double *>(
           malloc(sizeof(double) * rdp * m_local_Y->rank));
       buffer_Tensor->data = reinterpret_cast<double *>(
@@ -90,11 +367,15 @@ class DenseDimensionTree {
     // max_mode);
   }
 
+  /// Split mode of the tree. Modes up to and including it are left.
+  long int split_mode() const { return s; }
+
   void set_factor(const double *arma_factor_ptr, const long int mode) {
     // TransposeM(arma_factor_ptr, m_local_Y->factors[mode],
     // m_local_Y->dims[mode], m_local_Y->rank);
     std::memcpy(m_local_Y->factors[mode], arma_factor_ptr,
                 sizeof(double) * m_local_Y->dims[mode] * m_local_Y->rank);
+    m_set_stamp[mode] = ++m_stamp;
   }
 
   ~DenseDimensionTree() {
@@ -138,6 +419,17 @@ class DenseDimensionTree {
     multittv_time = 0;
     mttkrp_time = 0;
 
+    if (m_binary) {
+      const MAT &leaf =
+          m_path[binary_tree_MTTKRP(n, multittv_time, mttkrp_time)].projection;
+      if (colmajor) {
+        std::memcpy(out, leaf.memptr(), sizeof(double) * leaf.n_elem);
+      } else {
+        MAT out_t(out, leaf.n_cols, leaf.n_rows, false, true);
+        out_t = leaf.t();
+      }
+      return;
+    }
     if (n == 0) {
       /**
           Updating the first factor matrix, do a partial MTTKRP
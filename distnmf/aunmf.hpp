@@ -4,9 +4,12 @@
 #define DISTNMF_AUNMF_HPP_
 
 #include <mpi.h>
+#include <algorithm>
 #include <armadillo>
 #include <string>
 #include <vector>
+#include "common/checkpoint.hpp"
+#include "common/stopping.hpp"
 #include "distnmf/distnmf.hpp"
 #include "distnmf/mpicomm.hpp"
 
@@ -37,6 +40,30 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
   virtual void updateW() = 0;
   virtual void updateH() = 0;
 
+  /**
+   * Computes the gram of a factor together with its product with A, so
+   * that an iteration has no allreduce of the grams. Only used with a
+   * single k block and without overlap_comm and mixed_precision. The
+   * gram adds k*k words to every segment of the reduce_scatter, so this
+   * pays off for small k where the collectives are latency bound.
+   * @param[in] fuse. true to fuse the grams into the reduce_scatter
+   */
+  void fuse_gram_comm(const bool fuse) {
+#ifdef USE_PACOSS
+    if (fuse) {
+      PRINTROOT("fuse_gram_comm is not supported with pacoss. ignored");
+    }
+#else
+    m_fuse_gram = fuse;
+    if (!fuse) return;
+    int kk = this->k * this->k;
+    m_fused_cnts.resize(std::max(NUMROWPROCS, NUMCOLPROCS));
+    m_fused_sendbuf.resize(std::max(WitAij.n_elem + NUMROWPROCS * kk,
+                                    AijHjt.n_elem + NUMCOLPROCS * kk));
+    m_fused_recvbuf.resize(std::max(WtAij.n_elem, AHtij.n_elem) + kk);
+#endif
+  }
+
  private:
   // Things needed while solving for W
   MAT localHtH;         /// H is of size (globaln/p)*k;
@@ -45,25 +72,32 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
   // INPUTMATTYPE A_ij_t;  /// n*m matrix. Transpose of A_ij
   // Things needed while solving for H
   MAT localWtW;        /// W is of size (globalm/p)*k;
-  MAT Wit, Wi;         /// Wi is of size m*k;
+  MAT Wit;             /// Wit is of size k*m;
   MAT WitAij, AijWit;  /// WijtAij is of size k*n;
 
+  // CSC form of the transpose of a sparse A. That is, the CSR form of A.
+  // Built once so that AH never transposes A. Empty for dense A.
+  SP_MAT At_csr;
+
   // needed for error computation
   MAT prevH;        // used for error computation
   MAT prevHtH;      // used for error computation
   MAT WtAijH;       /// global k*k matrix.
   MAT localWtAijH;  /// local k*k matrix
-  MAT errMtx;
-  MAT A_errMtx;
+  MAT errMtx;       /// Wi*Hjt - Aij of the dense error. m*n.
 
-  // needed for symm regularization
-  MAT crossFac;     // holds the appropriate row of W,H
+  // needed for symm regularization. The factor of the paired process
+  // sized as Ht while H is updated and as Wt while W is updated.
+  MAT crossFacH, crossFacW;
   int paired_proc;  // processor to swap factors with
 
-  // needed for block implementation to save memory
-  MAT Ht_blk;
+  // gradients for the pgrad stopping policy
+  MAT gradHt, gradWt;
+
+  // reduce_scatter targets of one block. Only allocated for more than
+  // one block. The blocks are gathered straight from the rows of Wt and
+  // Ht, and a single block reduces straight into WtAij and AHtij.
   MAT AHtij_blk;
-  MAT Wt_blk;
   MAT WtAij_blk;
 
   // Gatherv and Reducescatter variables
@@ -78,6 +112,32 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
   int num_k_blocks;
   int perk;
 
+  // second set of block buffers for the nonblocking overlap mode.
+  // allocated only when overlap_comm is enabled.
+  bool m_overlap_comm;
+  MAT Wit_nb, WitAij_nb, WtAij_blk_nb;
+  MAT Hjt_nb, AijHjt_nb, AHtij_blk_nb;
+
+  // mixed precision mode sends the allgather blocks as float.
+  bool m_mixed_precision;
+  FVEC m_fsendbuf, m_frecvbuf;
+
+  // fused gram mode. every reduce_scatter segment of the product is
+  // followed by the local gram.
+  bool m_fuse_gram;
+  std::vector<double> m_fused_sendbuf, m_fused_recvbuf;
+  std::vector<int> m_fused_cnts;
+
+  // early termination. the gradient norm is local until the end of the
+  // outer iteration.
+  StoppingCriterion m_stopping;
+  double m_pgrad_sqnorm;
+
+  // periodic checkpoints and the first outer iteration after a restart
+  std::string m_checkpoint_file;
+  int m_checkpoint_every;
+  unsigned int m_start_it;
+
   /**
    * Allocates matrices
    */
@@ -109,14 +169,14 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     }
 #endif
     // allocated for block implementation.
-    Ht_blk.zeros(this->perk, (this->W.n_rows));
-    AHtij_blk.zeros(this->perk, this->W.n_rows);
+    if (num_k_blocks > 1) {
+      AHtij_blk.zeros(this->perk, this->W.n_rows);
+    }
 
     // These initialization are for solving H.
     Wt.zeros(this->k, this->W.n_rows);
     WtW.zeros(this->k, this->k);
     localWtW.zeros(this->k, this->k);
-    Wi.zeros(this->m, this->perk);
     Wit.zeros(this->perk, this->m);
     WitAij.zeros(this->perk, this->n);
     AijWit.zeros(this->n, this->perk);
@@ -130,12 +190,8 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     fillVector<int>(0, &gatherWtAdisp);
 
     // allocated for block implementation
-    Wt_blk.zeros(this->perk, this->W.n_rows);
-    WtAij_blk.zeros(this->perk, this->H.n_rows);
-
-    // allocated for symmetric regularisation
-    if (this->symm_reg() > 0) {
-      crossFac.zeros(this->k, this->H.n_rows);
+    if (num_k_blocks > 1) {
+      WtAij_blk.zeros(this->perk, this->H.n_rows);
     }
 #ifdef MPI_VERBOSE
     if (ISROOT) {
@@ -143,14 +199,31 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
       printVector<int>(recvWtAsize);
     }
 #endif
-#ifndef BUILD_SPARSE
+  }
+  /**
+   * Allocates the buffers that depend on the error, the symmetric
+   * regularization and the stopping policy. These are set after the
+   * constructor, so they are sized once before the first iteration.
+   */
+  void allocateLoopMatrices() {
     if (this->is_compute_error()) {
+      prevH.zeros(size(this->H));
+      prevHtH.zeros(this->k, this->k);
+      WtAijH.zeros(this->k, this->k);
+      localWtAijH.zeros(this->k, this->k);
+#ifndef BUILD_SPARSE
       errMtx.zeros(this->m, this->n);
-      A_errMtx.zeros(this->m, this->n);
-    }
 #endif
+    }
+    if (this->symm_reg() > 0) {
+      crossFacH.zeros(arma::size(this->Ht));
+      crossFacW.zeros(arma::size(this->Wt));
+    }
+    if (this->m_stopping.needs_gradient()) {
+      gradHt.zeros(arma::size(this->Ht));
+      gradWt.zeros(arma::size(this->Wt));
+    }
   }
-
   void freeMatrices() {
     HtH.clear();
     localHtH.clear();
@@ -162,7 +235,6 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     Wt.clear();
     WtW.clear();
     localWtW.clear();
-    Wi.clear();
     Wit.clear();
     WitAij.clear();
     AijWit.clear();
@@ -174,17 +246,42 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
       WtAijH.clear();
       localWtAijH.clear();
     }
-    Ht_blk.clear();
     AHtij_blk.clear();
-    Wt_blk.clear();
     WtAij_blk.clear();
+    At_csr.clear();
+    if (m_overlap_comm) {
+      Wit_nb.clear();
+      WitAij_nb.clear();
+      WtAij_blk_nb.clear();
+      Hjt_nb.clear();
+      AijHjt_nb.clear();
+      AHtij_blk_nb.clear();
+    }
     if (this->symm_reg() > 0) {
-      crossFac.clear();
+      crossFacH.clear();
+      crossFacW.clear();
     }
     if (this->is_compute_error()) {
       errMtx.clear();
-      A_errMtx.clear();
     }
+    gradHt.clear();
+    gradWt.clear();
+  }
+
+  /// Builds the row major copy of a sparse A. Nothing to do for dense A.
+  void buildRowMajorInput(const SP_MAT &X) { At_csr = X.t(); }
+  void buildRowMajorInput(const MAT &X) {}
+  /// XtA = Xt * A into the preallocated XtA
+  void localWtA(const MAT &Xt, const SP_MAT &X, MAT *XtA) {
+    denseSpMM(Xt, X, XtA);
+  }
+  void localWtA(const MAT &Xt, const MAT &X, MAT *XtA) { *XtA = Xt * X; }
+  /// XtAt = Xt * A^T into the preallocated XtAt
+  void localAH(const MAT &Xt, const SP_MAT &X, MAT *XtAt) {
+    denseSpMM(Xt, At_csr, XtAt);
+  }
+  void localAH(const MAT &Xt, const MAT &X, MAT *XtAt) {
+    *XtAt = Xt * X.t();
   }
 
   /**
@@ -238,8 +335,15 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
                               communicator) {
     num_k_blocks = numkblks;
     perk = this->k / num_k_blocks;
+    m_overlap_comm = false;
+    m_mixed_precision = false;
+    m_fuse_gram = false;
+    m_pgrad_sqnorm = 0;
+    m_checkpoint_every = 10;
+    m_start_it = 0;
     allocateMatrices();
     setupCommcounts();
+    buildRowMajorInput(input);
     this->Wt = leftlowrankfactor.t();
     this->Ht = rightlowrankfactor.t();
     // A_ij_t = input.t();
@@ -257,6 +361,110 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     // freeMatrices();
   }
 
+  /**
+   * Enables the nonblocking matrix multiplies of distWtA and distAH.
+   * It needs more than one k block to have anything to overlap and
+   * an MPI 3 library for the nonblocking collectives. The block
+   * buffers are doubled.
+   * @param[in] overlap. true to overlap communication and computation
+   */
+  void overlap_comm(const bool overlap) {
+#ifdef USE_PACOSS
+    if (overlap) {
+      PRINTROOT("overlap_comm is not supported with pacoss. ignored");
+    }
+#else
+    m_overlap_comm = overlap && (num_k_blocks > 1);
+    if (overlap && !m_overlap_comm) {
+      PRINTROOT("overlap_comm needs numkblocks > 1. ignored");
+    }
+    if (m_overlap_comm) {
+      Wit_nb.zeros(this->perk, this->m);
+      WitAij_nb.zeros(this->perk, this->n);
+      WtAij_blk_nb.zeros(this->perk, this->H.n_rows);
+      Hjt_nb.zeros(this->perk, this->n);
+      AijHjt_nb.zeros(this->perk, this->m);
+      AHtij_blk_nb.zeros(this->perk, this->W.n_rows);
+    }
+#endif
+  }
+  /// Returns true if the nonblocking matrix multiplies are enabled
+  const bool overlap_comm() const { return m_overlap_comm; }
+  /**
+   * Stops before num_iterations when the criterion is met. The error
+   * policies turn on the error computation.
+   * @param[in] stopping policy and tolerance
+   */
+  void stopping(const StoppingCriterion &stopping) {
+    this->m_stopping = stopping;
+  }
+  /**
+   * Writes W, H, the iteration count and the timers to fname every few
+   * outer iterations. The factors are stored in the global layout, so the
+   * file can restart a run on a different grid.
+   * @param[in] fname checkpoint file. Empty disables checkpoints.
+   * @param[in] every outer iterations between two checkpoints
+   */
+  void checkpoint(const std::string &fname, const int every) {
+#ifdef USE_PACOSS
+    if (!fname.empty()) {
+      PRINTROOT("checkpoint every " << every
+                << " is not supported with pacoss. ignored");
+    }
+#else
+    m_checkpoint_file = fname;
+    m_checkpoint_every = every > 0 ? every : 1;
+#endif
+  }
+  /**
+   * Continues from a checkpoint. Replaces the local W and H with the rows
+   * this process owns and the iteration count and timers with the saved
+   * ones. Collective over the grid.
+   * @param[in] fname checkpoint file written by checkpoint
+   */
+  bool restart(const std::string &fname) {
+    std::vector<MAT *> factors;
+    std::vector<UWORD> global_rows, row_starts;
+    factorLayout(&factors, &global_rows, &row_starts);
+    DistCheckpoint ckp(this->m_mpicomm.gridComm());
+    if (!ckp.read(fname, factors, global_rows, row_starts, 0,
+                  this->time_stats.values().size())) {
+      return false;
+    }
+    this->Wt = this->W.t();
+    this->Ht = this->H.t();
+    this->time_stats.restore(ckp.times());
+    m_start_it = ckp.iteration();
+    PRINTROOT("restarted from " << fname << "::it=" << m_start_it);
+    return true;
+  }
+  /**
+   * Sends the factor allgather blocks of distWtA and distAH as float.
+   * The reduce_scatter of the products, the factors, the local products,
+   * the Gram matrices and the error stay in double. Not used by the
+   * overlap_comm mode.
+   * @param[in] mixed. true to communicate the blocks in float
+   */
+  void mixed_precision(const bool mixed) {
+    m_mixed_precision = mixed;
+    if (mixed && m_overlap_comm) {
+      PRINTROOT("mixed_precision is not used with overlap_comm");
+    }
+  }
+  /// Returns true if the blocks are communicated in float
+  const bool mixed_precision() const { return m_mixed_precision; }
+
+  /**
+   * Type of perk consecutive rows of the k x cols column major Xt. One
+   * element of it sends a block of rows of Wt or Ht in place, so the
+   * blocks are not copied out before the allgather.
+   */
+  MPI_Datatype blockRowsType(const MAT &Xt) const {
+    MPI_Datatype rows;
+    MPI_Type_vector(Xt.n_cols, perk, Xt.n_rows, MPI_DOUBLE, &rows);
+    MPI_Type_commit(&rows);
+    return rows;
+  }
   /**
    * This is a matrix multiplication routine based on
    * reduce_scatter.
@@ -271,41 +479,60 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
    * this->m_mpicomm.comm_subs()[1] is row communicator.
    */
   void distWtA() {
+    if (m_overlap_comm) {
+      distMMOverlap(true);
+      return;
+    }
+    // a single block is all of Wt and WtAij. No copies needed.
+    if (num_k_blocks == 1) {
+      distWtABlock(0, &WtAij);
+      return;
+    }
     for (int i = 0; i < num_k_blocks; i++) {
-      int start_row = i * perk;
-      int end_row = (i + 1) * perk - 1;
-      Wt_blk = Wt.rows(start_row, end_row);
-      distWtABlock();
-      WtAij.rows(start_row, end_row) = WtAij_blk;
+      distWtABlock(i * perk, &WtAij_blk);
+      WtAij.rows(i * perk, (i + 1) * perk - 1) = WtAij_blk;
     }
   }
-  void distWtABlock() {
+  /**
+   * WtA of one block of perk rows of Wt. The rows are gathered in place
+   * with blockRowsType.
+   * @param[in] start_row first row of the block in Wt
+   * @param[out] recvbuf perk x (globaln/p) block of WtAij
+   */
+  void distWtABlock(const int start_row, MAT *recvbuf) {
 #ifdef USE_PACOSS
     // Perform expand communication using Pacoss.
-    memcpy(Wit.memptr(), Wt_blk.memptr(),
-           Wt_blk.n_rows * Wt_blk.n_cols * sizeof(Wt_blk[0]));
+    // the local rows go to the front of Wit, which pacoss expands
+    MAT front(Wit.memptr(), perk, Wt.n_cols, false, true);
+    front = Wt.rows(start_row, start_row + perk - 1);
     MPITIC;
     this->m_rowcomm->expCommBegin(Wit.memptr(), this->perk);
     this->m_rowcomm->expCommFinish(Wit.memptr(), this->perk);
 #else
-    int sendcnt = (this->W.n_rows) * this->perk;
-    Wit.zeros();
     MPITIC;  // allgather WtA
-    MPI_Allgatherv(Wt_blk.memptr(), sendcnt, MPI_DOUBLE, Wit.memptr(),
-                  &(gatherWtAcnts[0]), &(gatherWtAdisp[0]), MPI_DOUBLE,
-                  this->m_mpicomm.commSubs()[1]);
+    if (m_mixed_precision) {
+      allgathervFloat(Wt.memptr() + start_row, perk, Wt.n_cols, Wt.n_rows,
+                      Wit.memptr(), &(gatherWtAcnts[0]), &(gatherWtAdisp[0]),
+                      this->m_mpicomm.commSubs()[1], &m_fsendbuf,
+                      &m_frecvbuf);
+    } else {
+      MPI_Datatype rows = blockRowsType(Wt);
+      MPI_Allgatherv(Wt.memptr() + start_row, 1, rows, Wit.memptr(),
+                     &(gatherWtAcnts[0]), &(gatherWtAdisp[0]), MPI_DOUBLE,
+                     this->m_mpicomm.commSubs()[1]);
+      MPI_Type_free(&rows);
+    }
 #endif
     double temp = MPITOC;  // allgather WtA
     PRINTROOT("n::" << this->n << "::k::" << this->k << PRINTMATINFO(Wt)
                     << PRINTMATINFO(Wit));
 #ifdef MPI_VERBOSE
-    DISTPRINTINFO(PRINTMAT(Wt_blk));
     DISTPRINTINFO(PRINTMAT(Wit));
 #endif
     this->time_stats.communication_duration(temp);
     this->time_stats.allgather_duration(temp);
     MPITIC;  // mm WtA
-    this->WitAij = this->Wit * this->A;
+    this->localWtA(this->Wit, this->A, &this->WitAij);
     // #if defined(MKL_FOUND) && defined(BUILD_SPARSE)
     //     // void ARMAMKLSCSCMM(const SRC &mklMat, const DESTN &Bt, const char
     //     transa,
@@ -333,12 +560,11 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     this->m_colcomm->foldCommBegin(WitAij.memptr(), this->perk);
     this->m_colcomm->foldCommFinish(WitAij.memptr(), this->perk);
     temp = MPITOC;
-    memcpy(WtAij_blk.memptr(), WitAij.memptr(),
-           WtAij_blk.n_rows * WtAij_blk.n_cols * sizeof(WtAij_blk[0]));
+    memcpy(recvbuf->memptr(), WitAij.memptr(),
+           recvbuf->n_rows * recvbuf->n_cols * sizeof(double));
 #else
-    WtAij_blk.zeros();
     MPITIC;  // reduce_scatter WtA
-    MPI_Reduce_scatter(this->WitAij.memptr(), this->WtAij_blk.memptr(),
+    MPI_Reduce_scatter(this->WitAij.memptr(), recvbuf->memptr(),
                        &(scatterWtAcnts[0]), MPI_DOUBLE, MPI_SUM,
                        this->m_mpicomm.commSubs()[0]);
     temp = MPITOC;  // reduce_scatter WtA
@@ -358,15 +584,27 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
    * To preserve the memory for Hj, we collect only partial k
    */
   void distAH() {
+    if (m_overlap_comm) {
+      distMMOverlap(false);
+      return;
+    }
+    // a single block is all of Ht and AHtij. No copies needed.
+    if (num_k_blocks == 1) {
+      distAHBlock(0, &AHtij);
+      return;
+    }
     for (int i = 0; i < num_k_blocks; i++) {
-      int start_row = i * perk;
-      int end_row = (i + 1) * perk - 1;
-      Ht_blk = Ht.rows(start_row, end_row);
-      distAHBlock();
-      AHtij.rows(start_row, end_row) = AHtij_blk;
+      distAHBlock(i * perk, &AHtij_blk);
+      AHtij.rows(i * perk, (i + 1) * perk - 1) = AHtij_blk;
     }
   }
-  void distAHBlock() {
+  /**
+   * AH of one block of perk rows of Ht. The rows are gathered in place
+   * with blockRowsType.
+   * @param[in] start_row first row of the block in Ht
+   * @param[out] recvbuf perk x (globalm/p) block of AHtij
+   */
+  void distAHBlock(const int start_row, MAT *recvbuf) {
     /*
     DISTPRINTINFO("distAH::" << "::Acolst::" \
                   Acolst.n_rows<<"x"<<Acolst.n_cols \
@@ -376,43 +614,40 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     */
 #ifdef USE_PACOSS
     // Perform expand communication using Pacoss.
-    memcpy(Hjt.memptr(), Ht_blk.memptr(),
-           Ht_blk.n_rows * Ht_blk.n_cols * sizeof(Ht_blk[0]));
+    // the local rows go to the front of Hjt, which pacoss expands
+    MAT front(Hjt.memptr(), perk, Ht.n_cols, false, true);
+    front = Ht.rows(start_row, start_row + perk - 1);
     MPITIC;
     this->m_colcomm->expCommBegin(Hjt.memptr(), this->perk);
     this->m_colcomm->expCommFinish(Hjt.memptr(), this->perk);
 #else
-    int sendcnt = (this->H.n_rows) * this->perk;
-    Hjt.zeros();
     MPITIC;  // allgather AH
-    MPI_Allgatherv(this->Ht_blk.memptr(), sendcnt, MPI_DOUBLE,
-                  this->Hjt.memptr(), &(gatherAHcnts[0]), &(gatherAHdisp[0]),
-                  MPI_DOUBLE, this->m_mpicomm.commSubs()[0]);
+    if (m_mixed_precision) {
+      allgathervFloat(Ht.memptr() + start_row, perk, Ht.n_cols, Ht.n_rows,
+                      this->Hjt.memptr(), &(gatherAHcnts[0]),
+                      &(gatherAHdisp[0]), this->m_mpicomm.commSubs()[0],
+                      &m_fsendbuf, &m_frecvbuf);
+    } else {
+      MPI_Datatype rows = blockRowsType(Ht);
+      MPI_Allgatherv(Ht.memptr() + start_row, 1, rows, this->Hjt.memptr(),
+                     &(gatherAHcnts[0]), &(gatherAHdisp[0]), MPI_DOUBLE,
+                     this->m_mpicomm.commSubs()[0]);
+      MPI_Type_free(&rows);
+    }
 #endif
     PRINTROOT("n::" << this->n << "::k::" << this->k << PRINTMATINFO(Ht)
                     << PRINTMATINFO(Hjt));
     double temp = MPITOC;  // allgather AH
 #ifdef MPI_VERBOSE
-    DISTPRINTINFO(PRINTMAT(Ht_blk));
     DISTPRINTINFO(PRINTMAT(Hjt));
     // DISTPRINTINFO(PRINTMAT(this->A_ij_t));
 #endif
     this->time_stats.communication_duration(temp);
     this->time_stats.allgather_duration(temp);
     MPITIC;  // mm AH
-/*
-#ifdef BUILD_SPARSE
-    this->Hj = this->Hjt.t();
-    this->AijHj = this->A * this->Hj;
-    this->AijHjt = this->AijHj.t();
-#else
-    this->AijHjt = this->Hjt * this->A.t();
-#endif
-More memory efficient to rewrite code as above since A.t() will construct a
-copy of the A in the sparse case. However sparse x dense matmul is much slower
-than in dense x sparse. Keeping current version for performance reasons.
-*/
-    this->AijHjt = this->Hjt * this->A.t();
+    // sparse A uses the row major copy built in the constructor instead
+    // of constructing A.t() on every call.
+    this->localAH(this->Hjt, this->A, &this->AijHjt);
     // #if defined(MKL_FOUND) && defined(BUILD_SPARSE)
     //     // void ARMAMKLSCSCMM(const SRC &mklMat, const DESTN &Bt, const char
     //     transa,
@@ -440,12 +675,11 @@ than in dense x sparse. Keeping current version for performance reasons.
     this->m_rowcomm->foldCommBegin(AijHjt.memptr(), this->perk);
     this->m_rowcomm->foldCommFinish(AijHjt.memptr(), this->perk);
     temp = MPITOC;
-    memcpy(AHtij_blk.memptr(), AijHjt.memptr(),
-           AHtij_blk.n_rows * AHtij_blk.n_cols * sizeof(AHtij_blk[0]));
+    memcpy(recvbuf->memptr(), AijHjt.memptr(),
+           recvbuf->n_rows * recvbuf->n_cols * sizeof(double));
 #else
-    AHtij_blk.zeros();
     MPITIC;  // reduce_scatter AH
-    MPI_Reduce_scatter(this->AijHjt.memptr(), this->AHtij_blk.memptr(),
+    MPI_Reduce_scatter(this->AijHjt.memptr(), recvbuf->memptr(),
                        &(this->scatterAHcnts[0]), MPI_DOUBLE, MPI_SUM,
                        this->m_mpicomm.commSubs()[1]);
     temp = MPITOC;  // reduce_scatter AH
@@ -453,6 +687,166 @@ than in dense x sparse. Keeping current version for performance reasons.
     this->time_stats.communication_duration(temp);
     this->time_stats.reducescatter_duration(temp);
   }
+  /**
+   * Nonblocking variant of distWtA and distAH for num_k_blocks > 1.
+   * The block buffers are doubled. While block i is multiplied, the
+   * allgather of block i+1 and the reduce_scatter of block i-1 are in
+   * flight. Only the time spent waiting on a request is counted as
+   * communication. The multiply time is reported once for all blocks.
+   * @param[in] wta. true computes WtAij from Wt, false computes AHtij
+   *            from Ht.
+   */
+  void distMMOverlap(const bool wta) {
+#ifndef USE_PACOSS
+    const MAT &Xt = wta ? this->Wt : this->Ht;
+    MAT *XtA = wta ? &this->WtAij : &this->AHtij;
+    MAT *gatherbuf[2], *mmbuf[2], *recvbuf[2];
+    if (wta) {
+      gatherbuf[0] = &Wit;      gatherbuf[1] = &Wit_nb;
+      mmbuf[0] = &WitAij;       mmbuf[1] = &WitAij_nb;
+      recvbuf[0] = &WtAij_blk;  recvbuf[1] = &WtAij_blk_nb;
+    } else {
+      gatherbuf[0] = &Hjt;      gatherbuf[1] = &Hjt_nb;
+      mmbuf[0] = &AijHjt;       mmbuf[1] = &AijHjt_nb;
+      recvbuf[0] = &AHtij_blk;  recvbuf[1] = &AHtij_blk_nb;
+    }
+    // WtA gathers along the row communicator and reduces along the
+    // column communicator. AH is the other way around.
+    MPI_Comm gathercomm = this->m_mpicomm.commSubs()[wta ? 1 : 0];
+    MPI_Comm scattercomm = this->m_mpicomm.commSubs()[wta ? 0 : 1];
+    int *gathercnts = wta ? &gatherWtAcnts[0] : &gatherAHcnts[0];
+    int *gatherdisp = wta ? &gatherWtAdisp[0] : &gatherAHdisp[0];
+    int *scattercnts = wta ? &scatterWtAcnts[0] : &scatterAHcnts[0];
+    // the blocks are sent straight from the rows of Xt, which is not
+    // written until every request completed
+    MPI_Datatype rows = blockRowsType(Xt);
+    MPI_Request gatherreq[2];
+    MPI_Request scatterreq[2];
+    double temp, mmtime = 0;
+
+    MPI_Iallgatherv(Xt.memptr(), 1, rows, gatherbuf[0]->memptr(), gathercnts,
+                    gatherdisp, MPI_DOUBLE, gathercomm, &gatherreq[0]);
+    for (int i = 0; i < num_k_blocks; i++) {
+      int cur = i % 2;
+      int nxt = 1 - cur;
+      MPITIC;  // allgather wait
+      MPI_Wait(&gatherreq[cur], MPI_STATUS_IGNORE);
+      temp = MPITOC;  // allgather wait
+      this->time_stats.communication_duration(temp);
+      this->time_stats.allgather_duration(temp);
+      // buffers of nxt were released by block i-1
+      if (i + 1 < num_k_blocks) {
+        MPI_Iallgatherv(Xt.memptr() + (i + 1) * perk, 1, rows,
+                        gatherbuf[nxt]->memptr(), gathercnts, gatherdisp,
+                        MPI_DOUBLE, gathercomm, &gatherreq[nxt]);
+      }
+      // buffers of cur are still owned by the reduce_scatter of block i-2
+      if (i >= 2) {
+        finishOverlapScatter(i - 2, &scatterreq[cur], *recvbuf[cur], XtA);
+      }
+      MPITIC;  // mm
+      if (wta) {
+        this->localWtA(*gatherbuf[cur], this->A, mmbuf[cur]);
+      } else {
+        this->localAH(*gatherbuf[cur], this->A, mmbuf[cur]);
+      }
+      temp = MPITOC;  // mm
+      mmtime += temp;
+      this->time_stats.compute_duration(temp);
+      this->time_stats.mm_duration(temp);
+      MPI_Ireduce_scatter(mmbuf[cur]->memptr(), recvbuf[cur]->memptr(),
+                          scattercnts, MPI_DOUBLE, MPI_SUM, scattercomm,
+                          &scatterreq[cur]);
+    }
+    for (int i = std::max(num_k_blocks - 2, 0); i < num_k_blocks; i++) {
+      finishOverlapScatter(i, &scatterreq[i % 2], *recvbuf[i % 2], XtA);
+    }
+    MPI_Type_free(&rows);
+    this->reportTime(mmtime, wta ? "WtA::" : "AH::");
+#endif
+  }
+  /**
+   * Waits for the reduce_scatter of block blk and copies the
+   * result into its rows of XtA.
+   */
+  void finishOverlapScatter(const int blk, MPI_Request *req,
+                            const MAT &recvbuf, MAT *XtA) {
+    MPITIC;  // reduce_scatter wait
+    MPI_Wait(req, MPI_STATUS_IGNORE);
+    double temp = MPITOC;  // reduce_scatter wait
+    this->time_stats.communication_duration(temp);
+    this->time_stats.reducescatter_duration(temp);
+    XtA->rows(blk * perk, (blk + 1) * perk - 1) = recvbuf;
+  }
+  /**
+   * distInnerProduct and distWtA, or distInnerProduct and distAH, with
+   * two collectives instead of three. The gathered Wit holds all the
+   * rows of W of a process row, and the reduce_scatter of WtA sums over
+   * the process rows. So \f$WtW = \sum_i W_i^TW_i\f$ is summed by the
+   * same reduce_scatter when every segment carries the local gram
+   * \f$W_i^TW_i\f$. AH is the same with the roles of the communicators
+   * swapped. See fuse_gram_comm.
+   * @param[in] wta. true computes WtAij and WtW from Wt, false computes
+   *            AHtij and HtH from Ht.
+   */
+  void distFusedMM(const bool wta) {
+#ifndef USE_PACOSS
+    const MAT &Xt = wta ? this->Wt : this->Ht;
+    MAT *XtA = wta ? &this->WtAij : &this->AHtij;
+    MAT *XtX = wta ? &this->WtW : &this->HtH;
+    MAT *localXtX = wta ? &localWtW : &localHtH;
+    MAT *gathered = wta ? &this->Wit : &this->Hjt;
+    MAT *product = wta ? &this->WitAij : &this->AijHjt;
+    MPI_Comm gathercomm = this->m_mpicomm.commSubs()[wta ? 1 : 0];
+    MPI_Comm scattercomm = this->m_mpicomm.commSubs()[wta ? 0 : 1];
+    int *gathercnts = wta ? &gatherWtAcnts[0] : &gatherAHcnts[0];
+    int *gatherdisp = wta ? &gatherWtAdisp[0] : &gatherAHdisp[0];
+    int *scattercnts = wta ? &scatterWtAcnts[0] : &scatterAHcnts[0];
+    int nseg = wta ? NUMROWPROCS : NUMCOLPROCS;
+    int kk = this->k * this->k;
+    MPITIC;  // allgather
+    MPI_Allgatherv(Xt.memptr(), Xt.n_elem, MPI_DOUBLE, gathered->memptr(),
+                   gathercnts, gatherdisp, MPI_DOUBLE, gathercomm);
+    double temp = MPITOC;  // allgather
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allgather_duration(temp);
+    MPITIC;  // gram
+    *localXtX = (*gathered) * gathered->t();
+    temp = MPITOC;  // gram
+    this->time_stats.compute_duration(temp);
+    this->time_stats.gram_duration(temp);
+    MPITIC;  // mm
+    if (wta) {
+      this->localWtA(*gathered, this->A, product);
+    } else {
+      this->localAH(*gathered, this->A, product);
+    }
+    temp = MPITOC;  // mm
+    this->time_stats.compute_duration(temp);
+    this->time_stats.mm_duration(temp);
+    this->reportTime(temp, wta ? "WtA::" : "AH::");
+    MPITIC;  // pack
+    const double *src = product->memptr();
+    double *dst = &m_fused_sendbuf[0];
+    for (int i = 0; i < nseg; i++) {
+      dst = std::copy(src, src + scattercnts[i], dst);
+      src += scattercnts[i];
+      dst = std::copy(localXtX->memptr(), localXtX->memptr() + kk, dst);
+      m_fused_cnts[i] = scattercnts[i] + kk;
+    }
+    temp = MPITOC;  // pack
+    this->time_stats.compute_duration(temp);
+    MPITIC;  // reduce_scatter
+    MPI_Reduce_scatter(&m_fused_sendbuf[0], &m_fused_recvbuf[0],
+                       &m_fused_cnts[0], MPI_DOUBLE, MPI_SUM, scattercomm);
+    temp = MPITOC;  // reduce_scatter
+    this->time_stats.communication_duration(temp);
+    this->time_stats.reducescatter_duration(temp);
+    const double *recv = &m_fused_recvbuf[0];
+    std::copy(recv, recv + XtA->n_elem, XtA->memptr());
+    std::copy(recv + XtA->n_elem, recv + XtA->n_elem + kk, XtX->memptr());
+#endif
+  }
   /**
    * There are p processes.
    * Every process i has W in m_i * k
@@ -473,7 +867,6 @@ than in dense x sparse. Keeping current version for performance reasons.
     double temp = MPITOC;  // gram
     this->time_stats.compute_duration(temp);
     this->time_stats.gram_duration(temp);
-    (*XtX).zeros();
     if (X.n_rows == this->m) {
       this->reportTime(temp, "Gram::W::");
     } else {
@@ -493,57 +886,73 @@ than in dense x sparse. Keeping current version for performance reasons.
    */
   void computeNMF() {
     PRINTROOT("computeNMF started");
+    if (this->m_stopping.needs_error()) this->compute_error(1);
 #ifdef MPI_VERBOSE
     DISTPRINTINFO(PRINTMAT(this->A));
 #endif
-    // error computation
-    if (this->is_compute_error()) {
-      prevH.zeros(size(this->H));
-      prevHtH.zeros(this->k, this->k);
-      WtAijH.zeros(this->k, this->k);
-      localWtAijH.zeros(this->k, this->k);
-    }
+    // everything the loop writes is sized here. The loop only reuses it.
+    allocateLoopMatrices();
 #ifdef __WITH__BARRIER__TIMING__
     MPI_Barrier(MPI_COMM_WORLD);
 #endif
-    for (unsigned int iter = 0; iter < this->num_iterations(); iter++) {
+    // a restart has no HtH of the previous iteration for the error
+    if (m_start_it > 0 && this->is_compute_error()) {
+      this->distInnerProduct(this->H, &this->HtH);
+      this->applyReg(this->regW(), &this->HtH);
+    }
+    unsigned long prev_pivots = this->time_stats.nnls_pivots();
+#ifdef COUNT_ARMA_ALLOCS
+    unsigned long prev_allocs = armaAllocations();
+#endif
+    bool fused = m_fuse_gram && num_k_blocks == 1 && !m_overlap_comm &&
+                 !m_mixed_precision;
+    for (unsigned int iter = m_start_it; iter < this->num_iterations();
+         iter++) {
       // saving current instance for error computation.
       if (iter > 0 && this->is_compute_error()) {
         this->prevH = this->H;
         this->prevHtH = this->HtH;
       }
       MPITIC;  // total_d W&H
+      this->m_pgrad_sqnorm = 0;
       // update H given WtW and WtA step 4 of the algorithm
       {
-        // compute WtW
-        this->distInnerProduct(this->W, &this->WtW);
+        // compute WtW and WtA
+        if (fused) {
+          this->distFusedMM(true);
+        } else {
+          this->distInnerProduct(this->W, &this->WtW);
+          this->distWtA();
+        }
         PRINTROOT(PRINTMATINFO(this->WtW));
         this->applyReg(this->regH(), &this->WtW);
 #ifdef MPI_VERBOSE
         PRINTROOT(PRINTMAT(this->WtW));
 #endif
-        // compute WtA
-        this->distWtA();
         if (this->symm_reg() > 0) {
           // Get the appropriate Wt from the transposed processor
-          this->crossFac.zeros(arma::size(this->Ht));
-          int recvsize = this->crossFac.n_elem;
+          int recvsize = this->crossFacH.n_elem;
           int sendsize = this->Wt.n_elem;
           MPITIC;
           MPI_Sendrecv(this->Wt.memptr(), sendsize, MPI_DOUBLE, paired_proc, 0,
-              this->crossFac.memptr(), recvsize, MPI_DOUBLE, paired_proc, 0,
+              this->crossFacH.memptr(), recvsize, MPI_DOUBLE, paired_proc, 0,
               this->m_mpicomm.gridComm(), MPI_STATUS_IGNORE);
           double temp = MPITOC;  // sendrecv
           this->time_stats.communication_duration(temp);
           this->time_stats.sendrecv_duration(temp);
 
           this->applySymmetricReg(this->symm_reg(), &this->WtW,
-                  &this->crossFac, &this->WtAij);
+                  &this->crossFacH, &this->WtAij);
         }
         // PRINTROOT(PRINTMATINFO(this->WtAij));
 #ifdef MPI_VERBOSE
         DISTPRINTINFO(PRINTMAT(this->WtAij));
 #endif
+        if (this->m_stopping.needs_gradient()) {
+          this->gradHt = this->WtW * this->Ht;
+          this->gradHt -= this->WtAij;
+          this->m_pgrad_sqnorm += projectedGradSqNorm(this->Ht, this->gradHt);
+        }
         MPITIC;  // nnls H
         // ensure both Ht and H are consistent after the update
         // some function find Ht and some H.
@@ -558,35 +967,42 @@ than in dense x sparse. Keeping current version for performance reasons.
       }
       // Update W given HtH and AH step 3 of the algorithm.
       {
-        // compute HtH
-        this->distInnerProduct(this->H, &this->HtH);
+        // compute HtH and AH
+        if (fused) {
+          this->distFusedMM(false);
+        } else {
+          this->distInnerProduct(this->H, &this->HtH);
+          this->distAH();
+        }
         PRINTROOT("HtH::" << PRINTMATINFO(this->HtH));
         this->applyReg(this->regW(), &this->HtH);
 #ifdef MPI_VERBOSE
         PRINTROOT(PRINTMAT(this->HtH));
 #endif
-        // compute AH
-        this->distAH();
         if (this->symm_reg() > 0) {
           // Get the appropriate Ht from the transposed processor
-          this->crossFac.zeros(arma::size(this->Wt));
-          int recvsize = this->crossFac.n_elem;
+          int recvsize = this->crossFacW.n_elem;
           int sendsize = this->Ht.n_elem;
           MPITIC;
           MPI_Sendrecv(this->Ht.memptr(), sendsize, MPI_DOUBLE, paired_proc, 0,
-              this->crossFac.memptr(), recvsize, MPI_DOUBLE, paired_proc, 0,
+              this->crossFacW.memptr(), recvsize, MPI_DOUBLE, paired_proc, 0,
               this->m_mpicomm.gridComm(), MPI_STATUS_IGNORE);
           double temp = MPITOC;  // sendrecv
           this->time_stats.communication_duration(temp);
           this->time_stats.sendrecv_duration(temp);
 
           this->applySymmetricReg(this->symm_reg(), &this->HtH,
-                &this->crossFac, &this->AHtij);
+                &this->crossFacW, &this->AHtij);
         }
         // PRINTROOT(PRINTMATINFO(this->AHtij));
 #ifdef MPI_VERBOSE
         DISTPRINTINFO(PRINTMAT(this->AHtij));
 #endif
+        if (this->m_stopping.needs_gradient()) {
+          this->gradWt = this->HtH * this->Wt;
+          this->gradWt -= this->AHtij;
+          this->m_pgrad_sqnorm += projectedGradSqNorm(this->Wt, this->gradWt);
+        }
         MPITIC;  // nnls W
         // Update W given HtH and AH step 3 of the algorithm.
         // ensure W and Wt are consistent. As some algorithms
@@ -615,7 +1031,7 @@ than in dense x sparse. Keeping current version for performance reasons.
 
         // Compute the difference between factor matrices
         if (this->symm_reg() > 0) {
-          double localdiff = arma::norm(this->Wt-this->crossFac, "fro");
+          double localdiff = arma::norm(this->Wt - this->crossFacW, "fro");
           double globaldiff = 0.0;
 
           // Compute global difference
@@ -635,8 +1051,30 @@ than in dense x sparse. Keeping current version for performance reasons.
                     << "::reldiff::" << sqrt(globaldiff / globalWnorm));
         }
       }
+      if (this->m_algorithm == ANLSBPP) {
+        this->reportTime(this->time_stats.nnls_pivots() - prev_pivots,
+                         "NNLS::pivots::");
+        prev_pivots = this->time_stats.nnls_pivots();
+      }
+#ifdef COUNT_ARMA_ALLOCS
+      // the loop buffers are sized before the loop. every count here is a
+      // temporary of the iteration, including those of the nnls solvers.
+      unsigned long allocs = armaAllocations() - prev_allocs;
+      this->time_stats.allocations(allocs);
+      this->reportTime(allocs, "allocs::");
+      prev_allocs = armaAllocations();
+#endif
       PRINTROOT("completed it=" << iter
                                 << "::taken::" << this->time_stats.duration());
+      if (!m_checkpoint_file.empty() && (iter + 1) % m_checkpoint_every == 0) {
+        writeCheckpoint(iter + 1);
+      }
+      // the error is available from the second iteration.
+      if (this->m_stopping.enabled() &&
+          (this->m_stopping.needs_gradient() || iter > 0) &&
+          stopIterations(iter)) {
+        break;
+      }
     }  // end for loop
     MPI_Barrier(MPI_COMM_WORLD);
     this->reportTime(this->time_stats.duration(), "total_d");
@@ -649,6 +1087,12 @@ than in dense x sparse. Keeping current version for performance reasons.
     this->reportTime(this->time_stats.gram_duration(), "total_gram");
     this->reportTime(this->time_stats.mm_duration(), "total_mm");
     this->reportTime(this->time_stats.nnls_duration(), "total_nnls");
+    if (this->m_algorithm == ANLSBPP) {
+      this->reportTime(this->time_stats.nnls_pivots(), "total_nnls_pivots");
+    }
+#ifdef COUNT_ARMA_ALLOCS
+    this->reportTime(this->time_stats.allocations(), "total_allocs");
+#endif
     if (this->symm_reg() > 0) {
       this->reportTime(this->time_stats.sendrecv_duration(), "total_sendrecv");
     }
@@ -693,7 +1137,9 @@ than in dense x sparse. Keeping current version for performance reasons.
 #endif
     this->time_stats.err_communication_duration(temp);
     double tWtAijh = trace(this->WtAijH);
-    double tWtWHtH = trace(this->WtW * this->prevHtH);
+    // both are symmetric, so the trace of the product is the sum of the
+    // elementwise product and needs no k*k temporary
+    double tWtWHtH = arma::accu(this->WtW % this->prevHtH);
     PRINTROOT("::it=" << it << "normA::" << this->m_globalsqnormA
                       << "::tWtAijH::" << 2 * tWtAijh
                       << "::tWtWHtH::" << tWtWHtH);
@@ -708,10 +1154,10 @@ than in dense x sparse. Keeping current version for performance reasons.
     MPITIC;
     // DISTPRINTINFO("::norm(Wi,fro)::" << norm(this->Wit, "fro") <<
     // "::norm(Hjt, fro)::" << norm(this->Hjt, "fro"));
-    this->Wi = this->Wit.t();
-    errMtx = this->Wi * this->Hjt;
-    A_errMtx = this->A - errMtx;
-    local_sqerror = norm(A_errMtx, "fro");
+    // gemm with a transposed Wit into the preallocated errMtx
+    errMtx = this->Wit.t() * this->Hjt;
+    errMtx -= this->A;
+    local_sqerror = norm(errMtx, "fro");
     local_sqerror *= local_sqerror;
     double temp = MPITOC;
     this->time_stats.err_compute_duration(temp);
@@ -723,6 +1169,66 @@ than in dense x sparse. Keeping current version for performance reasons.
     this->time_stats.err_communication_duration(temp);
   }
 
+  /**
+   * Adds this outer iteration to the stopping criterion. The relative
+   * error is already global. The gradient norm is reduced here. All the
+   * processes must agree before any of them stops.
+   */
+  bool stopIterations(const int it) {
+    if (this->m_stopping.needs_gradient()) {
+      double global_sqnorm = 0;
+      MPI_Allreduce(&this->m_pgrad_sqnorm, &global_sqnorm, 1, MPI_DOUBLE,
+                    MPI_SUM, MPI_COMM_WORLD);
+      this->m_stopping.add(global_sqnorm);
+    } else {
+      this->m_stopping.add(
+          sqrt(this->objective_err / this->m_globalsqnormA));
+    }
+    bool stop = allTrue(this->m_stopping.converged(), MPI_COMM_WORLD);
+    if (stop) {
+      PRINTROOT("converged::" << this->m_stopping.name() << "::it=" << it
+                              << "::value::" << this->m_stopping.last());
+    }
+    return stop;
+  }
+
+  /**
+   * Local factors with their global row counts and the first global row
+   * this process owns. Same layout as the factors written by DistIO.
+   */
+  void factorLayout(std::vector<MAT *> *factors,
+                    std::vector<UWORD> *global_rows,
+                    std::vector<UWORD> *row_starts) {
+    int pr = NUMROWPROCS;
+    int pc = NUMCOLPROCS;
+    int rrank = MPI_ROW_RANK;
+    int crank = MPI_COL_RANK;
+    int gm = this->globalm();
+    int gn = this->globaln();
+    factors->push_back(&this->W);
+    factors->push_back(&this->H);
+    global_rows->push_back(gm);
+    global_rows->push_back(gn);
+    row_starts->push_back(startidx(gm, pr, rrank) +
+                          startidx(itersplit(gm, pr, rrank), pc, crank));
+    row_starts->push_back(startidx(gn, pc, crank) +
+                          startidx(itersplit(gn, pc, crank), pr, rrank));
+  }
+  /// Collectively writes the state after it completed outer iterations
+  void writeCheckpoint(const unsigned int it) {
+    MPITIC;  // checkpoint
+    std::vector<MAT *> factors;
+    std::vector<UWORD> global_rows, row_starts;
+    factorLayout(&factors, &global_rows, &row_starts);
+    DistCheckpoint ckp(this->m_mpicomm.gridComm());
+    ckp.iteration(it);
+    ckp.times(this->time_stats.values());
+    bool ok = ckp.write(m_checkpoint_file, factors, global_rows, row_starts);
+    double temp = MPITOC;  // checkpoint
+    PRINTROOT("checkpoint::" << m_checkpoint_file << "::it=" << it
+                             << "::ok::" << ok << "::taken::" << temp);
+  }
+
   // Set the LUC inner iterations for iterative LUC
   void set_luciters(int max_luciters) {}
 };
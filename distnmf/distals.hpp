@@ -2,6 +2,7 @@
 
 #ifndef DISTNMF_DISTALS_HPP_
 #define DISTNMF_DISTALS_HPP_
+#include "common/spdsolver.hpp"
 #include "distnmf/aunmf.hpp"
 
 /**
@@ -13,15 +14,22 @@ namespace planc {
 
 template <class INPUTMATTYPE>
 class DistALS : public DistAUNMF<INPUTMATTYPE> {
+ private:
+  SPDSolver m_gram_solver;
+
  protected:
   /**
    * update W given HtH and AHt
    * AHtij is of size \f$ k \times \frac{globalm}/{p} \f$.
    * this->W is of size \f$ \frac{globalm}{p} \times k \f$
    * this->HtH is of size kxk
+   * The normal equations are solved in place on Wt with the Cholesky
+   * of HtH.
   */
   void updateW() {
-    this->Wt = arma::solve(arma::trimatl(this->HtH), this->AHtij);
+    m_gram_solver.factorize(this->HtH);
+    this->Wt = this->AHtij;
+    m_gram_solver.solve(&this->Wt);
     this->W = this->Wt.t();
     DISTPRINTINFO("ALS::updateW::HtH::" << PRINTMATINFO(this->HtH)
                                         << "::AHtij::"
@@ -38,7 +46,9 @@ class DistALS : public DistAUNMF<INPUTMATTYPE> {
    * this->WtW is of size kxk
    */
   void updateH() {
-    this->Ht = arma::solve(arma::trimatl(this->WtW), this->WtAij);
+    m_gram_solver.factorize(this->WtW);
+    this->Ht = this->WtAij;
+    m_gram_solver.solve(&this->Ht);
     this->H = this->Ht.t();
     DISTPRINTINFO("ALS::updateH::WtW::" << PRINTMATINFO(this->WtW)
                                         << "::WtAij::"
@@ -3,6 +3,7 @@
 #ifndef DISTNMF_DISTHALS_HPP_
 #define DISTNMF_DISTHALS_HPP_
 
+#include "common/halsupdate.hpp"
 #include "distnmf/aunmf.hpp"
 /**
  * emulating Jingu's code
@@ -14,6 +15,9 @@ namespace planc {
 
 template <class INPUTMATTYPE>
 class DistHALS : public DistAUNMF<INPUTMATTYPE> {
+  VEC sqnorms;         /// local squared column norms of the update
+  VEC global_sqnorms;  /// global squared column norms of the update
+
  protected:
   /**
    * AHtij is of size \f$ k \times \frac{globalm}/{p}\f$.
@@ -21,35 +25,24 @@ class DistHALS : public DistAUNMF<INPUTMATTYPE> {
    * this->HtH is of size kxk
    * Eq 14(a) page 7 of JGO paper
    * \f$W(:,i)=[W(:,i) + (AH(:,i)-WH^TH(:,i))/H^TH(i,i)]_+\f$
-   * column normalize W_i
+   * column normalize W after all the columns are updated. The local
+   * norms come out of halsUpdate and take one allreduce of k values.
    */
   void updateW() {
-    for (unsigned int i = 0; i < this->k; i++) {
-      // W(:,i) = max(W(:,i) * HHt_reg(i,i) + AHt(:,i) - W *
-      // HHt_reg(:,i),epsilon);
-      VEC updWi = this->W.col(i) * this->HtH(i, i) +
-                  ((this->AHtij.row(i)).t() - this->W * this->HtH.col(i));
-#ifdef MPI_VERBOSE
-      DISTPRINTINFO("b4 fixNumericalError::" << endl << updWi);
-#endif  // ifdef MPI_VERBOSE
-      fixNumericalError<VEC>(&updWi, EPSILON_1EMINUS16, EPSILON_1EMINUS16);
+    halsUpdate(this->HtH, this->AHtij, true, &this->W, &sqnorms);
 #ifdef MPI_VERBOSE
-      DISTPRINTINFO("after fixNumericalError::" << endl << updWi);
+    DISTPRINTINFO("updated W::" << endl << this->W);
 #endif  // ifdef MPI_VERBOSE
-
-      // W(:,i) = W(:,i)/norm(W(:,i));
-      double normWi = arma::norm(updWi, 2);
-      normWi *= normWi;
-      double globalnormWi;
-      mpitic();
-      MPI_Allreduce(&normWi, &globalnormWi, 1, MPI_DOUBLE, MPI_SUM,
-                    MPI_COMM_WORLD);
-      double temp = mpitoc();
-      this->time_stats.communication_duration(temp);
-      this->time_stats.allreduce_duration(temp);
-
-      if (globalnormWi > 0) {
-        this->W.col(i) = updWi / sqrt(globalnormWi);
+    mpitic();
+    MPI_Allreduce(sqnorms.memptr(), global_sqnorms.memptr(), this->k,
+                  MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    double temp = mpitoc();
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allreduce_duration(temp);
+    // W(:,i) = W(:,i)/norm(W(:,i));
+    for (unsigned int i = 0; i < this->k; i++) {
+      if (global_sqnorms(i) > 0) {
+        this->W.col(i) /= sqrt(global_sqnorms(i));
       }
     }
     this->Wt = this->W.t();
@@ -61,34 +54,15 @@ class DistHALS : public DistAUNMF<INPUTMATTYPE> {
    * this->WtW is of size kxk
    * Eq 14(b) page 7 of JGO paper
    * \f$ H(:,i) = H(:,i) + WtAij(:,i) - HW^TW(:,i)\f$
-   * Here ij is the element of H matrix.
+   * Here ij is the element of H matrix. Entries are kept at least
+   * EPSILON_1EMINUS16, so no column becomes zero.
    */
   void updateH() {
-    for (unsigned int i = 0; i < this->k; i++) {
-      // H(i,:) = max(H(i,:) + WtA(i,:) - WtW_reg(i,:) * H,epsilon);
-      VEC updHi = this->H.col(i) +
-                  ((this->WtAij.row(i)).t() - this->H * this->WtW.col(i));
-#ifdef MPI_VERBOSE
-      DISTPRINTINFO("b4 fixNumericalError::" << endl << updHi);
-#endif  // ifdef MPI_VERBOSE
-      fixNumericalError<VEC>(&updHi, EPSILON_1EMINUS16, EPSILON_1EMINUS16);
+    // H(i,:) = max(H(i,:) + WtA(i,:) - WtW_reg(i,:) * H,epsilon);
+    halsUpdate(this->WtW, this->WtAij, false, &this->H, &sqnorms);
 #ifdef MPI_VERBOSE
-      DISTPRINTINFO("after fixNumericalError::" << endl << updHi);
+    DISTPRINTINFO("updated H::" << endl << this->H);
 #endif  // ifdef MPI_VERBOSE
-      double normHi = arma::norm(updHi, 2);
-      normHi *= normHi;
-      double globalnormHi;
-      mpitic();
-      MPI_Allreduce(&normHi, &globalnormHi, 1, MPI_DOUBLE, MPI_SUM,
-                    MPI_COMM_WORLD);
-      double temp = mpitoc();
-      this->time_stats.communication_duration(temp);
-      this->time_stats.allreduce_duration(temp);
-
-      if (globalnormHi > 0) {
-        this->H.col(i) = updHi;
-      }
-    }
     this->Ht = this->H.t();
   }
 
@@ -98,6 +72,8 @@ class DistHALS : public DistAUNMF<INPUTMATTYPE> {
            const int numkblks)
       : DistAUNMF<INPUTMATTYPE>(input, leftlowrankfactor, rightlowrankfactor,
                                 communicator, numkblks) {
+    sqnorms.zeros(this->k);
+    global_sqnorms.zeros(this->k);
     PRINTROOT("DistHALS() constructor successful");
   }
 };
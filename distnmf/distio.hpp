@@ -11,7 +11,9 @@
 
 #include <algorithm>
 
+#include "common/distnpyio.hpp"
 #include "common/distutils.hpp"
+#include "common/sparsebinary.hpp"
 #include "distnmf/mpicomm.hpp"
 
 /**
@@ -23,6 +25,10 @@
  * TWOD distribution A_totalpartition_rank
  * Just send the first parameter Arows and the second parameter Acols to be
  * zero.
+ * For sparse TWOD input, A can also be a single binary file written by
+ * utilities/sparse2bin. It can be read on any grid. See sparsebinary.hpp.
+ * For dense TWOD input, A ending in .npy is read blockwise from a 2D
+ * numpy array in C or Fortran order and its shape overrides m and n.
  */
 
 namespace planc {
@@ -544,6 +550,9 @@ class DistIO {
         int srow = itersplit(m, pr, MPI_ROW_RANK);
         int scol = itersplit(n, pc, MPI_COL_RANK);
 #ifdef BUILD_SPARSE
+        // binary container written by utilities/sparse2bin
+        if (readInputSparseBinary(file_name, m, n)) return;
+        sr << file_name << "_" << MPI_SIZE << "_" << MPI_RANK;
         MAT temp_ijv;
         temp_ijv.load(sr.str(), arma::raw_ascii);
         if (temp_ijv.n_rows > 0 && temp_ijv.n_cols > 0) {
@@ -564,7 +573,12 @@ class DistIO {
         // uniform_dist_matrix(m_A);
         m_A.resize(srow, scol);
 #else
-        readInputMatrix(m, n, file_name);
+        if (file_name.size() > 4 &&
+            file_name.compare(file_name.size() - 4, 4, ".npy") == 0) {
+          readInputNpy(file_name);
+        } else {
+          readInputMatrix(m, n, file_name);
+        }
 #endif
       }
     }
@@ -620,6 +634,163 @@ class DistIO {
     MPI_File_close(&fh);
     MPI_Type_free(&view);
   }
+  /**
+   * Reads the 2D block of this process from a npy file. The header is
+   * parsed once by the root and every process reads its block with a
+   * subarray view. The global sizes are taken from the file. The
+   * drivers read the same shape with npyShape before the grid is set up.
+   * @param[in] input_file_name of a 2D npy array of doubles
+   */
+  void readInputNpy(const std::string& input_file_name) {
+    DistNumPyArray npy(MPI_COMM_WORLD);
+    if (!npy.open(input_file_name) || npy.dims().n_elem != 2) {
+      if (ISROOT) {
+        DISTPRINTINFO("Error: " << input_file_name
+                                << " is not a 2D npy array of doubles");
+      }
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int global_m = npy.dims()[0];
+    int global_n = npy.dims()[1];
+    int pr = m_mpicomm.pr();
+    int pc = m_mpicomm.pc();
+    int row_rank = m_mpicomm.row_rank();
+    int col_rank = m_mpicomm.col_rank();
+
+    UVEC starts(2), counts(2);
+    starts[0] = startidx(global_m, pr, row_rank);
+    starts[1] = startidx(global_n, pc, col_rank);
+    counts[0] = itersplit(global_m, pr, row_rank);
+    counts[1] = itersplit(global_n, pc, col_rank);
+    m_A.zeros(counts[0], counts[1]);
+    if (!npy.read(input_file_name, starts, counts, m_A.memptr())) {
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+#ifdef BUILD_SPARSE
+  /**
+   * Reads count entries of elemsize bytes from offset with
+   * MPI_File_read_at_all in pieces that fit an int count. Every rank
+   * calls the collective read the same number of times.
+   */
+  void readAtAllChunked(MPI_File fh, MPI_Offset offset, void* buf,
+                        uint64_t count, size_t elemsize) {
+    const uint64_t kChunk = 1 << 27;
+    uint64_t nchunks = (count + kChunk - 1) / kChunk;
+    uint64_t maxchunks = 0;
+    MPI_Allreduce(&nchunks, &maxchunks, 1, MPI_UINT64_T, MPI_MAX,
+                  MPI_COMM_WORLD);
+    char* dest = static_cast<char*>(buf);
+    for (uint64_t c = 0; c < maxchunks; c++) {
+      uint64_t begin = std::min(c * kChunk, count);
+      uint64_t len = std::min(kChunk, count - begin);
+      MPI_File_read_at_all(fh, offset + begin * elemsize,
+                           dest + begin * elemsize, len * elemsize, MPI_BYTE,
+                           MPI_STATUS_IGNORE);
+    }
+  }
+  /**
+   * Reads the local 2D block of a binary sparse file written by
+   * utilities/sparse2bin. The file holds global coordinates and does not
+   * depend on the grid. All ranks open the file collectively, every rank
+   * reads one contiguous nnz/p range of entries and an MPI_Alltoallv
+   * sends every entry to the rank that owns its block.
+   * @param[in] input_file_name binary sparse file
+   * @param[in] m global rows given on the command line. 0 to skip check.
+   * @param[in] n global cols given on the command line. 0 to skip check.
+   * @return false if the file does not exist or is not a binary
+   *         sparse file. Aborts on a size mismatch.
+   */
+  bool readInputSparseBinary(const std::string& input_file_name, UWORD m,
+                             UWORD n) {
+    MPI_File fh;
+    int ret = MPI_File_open(MPI_COMM_WORLD, input_file_name.c_str(),
+                            MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    if (ret != MPI_SUCCESS) return false;
+    SparseBinaryHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    MPI_File_read_at_all(fh, 0, &hdr, sizeof(hdr), MPI_BYTE,
+                         MPI_STATUS_IGNORE);
+    SparseBinaryLayout layout(hdr);
+    if (!layout.valid()) {
+      MPI_File_close(&fh);
+      return false;
+    }
+    if ((m > 0 && hdr.m != m) || (n > 0 && hdr.n != n)) {
+      if (ISROOT) {
+        ERR << "binary sparse file " << input_file_name << " is " << hdr.m
+            << "x" << hdr.n << ". given " << m << "x" << n << std::endl;
+      }
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const int p = MPI_SIZE;
+    const uint64_t pr = m_mpicomm.pr();
+    const uint64_t pc = m_mpicomm.pc();
+    uint64_t first = SparseBinaryLayout::start(hdr.nnz, p, MPI_RANK);
+    uint64_t count = SparseBinaryLayout::split(hdr.nnz, p, MPI_RANK);
+    std::vector<SparseBinaryEntry> entries(count);
+    readAtAllChunked(fh, layout.entry_offset(first),
+                     count ? &entries[0] : NULL, count,
+                     sizeof(SparseBinaryEntry));
+    MPI_File_close(&fh);
+
+    // rank of every grid position
+    int coords[2] = {MPI_ROW_RANK, MPI_COL_RANK};
+    std::vector<int> allcoords(2 * p);
+    MPI_Allgather(coords, 2, MPI_INT, &allcoords[0], 2, MPI_INT,
+                  MPI_COMM_WORLD);
+    std::vector<int> grid_rank(p);
+    for (int q = 0; q < p; q++) {
+      grid_rank[allcoords[2 * q] * pc + allcoords[2 * q + 1]] = q;
+    }
+    // bucket the entries by owner
+    std::vector<int> dest(count);
+    std::vector<int> sendcnts(p, 0), recvcnts(p, 0);
+    std::vector<int> sdispls(p, 0), rdispls(p, 0);
+    for (uint64_t e = 0; e < count; e++) {
+      uint64_t r = SparseBinaryLayout::owner(entries[e].row, hdr.m, pr);
+      uint64_t c = SparseBinaryLayout::owner(entries[e].col, hdr.n, pc);
+      dest[e] = grid_rank[r * pc + c];
+      sendcnts[dest[e]]++;
+    }
+    MPI_Alltoall(&sendcnts[0], 1, MPI_INT, &recvcnts[0], 1, MPI_INT,
+                 MPI_COMM_WORLD);
+    for (int q = 1; q < p; q++) {
+      sdispls[q] = sdispls[q - 1] + sendcnts[q - 1];
+      rdispls[q] = rdispls[q - 1] + recvcnts[q - 1];
+    }
+    uint64_t nrecv = rdispls[p - 1] + recvcnts[p - 1];
+    std::vector<SparseBinaryEntry> sendbuf(count), recvbuf(nrecv);
+    std::vector<int> pos(sdispls);
+    for (uint64_t e = 0; e < count; e++) sendbuf[pos[dest[e]]++] = entries[e];
+    entries.clear();
+    MPI_Datatype entry_type;
+    MPI_Type_contiguous(sizeof(SparseBinaryEntry), MPI_BYTE, &entry_type);
+    MPI_Type_commit(&entry_type);
+    MPI_Alltoallv(count ? &sendbuf[0] : NULL, &sendcnts[0], &sdispls[0],
+                  entry_type, nrecv ? &recvbuf[0] : NULL, &recvcnts[0],
+                  &rdispls[0], entry_type, MPI_COMM_WORLD);
+    MPI_Type_free(&entry_type);
+    sendbuf.clear();
+
+    uint64_t row0 = SparseBinaryLayout::start(hdr.m, pr, MPI_ROW_RANK);
+    uint64_t col0 = SparseBinaryLayout::start(hdr.n, pc, MPI_COL_RANK);
+    uint64_t local_m = SparseBinaryLayout::split(hdr.m, pr, MPI_ROW_RANK);
+    uint64_t local_n = SparseBinaryLayout::split(hdr.n, pc, MPI_COL_RANK);
+    arma::umat locations(2, nrecv);
+    VEC vals(nrecv);
+    for (uint64_t e = 0; e < nrecv; e++) {
+      locations(0, e) = recvbuf[e].row - row0;
+      locations(1, e) = recvbuf[e].col - col0;
+      vals(e) = recvbuf[e].value;
+    }
+    // repeated coordinates are summed
+    m_A = SP_MAT(true, locations, vals, local_m, local_n);
+    PRINTROOT("read binary sparse input::" << hdr.m << "x" << hdr.n
+                                            << "::nnz::" << hdr.nnz);
+    return true;
+  }
+#endif
   /**
    * Writes the factor matrix as output_file_name_W/H
    * @param[in] Local W factor matrix
@@ -671,46 +842,8 @@ class DistIO {
    */
   void writeOutputMatrix(const MAT& X, int global_m, int idx,
                          const std::string& output_file_name) {
-    int rank = m_mpicomm.rank();
-    int size = m_mpicomm.size();
-
-    int local_m = X.n_rows;
-    int global_n = X.n_cols;
-
-    int gsizes[] = {global_m, global_n};
-    int lsizes[] = {local_m, global_n};
-    int starts[] = {idx, 0};
-
-    MPI_Datatype view;
-    if (local_m > 0) {  // process owns some part of X
-      MPI_Type_create_subarray(2, gsizes, lsizes, starts, MPI_ORDER_FORTRAN,
-                               MPI_DOUBLE, &view);
-    } else {  // process owns no data and so previous function will fail
-      MPI_Type_contiguous(0, MPI_DOUBLE, &view);
-    }
-    MPI_Type_commit(&view);
-
-    MPI_File fh;
-    int ret =
-        MPI_File_open(m_mpicomm.gridComm(), output_file_name.c_str(),
-                      MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh);
-    if (ISROOT & ret != MPI_SUCCESS) {
-      DISTPRINTINFO("Error: Could not open file " << output_file_name
-                                                  << std::endl);
-    }
-
-    MPI_Offset disp = 0;
-    MPI_File_set_view(fh, disp, MPI_DOUBLE, view, "native", MPI_INFO_NULL);
-
-    int count = lsizes[0] * lsizes[1];
-    MPI_Status status;
-    ret = MPI_File_write_all(fh, X.memptr(), count, MPI_DOUBLE, &status);
-    if (ISROOT && ret != MPI_SUCCESS) {
-      DISTPRINTINFO("Error could not write file " << output_file_name
-                                                  << std::endl);
-    }
-    MPI_File_close(&fh);
-    MPI_Type_free(&view);
+    writeRowBlocks(m_mpicomm.gridComm(), output_file_name, std::string(), X,
+                   global_m, idx);
   }
 
   void writeRandInput() {
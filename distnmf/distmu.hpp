@@ -29,11 +29,14 @@ class DistMU : public DistAUNMF<INPUTMATTYPE> {
    * Here ij is the element of W matrix.
    */
   void updateW() {
-    WHtH = (this->W * this->HtH) + EPSILON;
+    // in place so that neither the product nor W is reallocated
+    WHtH = this->W * this->HtH;
+    WHtH += EPSILON;
 #ifdef MPI_VERBOSE
     DISTPRINTINFO("::WHtH::" << endl << this->WHtH);
 #endif  // ifdef MPI_VERBOSE
-    this->W = (this->W % this->AHtij.t()) / WHtH;
+    this->W %= this->AHtij.t();
+    this->W /= WHtH;
     DISTPRINTINFO("MU::updateW::HtH::"
                   << PRINTMATINFO(this->HtH) << "::WHtH::" << PRINTMATINFO(WHtH)
                   << "::AHtij::" << PRINTMATINFO(this->AHtij)
@@ -67,8 +70,10 @@ class DistMU : public DistAUNMF<INPUTMATTYPE> {
    * Here ij is the element of H matrix.
    */  
   void updateH() {
-    HWtW = this->H * this->WtW + EPSILON;
-    this->H = (this->H % this->WtAij.t()) / HWtW;
+    HWtW = this->H * this->WtW;
+    HWtW += EPSILON;
+    this->H %= this->WtAij.t();
+    this->H /= HWtW;
 #ifdef MPI_VERBOSE
     DISTPRINTINFO("::HWtW::" << endl << HWtW);
 #endif  // ifdef MPI_VERBOSE
@@ -91,8 +96,8 @@ class DistMU : public DistAUNMF<INPUTMATTYPE> {
          const int numkblks)
       : DistAUNMF<INPUTMATTYPE>(input, leftlowrankfactor, rightlowrankfactor,
                                 communicator, numkblks) {
-    WHtH.zeros(this->globalm() / this->m_mpicomm.size(), this->k);
-    HWtW.zeros(this->globaln() / this->m_mpicomm.size(), this->k);
+    WHtH.zeros(arma::size(this->W));
+    HWtW.zeros(arma::size(this->H));
     localWnorm.zeros(this->k);
     Wnorm.zeros(this->k);
     PRINTROOT("DistMU() constructor successful");
@@ -29,9 +29,14 @@ class DistNMFDriver {
   UWORD m_globalm, m_globaln;
   std::string m_Afile_name;
   std::string m_outputfile_name;
+  std::string m_checkpoint_file_name;
+  std::string m_restart_file_name;
+  int m_checkpoint_every;
   int m_num_it;
   int m_pr;
   int m_pc;
+  int m_cores_per_node;
+  bool m_proc_grids_given;
   FVEC m_regW;
   FVEC m_regH;
   double m_symm_reg;
@@ -42,7 +47,11 @@ class DistNMFDriver {
   iodistributions m_distio;
   uint m_compute_error;
   double m_tolerance;
+  stoptype m_stop_policy;
+  int m_stop_window;
   int m_num_k_blocks;
+  bool m_overlap_comm;
+  bool m_mixed_precision;
   static const int kprimeoffset = 17;
   normtype m_input_normalization;
   int m_max_luciters;
@@ -103,6 +112,8 @@ class DistNMFDriver {
          << "symm_reg::" << this->m_symm_reg
          << "symm_flag::" << this->m_symm_flag
          << "::num_k_blocks::" << this->m_num_k_blocks
+         << "::overlap::" << this->m_overlap_comm
+         << "::mixedprec::" << this->m_mixed_precision
          << "::normtype::" << this->m_input_normalization << std::endl;
   }
 
@@ -110,6 +121,11 @@ class DistNMFDriver {
   void callDistNMF1D() {
     std::string rand_prefix("rand_");
     MPICommunicator mpicomm(this->m_argc, this->m_argv);
+    // the 1D distribution has no grid. Keep the old 1x1 default.
+    if (this->m_pr <= 0 || this->m_pc <= 0) {
+      this->m_pr = 1;
+      this->m_pc = 1;
+    }
 #ifdef BUILD_SPARSE
     SP_MAT A;
     DistIO<SP_MAT> dio(mpicomm, m_distio, A);
@@ -172,7 +188,22 @@ class DistNMFDriver {
   template <class NMFTYPE>
   void callDistNMF2D() {
     std::string rand_prefix("rand_");
-    MPICommunicator mpicomm(this->m_argc, this->m_argv, this->m_pr, this->m_pc);
+    // the grid is chosen from the communication model only for an input
+    // of known size that can be read on any grid. symmetric NMF needs a
+    // square grid.
+    UVEC global_dims(2);
+    global_dims[0] = this->m_globalm;
+    global_dims[1] = this->m_globaln;
+    UVEC grid(2);
+    grid[0] = this->m_pr;
+    grid[1] = this->m_pc;
+    grid = requestedGrid(grid, this->m_proc_grids_given, global_dims,
+                         gridAgnosticInput(this->m_Afile_name));
+    MPICommunicator mpicomm(this->m_argc, this->m_argv, grid[0], grid[1],
+                            global_dims, this->m_k, this->m_cores_per_node,
+                            this->m_symm_flag);
+    this->m_pr = mpicomm.pr();
+    this->m_pc = mpicomm.pc();
 // #ifdef BUILD_CUDA
 //         if (mpicomm.rank()==0){
 //             gpuQuery();
@@ -269,7 +300,8 @@ class DistNMFDriver {
         // initializer we run couple of iterations of HALS.
 #ifndef USE_PACOSS
 #ifdef BUILD_SPARSE
-    if (m_nmfalgo == ANLSBPP && this->m_symm_reg < 0) {
+    if (m_nmfalgo == ANLSBPP && this->m_symm_reg < 0 &&
+        this->m_restart_file_name.empty()) {
       DistHALS<SP_MAT> lrinitializer(A, W, H, mpicomm, this->m_num_k_blocks);
       lrinitializer.num_iterations(4);
       lrinitializer.algorithm(HALS);
@@ -325,6 +357,22 @@ class DistNMFDriver {
     nmfAlgorithm.algorithm(this->m_nmfalgo);
     nmfAlgorithm.regW(this->m_regW);
     nmfAlgorithm.regH(this->m_regH);
+    nmfAlgorithm.overlap_comm(this->m_overlap_comm);
+    nmfAlgorithm.mixed_precision(this->m_mixed_precision);
+    nmfAlgorithm.stopping(planc::StoppingCriterion(
+        this->m_stop_policy, this->m_tolerance, this->m_stop_window));
+    if (!this->m_checkpoint_file_name.empty()) {
+      nmfAlgorithm.checkpoint(this->m_checkpoint_file_name,
+                              this->m_checkpoint_every);
+    }
+    if (!this->m_restart_file_name.empty() &&
+        !nmfAlgorithm.restart(this->m_restart_file_name)) {
+      if (mpicomm.rank() == 0) {
+        ERR << "Could not restart from " << this->m_restart_file_name
+            << std::endl;
+      }
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
     if (this->m_symm_reg == 0) {
       double local_A_max = A.max();
       MPI_Allreduce(&local_A_max, &global_A_max, 1, MPI_DOUBLE, MPI_MAX,
@@ -361,22 +409,49 @@ class DistNMFDriver {
     this->m_Afile_name = pc.input_file_name();
     this->m_pr = pc.pr();
     this->m_pc = pc.pc();
+    this->m_cores_per_node = pc.cores_per_node();
+    this->m_proc_grids_given = pc.proc_grids_given();
     this->m_sparsity = pc.sparsity();
     this->m_num_it = pc.iterations();
     this->m_distio = TWOD;
     this->m_regW = pc.regW();
     this->m_regH = pc.regH();
-    this->m_num_k_blocks = 1;
+    this->m_num_k_blocks = pc.num_k_blocks();
+    this->m_overlap_comm = pc.overlap_comm();
+    this->m_mixed_precision = pc.mixed_precision();
+    if (this->m_num_k_blocks < 1 || this->m_k % this->m_num_k_blocks != 0) {
+      ERR << "numkblocks::" << this->m_num_k_blocks
+          << " must divide k::" << this->m_k << ". using 1" << std::endl;
+      this->m_num_k_blocks = 1;
+    }
     this->m_globalm = pc.globalm();
     this->m_globaln = pc.globaln();
+#ifndef BUILD_SPARSE
+    // the shape of a npy input overrides -d. The grid choice and the mean
+    // of the symmetric initialization need it before A is read.
+    if (this->m_Afile_name.size() > 4 &&
+        this->m_Afile_name.compare(this->m_Afile_name.size() - 4, 4,
+                                   ".npy") == 0) {
+      UVEC shape = npyShape(this->m_Afile_name);
+      if (shape.n_elem == 2) {
+        this->m_globalm = shape[0];
+        this->m_globaln = shape[1];
+      }
+    }
+#endif
     this->m_compute_error = pc.compute_error();
     this->m_tolerance = pc.tolerance();
+    this->m_stop_policy = pc.stop_policy();
+    this->m_stop_window = pc.stop_window();
     this->m_symm_reg = pc.symm_reg();
     this->m_symm_flag = 0;
     this->m_adj_rand = pc.adj_rand();
     this->m_max_luciters = pc.max_luciters();
     this->m_initseed = pc.initseed();
     this->m_outputfile_name = pc.output_file_name();
+    this->m_checkpoint_file_name = pc.checkpoint_file_name();
+    this->m_checkpoint_every = pc.checkpoint_every();
+    this->m_restart_file_name = pc.restart_file_name();
 
     // Put in the default LUC iterations
     if (this->m_max_luciters == -1) {
@@ -386,7 +461,7 @@ class DistNMFDriver {
     // check the conditions for symm nmf
     if (this->m_symm_reg != -1) {
       this->m_symm_flag = 1;
-      if (this->m_pr != this->m_pc) {
+      if (this->m_pr > 0 && this->m_pc > 0 && this->m_pr != this->m_pc) {
         ERR << "Symmetric Regularization enabled"
             << " and process grid is not square"
             << "::pr::" << this->m_pr << "::pc::" << this->m_pc << std::endl;
@@ -3,6 +3,8 @@
 #ifndef DISTNMF_DISTNMFTIME_HPP_
 #define DISTNMF_DISTNMFTIME_HPP_
 
+#include <vector>
+
 /**
  * Class and function for collecting time statistics 
  */
@@ -27,6 +29,10 @@ class DistNMFTime {
   double m_gradient_duration;
   double m_cg_duration;
   double m_projection_duration;
+  // counters
+  unsigned long m_nnls_pivots;  /// BPP pivots summed over all solves
+  /// armadillo heap allocations in the iterations. COUNT_ARMA_ALLOCS only.
+  unsigned long m_allocations;
 
  public:
   DistNMFTime(double d, double compute_d, double communication_d,
@@ -35,7 +41,9 @@ class DistNMFTime {
         m_compute_duration(compute_d),
         m_communication_duration(communication_d),
         m_err_compute_duration(err_comp),
-        m_err_communication_duration(err_comm) {}
+        m_err_communication_duration(err_comm),
+        m_nnls_pivots(0),
+        m_allocations(0) {}
   DistNMFTime(double d, double compute_d, double communication_d,
               double allgather_d, double allreduce_d, double reducescatter_d,
               double gram_d, double mm_d, double nnls_d, double err_comp,
@@ -57,6 +65,8 @@ class DistNMFTime {
           m_gradient_duration = 0.0;
           m_cg_duration = 0.0;
           m_projection_duration = 0.0;
+          m_nnls_pivots = 0;
+          m_allocations = 0;
         }
   DistNMFTime(double d, double compute_d, double communication_d, double gram_d,
               double mm_d, double nnls_d, double err_comp, double err_comm)
@@ -77,6 +87,8 @@ class DistNMFTime {
           m_gradient_duration = 0.0;
           m_cg_duration = 0.0;
           m_projection_duration = 0.0;
+          m_nnls_pivots = 0;
+          m_allocations = 0;
         }
   // Getter Functions
   const double duration() const { return m_duration; }
@@ -101,6 +113,8 @@ class DistNMFTime {
   const double gradient_duration() const { return m_gradient_duration; }
   const double cg_duration() const { return m_cg_duration; }
   const double projection_duration() const { return m_projection_duration; }
+  const unsigned long nnls_pivots() const { return m_nnls_pivots; }
+  const unsigned long allocations() const { return m_allocations; }
   // Update Functions
   void duration(double d) { m_duration += d; }
   void compute_duration(double d) { m_compute_duration += d; }
@@ -120,6 +134,51 @@ class DistNMFTime {
   void gradient_duration(double d) { m_gradient_duration += d; }
   void cg_duration(double d) { m_cg_duration += d; }
   void projection_duration(double d) { m_projection_duration += d; }
+  void nnls_pivots(unsigned long p) { m_nnls_pivots += p; }
+  void allocations(unsigned long a) { m_allocations += a; }
+  /// All the accumulated statistics in a fixed order for checkpoints
+  std::vector<double> values() const {
+    double v[] = {m_duration,
+                  m_compute_duration,
+                  m_communication_duration,
+                  m_allgather_duration,
+                  m_allreduce_duration,
+                  m_reducescatter_duration,
+                  m_sendrecv_duration,
+                  m_gram_duration,
+                  m_nongram_duration,
+                  m_mm_duration,
+                  m_nnls_duration,
+                  m_err_compute_duration,
+                  m_err_communication_duration,
+                  m_gradient_duration,
+                  m_cg_duration,
+                  m_projection_duration,
+                  static_cast<double>(m_nnls_pivots)};
+    return std::vector<double>(v, v + sizeof(v) / sizeof(v[0]));
+  }
+  /// Restores statistics saved by values(). Ignored if the size differs.
+  void restore(const std::vector<double> &v) {
+    if (v.size() != values().size()) return;
+    double *d[] = {&m_duration,
+                   &m_compute_duration,
+                   &m_communication_duration,
+                   &m_allgather_duration,
+                   &m_allreduce_duration,
+                   &m_reducescatter_duration,
+                   &m_sendrecv_duration,
+                   &m_gram_duration,
+                   &m_nongram_duration,
+                   &m_mm_duration,
+                   &m_nnls_duration,
+                   &m_err_compute_duration,
+                   &m_err_communication_duration,
+                   &m_gradient_duration,
+                   &m_cg_duration,
+                   &m_projection_duration};
+    for (unsigned int i = 0; i < v.size() - 1; i++) *d[i] = v[i];
+    m_nnls_pivots = static_cast<unsigned long>(v.back());
+  }
 };
 
 }  // namespace planc
@@ -10,62 +10,68 @@ namespace planc {
   
   template <class INPUTMATTYPE>
   class DistR2 : public DistAUNMF<INPUTMATTYPE> {
-    private:
-      MAT Huv;
-      MAT Wuv;
     protected:
       void updateW() {
         //HHt AHt
-        MPITIC;
-        update(this->HtH, this->AHtij, this->Wuv, this->Wt);
+        update(this->HtH, this->AHtij, &this->Wt);
         this->W = this->Wt.t();
-        double temp = MPITOC;
-        this->reportTime(temp,"updateW::");
       }
       void updateH() {
         //WtW, (WtA)t
-        MPITIC;
-        update(this->WtW, this->WtAij, this->Huv, this->Ht);
+        update(this->WtW, this->WtAij, &this->Ht);
         this->H = this->Ht.t();
-        double temp = MPITOC;
-        this->reportTime(temp,"updateH::");
       }
 
     private:
-      void update(MAT& left, const MAT& right, MAT& uv, MAT& G) {
-        MPITIC;
-        G = solve(left, right, arma::solve_opts::fast + arma::solve_opts::allow_ugly);
-        double temp = MPITOC;
-        this->reportTime(temp,"G::");
-
-        MPITIC;
-        uv.row(0) = right.row(0) / left(0,0);
-        uv.row(1) = right.row(1) / left(1,1);
-
-        auto b0 = sqrt(left(0,0));
-        auto b1 = sqrt(left(1,1));
-
-        UVEC negs = find(any(G<0));
-
-        uv.each_col( [&,b0,b1](VEC& b) {
-            if (b0*b(0) >= b1*b(1)) {
-              b(1) = 0;
-            } else {
-              b(0) = 0;
-            }
-          });
-        
-        G.cols(negs) = uv.cols(negs);
-        temp = MPITOC;
-        this->reportTime(temp,"UV::");
+      /**
+       * Rank 2 NNLS of every column of right with the 2x2 gram left.
+       * The unconstrained solution is in closed form. A column with a
+       * negative entry takes the better of the two single variable
+       * solutions, with the columns of the factor weighted by their
+       * norms \f$\sqrt{left(i,i)}\f$. All of it is one branch free pass
+       * over the columns.
+       * @param[in] left 2x2 gram
+       * @param[in] right 2xn right hand side
+       * @param[out] G 2xn solution
+       */
+      void update(const MAT& left, const MAT& right, MAT* G) {
+        const double a = left(0, 0);
+        const double b = left(0, 1);
+        const double d = left(1, 1);
+        const double det = a * d - b * b;
+        // a singular gram only has the single variable solutions
+        const bool solvable = det > EPSILON_1EMINUS12 * a * d;
+        const double inv_det = solvable ? 1.0 / det : 0;
+        const double inv_a = a > 0 ? 1.0 / a : 0;
+        const double inv_d = d > 0 ? 1.0 / d : 0;
+        const double inv_b0 = a > 0 ? 1.0 / sqrt(a) : 0;
+        const double inv_b1 = d > 0 ? 1.0 / sqrt(d) : 0;
+        const UWORD n = right.n_cols;
+        const double* r = right.memptr();
+        double* g = G->memptr();
+#pragma omp simd
+        for (UWORD j = 0; j < n; j++) {
+          const double r0 = r[2 * j];
+          const double r1 = r[2 * j + 1];
+          const double g0 = (d * r0 - b * r1) * inv_det;
+          const double g1 = (a * r1 - b * r0) * inv_det;
+          const bool active = !solvable || g0 < 0 || g1 < 0;
+          // b0 * u >= b1 * v with u = r0 / a and v = r1 / d
+          const bool first = r0 * inv_b0 >= r1 * inv_b1;
+          g[2 * j] = active ? (first ? r0 * inv_a : 0) : g0;
+          g[2 * j + 1] = active ? (first ? 0 : r1 * inv_d) : g1;
+        }
       }
 
-
     public:
-      DistR2(const INPUTMATTYPE& input, const MAT& leftlowrankfactor, const MAT& rightlowrankfactor, const MPICommunicator& communicator, const int numkblks) : DistAUNMF<INPUTMATTYPE>(input, leftlowrankfactor, rightlowrankfactor, communicator, numkblks) {
-        Wuv.zeros(2,this->W.n_rows);
-        Huv.zeros(2,this->H.n_rows);
-        
+      DistR2(const INPUTMATTYPE& input, const MAT& leftlowrankfactor,
+             const MAT& rightlowrankfactor,
+             const MPICommunicator& communicator, const int numkblks)
+          : DistAUNMF<INPUTMATTYPE>(input, leftlowrankfactor,
+                                    rightlowrankfactor, communicator,
+                                    numkblks) {
+        // the 2x2 grams travel with the products. no allreduce.
+        this->fuse_gram_comm(true);
       }
   };
 }
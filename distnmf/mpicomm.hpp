@@ -4,8 +4,10 @@
 #define DISTNMF_MPICOMM_HPP_
 
 #include <mpi.h>
+#include <algorithm>
 #include <vector>
 #include "common/distutils.hpp"
+#include "common/procgrid.hpp"
 
 #ifdef USE_PACOSS
 #include "pacoss/pacoss.h"
@@ -43,35 +45,8 @@ class MPICommunicator {
     INFO << ":rank=" << rank() << ":row_rank=" << row_rank() << ":colrank"
          << col_rank() << std::endl;
   }
-
- public:
-  // Violating the cpp guidlines. Other functions need
-  // non const pointers.
-  MPICommunicator(int argc, char *argv[]) {
-#ifdef USE_PACOSS
-    TMPI_Init(&argc, &argv);
-#else
-    MPI_Init(&argc, &argv);
-#endif
-    MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &m_numProcs);
-  }
-  ~MPICommunicator() {
-    MPI_Barrier(MPI_COMM_WORLD);
-#ifdef USE_PACOSS
-    TMPI_Finalize();
-#else
-    MPI_Finalize();
-#endif
-  }
-  MPICommunicator(int argc, char *argv[], int pr, int pc) {
-#ifdef USE_PACOSS
-    TMPI_Init(&argc, &argv);
-#else
-    MPI_Init(&argc, &argv);
-#endif
-    MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &m_numProcs);
+  /// Sets up the pr x pc grid and its row and column communicators
+  void setupGrid(int pr, int pc) {
     int reorder = 0;
     std::vector<int> dimSizes;
     std::vector<int> periods;
@@ -115,6 +90,71 @@ class MPICommunicator {
     printConfig();
 #endif
   }
+
+ public:
+  // Violating the cpp guidlines. Other functions need
+  // non const pointers.
+  MPICommunicator(int argc, char *argv[]) {
+#ifdef USE_PACOSS
+    TMPI_Init(&argc, &argv);
+#else
+    MPI_Init(&argc, &argv);
+#endif
+    MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &m_numProcs);
+  }
+  ~MPICommunicator() {
+    MPI_Barrier(MPI_COMM_WORLD);
+#ifdef USE_PACOSS
+    TMPI_Finalize();
+#else
+    MPI_Finalize();
+#endif
+  }
+  MPICommunicator(int argc, char *argv[], int pr, int pc) {
+#ifdef USE_PACOSS
+    TMPI_Init(&argc, &argv);
+#else
+    MPI_Init(&argc, &argv);
+#endif
+    MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &m_numProcs);
+    setupGrid(pr, pc);
+  }
+  /**
+   * Chooses the grid with autoProcGrid if pr or pc is not positive.
+   * A positive pr or pc is kept and only the other one is chosen. See
+   * requestedGrid for when the drivers ask for a choice.
+   * @param[in] global_dims global m and n. Known if pr or pc is 0.
+   * @param[in] k low rank
+   * @param[in] ranks_per_node processes on a node. 0 detects it.
+   * @param[in] square only pr = pc as the symmetric NMF needs
+   */
+  MPICommunicator(int argc, char *argv[], int pr, int pc,
+                  const UVEC &global_dims, int k, int ranks_per_node,
+                  bool square) {
+#ifdef USE_PACOSS
+    TMPI_Init(&argc, &argv);
+#else
+    MPI_Init(&argc, &argv);
+#endif
+    MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &m_numProcs);
+    if (pr <= 0 || pc <= 0) {
+      UVEC fixed(2);
+      fixed[0] = std::max(pr, 0);
+      fixed[1] = std::max(pc, 0);
+      UVEC grid = autoProcGrid(MPI_COMM_WORLD, global_dims, k,
+                               ranks_per_node, fixed, square);
+      if (grid.n_elem == 0) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      pr = grid[0];
+      pc = grid[1];
+    }
+    setupGrid(pr, pc);
+  }
   /// returns the global rank
   const int rank() const { return m_rank; }
   /// returns the total number of mpi processes
@@ -3,10 +3,13 @@
 #define DISTNTF_DISTAUNTF_HPP_
 
 #include <armadillo>
+#include <algorithm>
 #include <string>
 #include <vector>
+#include "common/checkpoint.hpp"
 #include "common/distutils.hpp"
 #include "common/ntf_utils.hpp"
+#include "common/stopping.hpp"
 #include "dimtree/ddt.hpp"
 #include "distntf/distntfmpicomm.hpp"
 #include "distntf/distntftime.hpp"
@@ -46,16 +49,46 @@ class DistAUNTF {
   MAT global_gram;
 
   virtual MAT update(int current_mode) = 0;
+  /**
+   * Called once per mode update after global_gram is formed and before
+   * update or any update_rows. Updates that solve with the same gram for
+   * every row factorize it here.
+   * @param[in] current_mode
+   */
+  virtual void prepare_update(int current_mode) {}
+  /**
+   * Updates that solve every row of the factor independently given the
+   * global gram override this and update_rows. The pipelined mode then
+   * solves a row chunk as soon as its mttkrp arrives.
+   */
+  virtual bool row_separable() const { return false; }
+  /**
+   * Returns columns start to end of the transposed updated factor.
+   * Only called when row_separable is true.
+   * @param[in] current_mode
+   * @param[in] start first local row of the chunk
+   * @param[in] end last local row of the chunk
+   */
+  virtual MAT update_rows(int current_mode, UWORD start, UWORD end) {
+    MAT factor_t = update(current_mode);
+    return factor_t.cols(start, end);
+  }
 
  private:
-  const Tensor &m_input_tensor;
+  const NTFTENSOR &m_input_tensor;
   NCPFactors m_gathered_ncp_factors;
   NCPFactors m_gathered_ncp_factors_t;
-  // mttkrp related variables
-  MAT *ncp_krp;
   // gram related variables.
   MAT factor_local_grams;    // U in the algorithm.
   MAT *factor_global_grams;  // G in the algorithm
+  // hadamard of the grams before and after a mode. m_gram_prefix is the
+  // hadamard of the modes below m_gram_prefix_mode. m_gram_suffix[n] is
+  // the hadamard of the modes above n and is current for every n from
+  // m_gram_suffix_valid on.
+  MAT m_gram_prefix;
+  MAT *m_gram_suffix;
+  unsigned int m_gram_prefix_mode;
+  unsigned int m_gram_suffix_valid;
 
   // NTF related variable.
   const unsigned int m_low_rank_k;
@@ -71,9 +104,29 @@ class DistAUNTF {
   unsigned int m_current_it;
   double m_rel_error;
 
+  // mixed precision mode sends the factor allgathers as float.
+  bool m_mixed_precision;
+  FVEC m_fsendbuf, m_frecvbuf;
+
+  // pipelined mode. counts and displacements of every row chunk stay
+  // alive until the nonblocking collectives complete.
+  bool m_overlap_comm;
+  int m_comm_chunks;
+  std::vector<int> m_chunk_cnts;
+  std::vector<int> m_chunk_displs;
+  std::vector<double> m_pack_buf;
+
   // needed for acceleration algorithms.
   bool m_accelerated;
   std::vector<bool> m_stale_mttkrp;
+  // early termination. the gradient norm is local until the end of the
+  // outer iteration.
+  StoppingCriterion m_stopping;
+  double m_pgrad_sqnorm;
+  // periodic checkpoints and the first outer iteration after a restart
+  std::string m_checkpoint_file;
+  int m_checkpoint_every;
+  unsigned int m_start_it;
   // stats
   DistNTFTime time_stats;
 
@@ -112,6 +165,20 @@ class DistAUNTF {
              &(factor_global_grams[current_mode]));
     this->time_stats.communication_duration(temp);
     this->time_stats.allreduce_duration(temp);
+    gram_changed(current_mode);
+  }
+
+  /**
+   * Marks the prefix and suffix hadamards that contain the gram of mode
+   * as stale. Call after every change of factor_global_grams[mode].
+   * @param[in] mode
+   */
+  void gram_changed(const unsigned int mode) {
+    if (mode < m_gram_prefix_mode) {
+      m_gram_prefix.ones();
+      m_gram_prefix_mode = 0;
+    }
+    m_gram_suffix_valid = std::max(m_gram_suffix_valid, mode);
   }
 
   /**
@@ -136,20 +203,30 @@ class DistAUNTF {
   }
 
   /**
-   * This iterates over all grams leaving out current mode
-   * and finds hadamard of the grams
+   * Finds the hadamard of all grams leaving out current mode as the
+   * hadamard of the prefix and the suffix of current mode. The modes are
+   * updated in order, so a sweep extends the prefix by the gram updated
+   * last and rebuilds the suffixes once at its first mode. That is about
+   * 3N instead of \f$N^2\f$ hadamards of \f$k \times k\f$ per outer
+   * iteration. Stale parts are rebuilt, so any order of calls is correct.
    *
    * @param[in] current_mode.
    */
   void gram_hadamard(unsigned int current_mode) {
-    global_gram.ones();
     MPITIC;  // gram hadamard
-    for (unsigned int i = 0; i < m_modes; i++) {
-      if (i != current_mode) {
-        //%= element-wise multiplication
-        global_gram %= factor_global_grams[i];
-      }
+    if (m_gram_prefix_mode > current_mode) {
+      m_gram_prefix.ones();
+      m_gram_prefix_mode = 0;
+    }
+    //%= element-wise multiplication
+    for (; m_gram_prefix_mode < current_mode; m_gram_prefix_mode++) {
+      m_gram_prefix %= factor_global_grams[m_gram_prefix_mode];
+    }
+    for (; m_gram_suffix_valid > current_mode; m_gram_suffix_valid--) {
+      unsigned int n = m_gram_suffix_valid - 1;
+      m_gram_suffix[n] = m_gram_suffix[n + 1] % factor_global_grams[n + 1];
     }
+    global_gram = m_gram_prefix % m_gram_suffix[current_mode];
     double temp = MPITOC;  // gram hadamard
     this->time_stats.compute_duration(temp);
     this->time_stats.gram_duration(temp);
@@ -206,13 +283,21 @@ class DistAUNTF {
                   << m_gathered_ncp_factors_t.factor(current_mode).n_elem);
 #endif
     MPITIC;  // allgather tic
-    MPI_Allgatherv(m_local_ncp_factors_t.factor(current_mode).memptr(), sendcnt,
-                   MPI_DOUBLE,
-                   m_gathered_ncp_factors_t.factor(current_mode).memptr(),
-                   &recvgathercnt[0], &recvgatherdispl[0], MPI_DOUBLE,
-                   // todo:: check whether it is slice or fiber while running
-                   // and debugging the code.
-                   current_slice_comm);
+    if (m_mixed_precision) {
+      allgathervFloat(m_local_ncp_factors_t.factor(current_mode).memptr(),
+                      sendcnt,
+                      m_gathered_ncp_factors_t.factor(current_mode).memptr(),
+                      &recvgathercnt[0], &recvgatherdispl[0],
+                      current_slice_comm, &m_fsendbuf, &m_frecvbuf);
+    } else {
+      MPI_Allgatherv(m_local_ncp_factors_t.factor(current_mode).memptr(),
+                     sendcnt, MPI_DOUBLE,
+                     m_gathered_ncp_factors_t.factor(current_mode).memptr(),
+                     &recvgathercnt[0], &recvgatherdispl[0], MPI_DOUBLE,
+                     // todo:: check whether it is slice or fiber while
+                     // running and debugging the code.
+                     current_slice_comm);
+    }
     // current_slice_comm);
     double temp = MPITOC;  // allgather toc
     this->time_stats.communication_duration(temp);
@@ -241,16 +326,17 @@ class DistAUNTF {
    * @param[in] current_mode
    */
   void distmttkrp(const int &current_mode) {
-    double temp;
-    if (!this->m_enable_dim_tree) {
-      MPITIC;  // krp tic
-      m_gathered_ncp_factors.krp_leave_out_one(current_mode,
-                                               &ncp_krp[current_mode]);
-      temp = MPITOC;  // krp toc
-      this->time_stats.compute_duration(temp);
-      this->time_stats.krp_duration(temp);
-    }
+    local_mttkrp(current_mode);
+    reduce_scatter_mttkrp(current_mode);
+  }
 
+  /**
+   * Local part of distmttkrp. Leaves the partial mttkrp of all the
+   * m_factor_local_dims rows in ncp_mttkrp_t.
+   * @param[in] current_mode
+   */
+  void local_mttkrp(const int &current_mode) {
+    double temp;
     if (this->m_enable_dim_tree) {
       double multittv_time = 0;
       double mttkrp_time = 0;
@@ -263,9 +349,10 @@ class DistAUNTF {
       this->time_stats.mttkrp_duration(mttkrp_time);
 
     } else {
+      // the krp rows are formed inside the mttkrp. krp time is included.
       MPITIC;  // mttkrp tic
-      m_input_tensor.mttkrp(current_mode, ncp_krp[current_mode],
-                            &ncp_mttkrp_t[current_mode]);
+      mttkrp_fused(current_mode, m_input_tensor, m_gathered_ncp_factors,
+                   &ncp_mttkrp_t[current_mode]);
       temp = MPITOC;  // mttkrp toc
       this->time_stats.compute_duration(temp);
       this->time_stats.mttkrp_duration(temp);
@@ -280,7 +367,15 @@ class DistAUNTF {
     // PRINTROOT("kdt vs mttkrp::" << same_mttkrp);
     // PRINTROOT("kdt mttkrp::" << kdt_ncp_mttkrp_t);
     // PRINTROOT("classic mttkrp_t::" << ncp_mttkrp_t[current_mode]);
+  }
 
+  /**
+   * Reduce scatters the partial mttkrp over the slice communicator.
+   * Every process gets the sum for its m_nls_sizes rows.
+   * @param[in] current_mode
+   */
+  void reduce_scatter_mttkrp(const int &current_mode) {
+    double temp;
     MPI_Comm current_slice_comm = this->m_mpicomm.slice(current_mode);
     int slice_size;
     int slice_rank;
@@ -322,45 +417,212 @@ class DistAUNTF {
     this->m_stale_mttkrp[current_mode] = false;
   }
 
+  /**
+   * Pipelined lines 9 to 15 of the algorithm for the current mode. The
+   * factor rows of every process in the slice are split into
+   * m_comm_chunks chunks. The reduce_scatter of every chunk is posted
+   * at once and chunk c is solved as soon as its mttkrp arrives, while
+   * the later chunks are in flight. A solved chunk is allgathered
+   * unnormalized straight away. The diagonal of the global gram has the
+   * squared column norms, so the normalization is applied to the local
+   * and the gathered factor after the waits. Updates that are not
+   * row_separable are solved as a single chunk.
+   * @param[in] current_mode
+   * @returns the unnormalized transposed factor, same as update
+   */
+  MAT pipelined_update(const unsigned int current_mode) {
+    MPI_Comm current_slice_comm = this->m_mpicomm.slice(current_mode);
+    int slice_size;
+    MPI_Comm_size(current_slice_comm, &slice_size);
+    int slice_rank = this->m_mpicomm.slice_rank(current_mode);
+    int nchunks = row_separable() ? m_comm_chunks : 1;
+    int k = m_low_rank_k;
+    int dimsize = m_factor_local_dims[current_mode];
+    int local_rows = m_nls_sizes[current_mode];
+    // chunk c of process i is m_chunk_cnts[c * slice_size + i] values at
+    // m_chunk_displs[c * slice_size + i] of the gathered factor.
+    m_chunk_cnts.resize(nchunks * slice_size);
+    m_chunk_displs.resize(nchunks * slice_size);
+    for (int c = 0; c < nchunks; c++) {
+      for (int i = 0; i < slice_size; i++) {
+        int rows = itersplit(dimsize, slice_size, i);
+        m_chunk_cnts[c * slice_size + i] = itersplit(rows, nchunks, c) * k;
+        m_chunk_displs[c * slice_size + i] =
+            (startidx(dimsize, slice_size, i) + startidx(rows, nchunks, c)) *
+            k;
+      }
+    }
+    std::vector<MPI_Request> rsreq(nchunks, MPI_REQUEST_NULL);
+    std::vector<MPI_Request> agreq(nchunks, MPI_REQUEST_NULL);
+    double temp;
+    bool stale = is_stale_mttkrp(current_mode);
+    if (stale) {
+      local_mttkrp(current_mode);
+      // reduce_scatter needs the blocks of every chunk in rank order.
+      MPITIC;  // pack
+      m_pack_buf.resize(ncp_mttkrp_t[current_mode].n_elem);
+      const double *src = ncp_mttkrp_t[current_mode].memptr();
+      double *dst = m_pack_buf.data();
+      for (int c = 0; c < nchunks * slice_size; c++) {
+        std::copy(src + m_chunk_displs[c],
+                  src + m_chunk_displs[c] + m_chunk_cnts[c], dst);
+        dst += m_chunk_cnts[c];
+      }
+      temp = MPITOC;  // pack
+      this->time_stats.compute_duration(temp);
+      this->time_stats.pack_duration(temp);
+      MPITIC;  // post reduce_scatter
+      dst = m_pack_buf.data();
+      for (int c = 0; c < nchunks; c++) {
+        int start = startidx(local_rows, nchunks, c);
+        MPI_Ireduce_scatter(
+            dst, ncp_local_mttkrp_t[current_mode].memptr() + start * k,
+            &m_chunk_cnts[c * slice_size], MPI_DOUBLE, MPI_SUM,
+            current_slice_comm, &rsreq[c]);
+        for (int i = 0; i < slice_size; i++) {
+          dst += m_chunk_cnts[c * slice_size + i];
+        }
+      }
+      temp = MPITOC;  // post reduce_scatter
+      this->time_stats.communication_duration(temp);
+      this->time_stats.reducescatter_duration(temp);
+    }
+    // line 11 of the algorithm overlaps with the reduce_scatter.
+    gram_hadamard(current_mode);
+    MPITIC;  // nnls
+    prepare_update(current_mode);
+    temp = MPITOC;  // nnls
+    this->time_stats.compute_duration(temp);
+    this->time_stats.nnls_duration(temp);
+    MAT factor_t(k, local_rows);
+    for (int c = 0; c < nchunks; c++) {
+      int start = startidx(local_rows, nchunks, c);
+      int rows = itersplit(local_rows, nchunks, c);
+      MPITIC;  // reduce_scatter wait
+      MPI_Wait(&rsreq[c], MPI_STATUS_IGNORE);
+      temp = MPITOC;  // reduce_scatter wait
+      this->time_stats.communication_duration(temp);
+      this->time_stats.reducescatter_wait_duration(temp);
+      MPITIC;  // nnls
+      if (nchunks == 1) {
+        factor_t = update(current_mode);
+      } else if (rows > 0) {
+        factor_t.cols(start, start + rows - 1) =
+            update_rows(current_mode, start, start + rows - 1);
+      }
+      temp = MPITOC;  // nnls
+      this->time_stats.compute_duration(temp);
+      this->time_stats.nnls_duration(temp);
+      MPITIC;  // post allgather
+      MPI_Iallgatherv(factor_t.memptr() + start * k, rows * k, MPI_DOUBLE,
+                      m_gathered_ncp_factors_t.factor(current_mode).memptr(),
+                      &m_chunk_cnts[c * slice_size],
+                      &m_chunk_displs[c * slice_size], MPI_DOUBLE,
+                      current_slice_comm, &agreq[c]);
+      temp = MPITOC;  // post allgather
+      this->time_stats.communication_duration(temp);
+      this->time_stats.allgather_duration(temp);
+    }
+    if (stale) this->m_stale_mttkrp[current_mode] = false;
+    if (m_stopping.needs_gradient()) accumulate_pgrad(current_mode);
+    // lines 13 and 14 overlap with the allgather. gram of the
+    // unnormalized factor.
+    MPITIC;  // gram
+    factor_local_grams = factor_t * factor_t.t();
+    temp = MPITOC;  // gram
+    this->time_stats.compute_duration(temp);
+    this->time_stats.gram_duration(temp);
+    MPITIC;  // allreduce gram
+    MPI_Allreduce(factor_local_grams.memptr(),
+                  factor_global_grams[current_mode].memptr(), k * k,
+                  MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    temp = MPITOC;  // allreduce gram
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allreduce_duration(temp);
+    // same as distributed_normalize. zero columns are left as they are.
+    VEC lambda = arma::sqrt(factor_global_grams[current_mode].diag());
+    VEC scale = lambda;
+    scale.elem(arma::find(scale <= 0)).ones();
+    factor_global_grams[current_mode] /= scale * scale.t();
+    applyReg(this->m_regularizers(current_mode * 2),
+             this->m_regularizers(current_mode * 2 + 1),
+             &(factor_global_grams[current_mode]));
+    gram_changed(current_mode);
+    MPITIC;  // allgather wait
+    MPI_Waitall(nchunks, &agreq[0], MPI_STATUSES_IGNORE);
+    temp = MPITOC;  // allgather wait
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allgather_wait_duration(temp);
+    MPITIC;  // transpose tic
+    MAT normalized_t = factor_t;
+    normalized_t.each_col() /= scale;
+    m_gathered_ncp_factors_t.factor(current_mode).each_col() /= scale;
+    m_local_ncp_factors_t.set(current_mode, normalized_t);
+    m_local_ncp_factors.set(current_mode, normalized_t.t());
+    m_local_ncp_factors.set_lambda(lambda);
+    m_local_ncp_factors_t.set_lambda(lambda);
+    m_gathered_ncp_factors.set(
+        current_mode, m_gathered_ncp_factors_t.factor(current_mode).t());
+    temp = MPITOC;  // transpose toc
+    this->time_stats.compute_duration(temp);
+    this->time_stats.trans_duration(temp);
+    if (this->m_enable_dim_tree) {
+      kdt->set_factor(m_gathered_ncp_factors_t.factor(current_mode).memptr(),
+                      current_mode);
+    }
+    for (unsigned int mode = 0; mode < this->m_modes; mode++) {
+      if (mode != current_mode) this->m_stale_mttkrp[mode] = true;
+    }
+    return factor_t;
+  }
+
+  /**
+   * Adds the local squared projected gradient of current_mode at the
+   * current model. Needs the reduce scattered mttkrp and global_gram of
+   * current_mode and the factor before its update. lambda is carried by
+   * current_mode as the other factors are normalized.
+   * @param[in] current_mode
+   */
+  void accumulate_pgrad(const int current_mode) {
+    MAT current_t = arma::diagmat(m_local_ncp_factors.lambda()) *
+                    m_local_ncp_factors_t.factor(current_mode);
+    MAT grad_t =
+        global_gram * current_t - ncp_local_mttkrp_t[current_mode];
+    m_pgrad_sqnorm += projectedGradSqNorm(current_t, grad_t);
+  }
+
   void allocateMatrices() {
     // allocate matrices.
-    if (!m_enable_dim_tree) {
-      ncp_krp = new MAT[m_modes];
-    }
     ncp_mttkrp_t = new MAT[m_modes];
     ncp_local_mttkrp_t = new MAT[m_modes];
     factor_global_grams = new MAT[m_modes];
+    m_gram_suffix = new MAT[m_modes];
     factor_local_grams.zeros(this->m_low_rank_k, this->m_low_rank_k);
     global_gram.ones(this->m_low_rank_k, this->m_low_rank_k);
-    UWORD current_size = 0;
+    m_gram_prefix.ones(this->m_low_rank_k, this->m_low_rank_k);
+    m_gram_prefix_mode = 0;
+    m_gram_suffix_valid = m_modes - 1;
     for (unsigned int i = 0; i < m_modes; i++) {
-      current_size = TENSOR_LOCAL_NUMEL / TENSOR_LOCAL_DIM[i];
-      if (!m_enable_dim_tree) {
-        ncp_krp[i] = arma::zeros(current_size, this->m_low_rank_k);
-      }
       ncp_mttkrp_t[i] = arma::zeros(this->m_low_rank_k, TENSOR_LOCAL_DIM[i]);
       ncp_local_mttkrp_t[i] = arma::zeros(m_local_ncp_factors.factor(i).n_cols,
                                           m_local_ncp_factors.factor(i).n_rows);
       factor_global_grams[i] =
           arma::zeros(this->m_low_rank_k, this->m_low_rank_k);
+      m_gram_suffix[i] = arma::ones(this->m_low_rank_k, this->m_low_rank_k);
     }
   }
 
   void freeMatrices() {
     for (unsigned int i = 0; i < m_modes; i++) {
-      if (!m_enable_dim_tree) {
-        ncp_krp[i].clear();
-      }
       ncp_mttkrp_t[i].clear();
       ncp_local_mttkrp_t[i].clear();
       factor_global_grams[i].clear();
-    }
-    if (!m_enable_dim_tree) {
-      delete[] ncp_krp;
+      m_gram_suffix[i].clear();
     }
     delete[] ncp_mttkrp_t;
     delete[] ncp_local_mttkrp_t;
     delete[] factor_global_grams;
+    delete[] m_gram_suffix;
   }
 
   void reportTime(const double temp, const std::string &reportstring) {
@@ -405,6 +667,58 @@ class DistAUNTF {
 
   virtual void accelerate() {}
 
+  /**
+   * Adds this outer iteration to the stopping criterion. The relative
+   * error is already global. The gradient norm is reduced here. All the
+   * processes must agree before any of them stops.
+   */
+  bool stop_iterations() {
+    if (m_stopping.needs_gradient()) {
+      double global_sqnorm = 0;
+      MPI_Allreduce(&m_pgrad_sqnorm, &global_sqnorm, 1, MPI_DOUBLE, MPI_SUM,
+                    MPI_COMM_WORLD);
+      m_stopping.add(global_sqnorm);
+    } else {
+      m_stopping.add(this->m_rel_error);
+    }
+    bool stop = allTrue(m_stopping.converged(), MPI_COMM_WORLD);
+    if (stop) {
+      PRINTROOT("converged::" << m_stopping.name() << "::it::"
+                              << this->m_current_it
+                              << "::value::" << m_stopping.last());
+    }
+    return stop;
+  }
+
+  /**
+   * Local factors with their global row counts and the first global row
+   * this process owns.
+   */
+  void factorLayout(std::vector<MAT *> *factors,
+                    std::vector<UWORD> *global_rows,
+                    std::vector<UWORD> *row_starts) {
+    for (unsigned int i = 0; i < this->m_modes; i++) {
+      factors->push_back(&m_local_ncp_factors.factor(i));
+      global_rows->push_back(this->m_global_dims[i]);
+      row_starts->push_back(factor_row_start(i));
+    }
+  }
+  /// Collectively writes the state after it completed outer iterations
+  void writeCheckpoint(const unsigned int it) {
+    MPITIC;  // checkpoint
+    std::vector<MAT *> factors;
+    std::vector<UWORD> global_rows, row_starts;
+    factorLayout(&factors, &global_rows, &row_starts);
+    DistCheckpoint ckp(MPI_COMM_WORLD);
+    ckp.iteration(it);
+    ckp.lambda(m_local_ncp_factors.lambda());
+    ckp.times(this->time_stats.values());
+    bool ok = ckp.write(m_checkpoint_file, factors, global_rows, row_starts);
+    double temp = MPITOC;  // checkpoint
+    PRINTROOT("checkpoint::" << m_checkpoint_file << "::it::" << it
+                             << "::ok::" << ok << "::taken::" << temp);
+  }
+
   void generateReport() {
     MPI_Barrier(MPI_COMM_WORLD);
     this->reportTime(this->time_stats.duration(), "total_d");
@@ -419,6 +733,13 @@ class DistAUNTF {
     this->reportTime(this->time_stats.mttkrp_duration(), "total_mttkrp");
     this->reportTime(this->time_stats.multittv_duration(), "total_multittv");
     this->reportTime(this->time_stats.nnls_duration(), "total_nnls");
+    if (this->m_overlap_comm) {
+      this->reportTime(this->time_stats.allgather_wait_duration(),
+                       "total_allgather_wait");
+      this->reportTime(this->time_stats.reducescatter_wait_duration(),
+                       "total_reducescatter_wait");
+      this->reportTime(this->time_stats.pack_duration(), "total_pack");
+    }
     if (this->m_compute_error) {
       this->reportTime(this->time_stats.err_compute_duration(),
                        "total_err_compute");
@@ -428,7 +749,7 @@ class DistAUNTF {
   }
 
  public:
-  DistAUNTF(const Tensor &i_tensor, const int i_k, algotype i_algo,
+  DistAUNTF(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo,
             const UVEC &i_global_dims, const UVEC &i_local_dims,
             const UVEC &i_nls_sizes, const UVEC &i_nls_idxs,
             const NTFMPICommunicator &i_mpicomm)
@@ -449,6 +770,12 @@ class DistAUNTF {
     this->m_compute_error = false;
     this->m_enable_dim_tree = false;
     this->m_accelerated = false;
+    this->m_mixed_precision = false;
+    this->m_overlap_comm = false;
+    this->m_comm_chunks = 4;
+    this->m_pgrad_sqnorm = 0;
+    this->m_checkpoint_every = 10;
+    this->m_start_it = 0;
     this->m_num_it = 30;
     this->m_rel_error = 1.0;
     // randomize again. otherwise all the process and factors
@@ -499,15 +826,72 @@ class DistAUNTF {
   /// MTTKRP can be computed with or without dimension trees. Dimtree is
   /// default.
   void dim_tree(bool i_dim_tree) {
+#ifdef BUILD_SPARSE
+    if (i_dim_tree) {
+      PRINTROOT("dimension trees need a dense tensor. ignoring.");
+    }
+#else
     this->m_enable_dim_tree = i_dim_tree;
-    if (this->m_enable_dim_tree) {
-      if (this->ncp_krp != NULL) {
-        for (unsigned int i = 0; i < m_modes; i++) {
-          ncp_krp[i].clear();
-        }
-        delete[] ncp_krp;
-      }
+#endif
+  }
+  /**
+   * Sends the factor allgather as float. The mttkrp reduce_scatter, the
+   * factors, grams and error stay in double.
+   */
+  void mixed_precision(const bool i_mixed) {
+    this->m_mixed_precision = i_mixed;
+  }
+  /**
+   * Pipelines the mttkrp reduce_scatter, the NNLS and the factor
+   * allgather of every mode over row chunks with nonblocking
+   * collectives. Always communicates in double.
+   */
+  void overlap_comm(const bool i_overlap) { this->m_overlap_comm = i_overlap; }
+  /// Number of row chunks of the pipelined mode
+  void comm_chunks(const int i_chunks) {
+    if (i_chunks > 0) this->m_comm_chunks = i_chunks;
+  }
+  /// Stops before num_iterations when the criterion is met
+  void stopping(const StoppingCriterion &i_stopping) {
+    this->m_stopping = i_stopping;
+  }
+  /**
+   * Writes the factors, lambda, the iteration count and the timers to
+   * fname every few outer iterations. The factors are stored in the
+   * global layout, so the file can restart a run on a different grid.
+   * @param[in] i_fname checkpoint file. Empty disables checkpoints.
+   * @param[in] i_every outer iterations between two checkpoints
+   */
+  void checkpoint(const std::string &i_fname, const int i_every) {
+    this->m_checkpoint_file = i_fname;
+    this->m_checkpoint_every = i_every > 0 ? i_every : 1;
+  }
+  /**
+   * Continues from a checkpoint. Replaces the local factors with the rows
+   * this process owns and lambda, the iteration count and the timers with
+   * the saved ones. Collective over all the processes.
+   * @param[in] i_fname checkpoint file written by checkpoint
+   */
+  bool restart(const std::string &i_fname) {
+    std::vector<MAT *> factors;
+    std::vector<UWORD> global_rows, row_starts;
+    factorLayout(&factors, &global_rows, &row_starts);
+    DistCheckpoint ckp(MPI_COMM_WORLD);
+    if (!ckp.read(i_fname, factors, global_rows, row_starts,
+                  this->m_low_rank_k, this->time_stats.values().size())) {
+      return false;
     }
+    for (unsigned int i = 0; i < this->m_modes; i++) {
+      MAT current_factor = arma::trans(m_local_ncp_factors.factor(i));
+      m_local_ncp_factors_t.set(i, current_factor);
+      this->m_stale_mttkrp[i] = true;
+    }
+    m_local_ncp_factors.set_lambda(ckp.lambda());
+    m_local_ncp_factors_t.set_lambda(ckp.lambda());
+    this->time_stats.restore(ckp.times());
+    this->m_start_it = ckp.iteration();
+    PRINTROOT("restarted from " << i_fname << "::it::" << this->m_start_it);
+    return true;
   }
   /// Does the algorithm need acceleration?
   void accelerated(const bool &set_acceleration) {
@@ -540,6 +924,22 @@ class DistAUNTF {
     m_local_ncp_factors_t.set_lambda(new_factors.lambda());
   }
 
+  /// Rows of the factor of mode owned by this process
+  const MAT &local_factor(const int mode) const {
+    return m_local_ncp_factors.factor(mode);
+  }
+  /**
+   * First global row of local_factor. The fiber gather of factor places
+   * the local rows of the slice after the rows of the lower fiber ranks.
+   * Every row of the global factor is owned by exactly one process.
+   */
+  UWORD factor_row_start(const int mode) const {
+    int global_size = this->m_global_dims[mode];
+    int fiber_size = this->m_mpicomm.proc_grids()[mode];
+    return startidx(global_size, fiber_size, MPI_FIBER_RANK(mode)) +
+           m_nls_idxs[mode];
+  }
+
   // Preferrably call this after the computeNTF().
   // This is right now called to save the factor matrices.
   /**
@@ -576,43 +976,26 @@ class DistAUNTF {
 
   /// The main computeNTF loop
   void computeNTF() {
+    // the error policies need the error of every iteration.
+    if (m_stopping.needs_error()) compute_error(true);
     // initialize everything.
     // line 3,4,5 of the algorithm
     for (unsigned int i = 1; i < m_modes; i++) {
       update_global_gram(i);
       gather_ncp_factor(i);
     }
+#ifndef BUILD_SPARSE
     if (this->m_enable_dim_tree) {
-      // Determine optimial split when given mode ordering.
-      // product of left dimensions \approx product of right dimensions.
-      size_t split_criteria = arma::prod(m_input_tensor.dimensions());
-      split_criteria = std::round(std::sqrt(split_criteria));
-      UVEC temp_cum_prod = arma::cumprod(m_input_tensor.dimensions());
-      int split_mode = 0;
-      while (temp_cum_prod(split_mode) < split_criteria) {
-        split_mode++;
-      }
-      PRINTROOT("KDT Split Mode::" << split_mode
-                                   << "::split criteria::" << split_criteria
-                                   << "::cum prod::" << std::endl
-                                   << temp_cum_prod << std::endl);
-
-      // check to see if split mode is left or right.
-      if (split_mode > 0) {
-        size_t current_left = temp_cum_prod(split_mode);
-        size_t good_criteria = temp_cum_prod(temp_cum_prod.n_rows - 1) /
-                               temp_cum_prod(split_mode - 1);
-        if (current_left > good_criteria) split_mode--;
-        PRINTROOT("KDT Split Mode::"
-                  << split_mode << "::split criteria::" << split_criteria
-                  << "::numerator::" << temp_cum_prod(temp_cum_prod.n_rows - 1)
-                  << "::good_criteria::" << good_criteria
-                  << "::current_left::" << current_left << std::endl
-                  << "::cum prod::" << std::endl
-                  << temp_cum_prod << std::endl);
-      }
-      kdt = new DenseDimensionTree(m_input_tensor, m_gathered_ncp_factors,
-                                   split_mode);
+      // split from the local dimensions. every process has the same
+      // local shape up to the remainders of the grid.
+      kdt = new DenseDimensionTree(m_input_tensor, m_gathered_ncp_factors);
+      PRINTROOT("KDT Split Mode::" << kdt->split_mode() << "::local dims::"
+                                   << m_input_tensor.dimensions().t());
+    }
+#endif
+    bool pipelined = this->m_overlap_comm;
+    if (pipelined && this->m_mixed_precision) {
+      PRINTROOT("overlap needs double communication. ignoring mixedprec.");
     }
 #ifdef DISTNTF_VERBOSE
     DISTPRINTINFO("local factor matrices::");
@@ -622,11 +1005,19 @@ class DistAUNTF {
     DISTPRINTINFO("gathered factor matrices::");
     this->m_gathered_ncp_factors.print();
 #endif
-    for (this->m_current_it = 0; this->m_current_it < m_num_it;
-         this->m_current_it++) {
+    for (this->m_current_it = this->m_start_it;
+         this->m_current_it < m_num_it; this->m_current_it++) {
       MAT unnorm_factor;
+      m_pgrad_sqnorm = 0;
       for (unsigned int current_mode = 0; current_mode < m_modes;
            current_mode++) {
+        if (pipelined) {
+          MAT factor = pipelined_update(current_mode);
+          if (m_compute_error && current_mode == this->m_modes - 1) {
+            unnorm_factor = factor;
+          }
+          continue;
+        }
         // line 9 and 10 of the algorithm
         if (is_stale_mttkrp(current_mode)) distmttkrp(current_mode);
         // line 11 of the algorithm
@@ -641,7 +1032,9 @@ class DistAUNTF {
         DISTPRINTINFO("mttkrp::");
         this->ncp_local_mttkrp_t[current_mode].print();
 #endif
+        if (m_stopping.needs_gradient()) accumulate_pgrad(current_mode);
         MPITIC;  // nnls_tic
+        prepare_update(current_mode);
         MAT factor = update(current_mode);
         double temp = MPITOC;  // nnls_toc
         this->time_stats.compute_duration(temp);
@@ -672,6 +1065,14 @@ class DistAUNTF {
         accelerate();
       }
       PRINTROOT("completed it::" << this->m_current_it);
+      if (!this->m_checkpoint_file.empty() &&
+          (this->m_current_it + 1) % this->m_checkpoint_every == 0) {
+        writeCheckpoint(this->m_current_it + 1);
+      }
+      if (m_stopping.enabled() && stop_iterations()) {
+        this->m_current_it++;
+        break;
+      }
     }
     generateReport();
   }
@@ -23,8 +23,13 @@ class DistNTF {
   int m_k;
   std::string m_Afile_name;
   std::string m_outputfile_name;
+  std::string m_checkpoint_file_name;
+  std::string m_restart_file_name;
+  int m_checkpoint_every;
   int m_num_it;
   UVEC m_proc_grids;
+  int m_cores_per_node;
+  bool m_proc_grids_given;
   FVEC m_regs;
   algotype m_ntfalgo;
   double m_sparsity;
@@ -35,6 +40,11 @@ class DistNTF {
   UVEC m_nls_sizes;
   UVEC m_nls_idxs;
   bool m_enable_dim_tree;
+  bool m_mixed_precision;
+  bool m_overlap_comm;
+  double m_tolerance;
+  stoptype m_stop_policy;
+  int m_stop_window;
   static const int kprimeoffset = 17;
 
   void printConfig() {
@@ -45,15 +55,30 @@ class DistNTF {
               << "::error::" << this->m_compute_error
               << "::regs::" << this->m_regs
               << "::num_k_blocks::" << m_num_k_blocks
-              << "::dim_tree::" << m_enable_dim_tree << std::endl;
+              << "::dim_tree::" << m_enable_dim_tree
+              << "::mixedprec::" << m_mixed_precision
+              << "::overlap::" << m_overlap_comm << std::endl;
   }
 
   template <class NTFTYPE>
   void callDistNTF() {
-    planc::Tensor A;
+    NTFTENSOR A;
     std::string rand_prefix("rand_");
-    planc::NTFMPICommunicator mpicomm(this->m_argc, this->m_argv,
-                                      this->m_proc_grids);
+    // the grid is chosen from the communication model only for an input
+    // of known size that can be read on any grid
+#ifdef BUILD_SPARSE
+    // the text tensor is split by byte ranges and not by the grid
+    bool any_grid_input = true;
+#else
+    bool any_grid_input = planc::gridAgnosticInput(m_Afile_name);
+#endif
+    UVEC grid = planc::requestedGrid(this->m_proc_grids,
+                                     this->m_proc_grids_given,
+                                     this->m_global_dims, any_grid_input);
+    planc::NTFMPICommunicator mpicomm(this->m_argc, this->m_argv, grid,
+                                      this->m_global_dims, this->m_k,
+                                      this->m_cores_per_node);
+    this->m_proc_grids = mpicomm.proc_grids();
     mpicomm.printConfig();
     planc::DistNTFIO dio(mpicomm, A);
     dio.readInput(m_Afile_name, this->m_global_dims, this->m_proc_grids,
@@ -114,6 +139,25 @@ class DistNTF {
       ntfsolver.dim_tree(this->m_enable_dim_tree);
     }
     ntfsolver.regularizers(this->m_regs);
+    ntfsolver.mixed_precision(this->m_mixed_precision);
+    ntfsolver.overlap_comm(this->m_overlap_comm);
+    ntfsolver.stopping(planc::StoppingCriterion(
+        this->m_stop_policy, this->m_tolerance, this->m_stop_window));
+    if (this->m_num_k_blocks > 1) {
+      ntfsolver.comm_chunks(this->m_num_k_blocks);
+    }
+    if (!this->m_checkpoint_file_name.empty()) {
+      ntfsolver.checkpoint(this->m_checkpoint_file_name,
+                           this->m_checkpoint_every);
+    }
+    if (!this->m_restart_file_name.empty() &&
+        !ntfsolver.restart(this->m_restart_file_name)) {
+      if (mpicomm.rank() == 0) {
+        ERR << "Could not restart from " << this->m_restart_file_name
+            << std::endl;
+      }
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
     MPI_Barrier(MPI_COMM_WORLD);
     // try {
     mpitic();
@@ -139,14 +183,39 @@ class DistNTF {
     this->m_k = pc.lowrankk();
     this->m_Afile_name = pc.input_file_name();
     this->m_proc_grids = pc.processor_grids();
+    this->m_cores_per_node = pc.cores_per_node();
+    this->m_proc_grids_given = pc.proc_grids_given();
     this->m_sparsity = pc.sparsity();
     this->m_num_it = pc.iterations();
-    this->m_num_k_blocks = 1;
+    this->m_num_k_blocks = pc.num_k_blocks();
     this->m_regs = pc.regularizers();
     this->m_global_dims = pc.dimensions();
+#ifndef BUILD_SPARSE
+    // the shape of a npy input overrides -d before the grid is chosen
+    if (this->m_Afile_name.size() > 4 &&
+        this->m_Afile_name.compare(this->m_Afile_name.size() - 4, 4,
+                                   ".npy") == 0) {
+      UVEC shape = planc::npyShape(this->m_Afile_name);
+      if (shape.n_elem > 0) {
+        this->m_global_dims = shape;
+        if (this->m_proc_grids.n_elem != shape.n_elem &&
+            !this->m_proc_grids_given) {
+          this->m_proc_grids = arma::ones<UVEC>(shape.n_elem);
+        }
+      }
+    }
+#endif
     this->m_compute_error = pc.compute_error();
     this->m_enable_dim_tree = pc.dim_tree();
+    this->m_mixed_precision = pc.mixed_precision();
+    this->m_overlap_comm = pc.overlap_comm();
+    this->m_tolerance = pc.tolerance();
+    this->m_stop_policy = pc.stop_policy();
+    this->m_stop_window = pc.stop_window();
     this->m_outputfile_name = pc.output_file_name();
+    this->m_checkpoint_file_name = pc.checkpoint_file_name();
+    this->m_checkpoint_every = pc.checkpoint_every();
+    this->m_restart_file_name = pc.restart_file_name();
     printConfig();
     switch (this->m_ntfalgo) {
       case MU:
@@ -3,6 +3,8 @@
 #ifndef DISTNTF_DISTNTFANLSBPP_HPP_
 #define DISTNTF_DISTNTFANLSBPP_HPP_
 
+#include <omp.h>
+
 #include "distntf/distauntf.hpp"
 #include "nnls/bppnnls.hpp"
 
@@ -22,52 +24,30 @@ class DistNTFANLSBPP : public DistAUNTF {
   MAT update(const int mode) {
     MAT othermat(this->m_local_ncp_factors_t.factor(mode));
     if (m_nls_sizes[mode] > 0) {
-      UINT nrhs = this->ncp_local_mttkrp_t[mode].n_cols;
-      UINT numChunks = nrhs / ONE_THREAD_MATRIX_SIZE;
-      if (numChunks * ONE_THREAD_MATRIX_SIZE < nrhs) numChunks++;
-      // #pragma omp parallel for schedule(dynamic)
-      for (UINT i = 0; i < numChunks; i++) {
-        UINT spanStart = i * ONE_THREAD_MATRIX_SIZE;
-        UINT spanEnd = (i + 1) * ONE_THREAD_MATRIX_SIZE - 1;
-        if (spanEnd > nrhs - 1) {
-          spanEnd = nrhs - 1;
-        }
-        BPPNNLS<MAT, VEC> subProblem(this->global_gram,
-                  (MAT)this->ncp_local_mttkrp_t[mode].cols(spanStart, spanEnd),
-                  true);
-#ifdef _VERBOSE
-      // #pragma omp critical
-        {
-          INFO << "Scheduling " << worh << " start=" << spanStart
-             << ", end=" << spanEnd
-             // << ", tid=" << omp_get_thread_num()
-             << std::endl
-             << "LHS ::" << std::endl
-             << giventGiven << std::endl
-             << "RHS ::" << std::endl
-             << this->ncp_local_mttkrp_t[mode].cols(spanStart, spanEnd)
-             << std::endl;
-        }
-#endif
-
-        subProblem.solveNNLS();
-
-#ifdef _VERBOSE
-        INFO << "completed " << worh << " start=" << spanStart
-           << ", end=" << spanEnd
-           // << ", tid=" << omp_get_thread_num() << " cpu=" << sched_getcpu()
-           << " time taken=" << t2 << std::endl;
-#endif
-        othermat.cols(spanStart, spanEnd) = subProblem.getSolutionMatrix();
-      }
+      othermat = update_rows(mode, 0, m_nls_sizes[mode] - 1);
     } else {
       othermat.zeros();
     }
     return othermat;
   }
+  /// Every column of the transposed factor is an independent NNLS.
+  bool row_separable() const { return true; }
+  /**
+   * Solves the rows start to end of the factor.
+   * @param[in] Mode of the factor to be updated
+   * @param[in] start first local row
+   * @param[in] end last local row
+   * @returns columns start to end of the transposed factor
+   */
+  MAT update_rows(const int mode, const UWORD start, const UWORD end) {
+    MAT othermat = this->m_local_ncp_factors_t.factor(mode).cols(start, end);
+    solveChunkedBPP(this->global_gram, this->ncp_local_mttkrp_t[mode], start,
+                    ONE_THREAD_MATRIX_SIZE, &othermat);
+    return othermat;
+  }
 
  public:
-  DistNTFANLSBPP(const Tensor &i_tensor, const int i_k, algotype i_algo,
+  DistNTFANLSBPP(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo,
                  const UVEC &i_global_dims, const UVEC &i_local_dims,
                  const UVEC &i_nls_sizes, const UVEC &i_nls_idxs,
                  const NTFMPICommunicator &i_mpicomm)
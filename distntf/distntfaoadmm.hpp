@@ -126,7 +126,7 @@ class DistNTFAOADMM : public DistAUNTF {
   }
 
  public:
-  DistNTFAOADMM(const Tensor &i_tensor, const int i_k, algotype i_algo,
+  DistNTFAOADMM(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo,
                 const UVEC &i_global_dims, const UVEC &i_local_dims,
                 const UVEC &i_nls_sizes, const UVEC &i_nls_idxs,
                 const NTFMPICommunicator &i_mpicomm)
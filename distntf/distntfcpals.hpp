@@ -3,31 +3,48 @@
 #ifndef DISTNTF_DISTNTFCPALS_HPP_
 #define DISTNTF_DISTNTFCPALS_HPP_
 
+#include "common/spdsolver.hpp"
 #include "distntf/distauntf.hpp"
 
 namespace planc {
 
 class DistNTFCPALS : public DistAUNTF {
+ private:
+  /// Cholesky of global_gram of the mode being updated
+  SPDSolver m_gram_solver;
+
  protected:
+  /// Factorizes the hadamard of the grams once per mode update.
+  void prepare_update(const int mode) {
+    if (!m_gram_solver.factorize(this->global_gram)) {
+      DISTPRINTINFO("rank deficient gram::mode::" << mode << "::shift::"
+                                                  << m_gram_solver.shift());
+    }
+  }
   /**
    * This is unconstrained CP ALS update function.
    * Given the MTTKRP and the hadamard of all the grams, we
-   * determine the factor matrix to be updated.
+   * determine the factor matrix to be updated. The mttkrp is copied
+   * and solved in place with the factorization of prepare_update. The
+   * mttkrp itself is kept for the error and its reuse.
    * @param[in] Mode of the factor to be updated
    * @returns The new updated factor
    */
   MAT update(const int mode) {
-    MAT Ht = this->m_local_ncp_factors.factor(mode).t();
-    if (m_nls_sizes[mode] > 0) {
-      Ht = arma::solve(this->global_gram, this->ncp_local_mttkrp_t[mode]);
-    } else {  // Return unmodified factor
-      Ht.zeros();
-    }
+    MAT Ht = this->ncp_local_mttkrp_t[mode];
+    m_gram_solver.solve(&Ht);
+    return Ht;
+  }
+  /// Every row is an independent solve with the same gram.
+  bool row_separable() const { return true; }
+  MAT update_rows(const int mode, const UWORD start, const UWORD end) {
+    MAT Ht = this->ncp_local_mttkrp_t[mode].cols(start, end);
+    m_gram_solver.solve(&Ht);
     return Ht;
   }
 
  public:
-  DistNTFCPALS(const Tensor &i_tensor, const int i_k, algotype i_algo,
+  DistNTFCPALS(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo,
                const UVEC &i_global_dims, const UVEC &i_local_dims,
                const UVEC &i_nls_sizes, const UVEC &i_nls_idxs,
                const NTFMPICommunicator &i_mpicomm)
@@ -5,12 +5,15 @@
 
 #include <unistd.h>
 #include <armadillo>
+#include <fstream>
 #include <limits>  // for limits of standard data types
 #include <string>
 #include <vector>
+#include "common/distnpyio.hpp"
 #include "common/distutils.hpp"
 #include "common/ncpfactors.hpp"
 #include "common/npyio.hpp"
+#include "common/ntf_utils.hpp"
 #include "common/tensor.hpp"
 #include "distntf/distntfmpicomm.hpp"
 
@@ -28,7 +31,7 @@ namespace planc {
 class DistNTFIO {
  private:
   const NTFMPICommunicator &m_mpicomm;
-  Tensor &m_A;
+  NTFTENSOR &m_A;
   // don't start getting prime number from 2;
   static const int kPrimeOffset = 10;
   // Hope no one hits on this number.
@@ -57,7 +60,12 @@ class DistNTFIO {
       local_factors.factor(i) =
           global_factors.factor(i).rows(start_row, end_row);
     }
+#ifdef BUILD_SPARSE
+    // keep the sparsity pattern of m_A
+    m_A.rankk_values(local_factors);
+#else
     local_factors.rankk_tensor(m_A);
+#endif
   }
 
   /*
@@ -113,7 +121,7 @@ class DistNTFIO {
   */
 
  public:
-  explicit DistNTFIO(const NTFMPICommunicator &mpic, Tensor &in)
+  explicit DistNTFIO(const NTFMPICommunicator &mpic, NTFTENSOR &in)
       : m_mpicomm(mpic), m_A(in) {}
   ~DistNTFIO() {
     // delete this->m_A;
@@ -152,6 +160,101 @@ class DistNTFIO {
     }
   }*/
 
+#ifdef BUILD_SPARSE
+  /**
+   * Reads the local block of a sparse coordinate file. Every process
+   * parses an equal byte range of the file, the global dimensions are
+   * the largest subscripts over all ranges and every non zero is sent to
+   * the process that owns its block. Each line is parsed once. See
+   * SparseTensor::parse for the format.
+   * @param[in] filename of the coordinate file
+   * @return global dimensions
+   */
+  UVEC read_sparse_tensor(const std::string filename) {
+    PRINTROOT("Reading sparse tensor" << filename);
+    std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::ate);
+    std::streamoff fsize = ifs.is_open() ? std::streamoff(ifs.tellg()) : 0;
+    ifs.close();
+    const int p = MPI_SIZE;
+    std::streamoff begin = fsize * MPI_RANK / p;
+    std::streamoff end = fsize * (MPI_RANK + 1) / p;
+    UMAT subs;
+    VEC vals;
+    UVEC dims = SparseTensor::parse(filename, begin, end, &subs, &vals);
+    int local_modes = dims.n_elem;
+    int modes = 0;
+    MPI_Allreduce(&local_modes, &modes, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    std::vector<uint64_t> local_dims(modes, 0), global_dims(modes, 0);
+    for (int i = 0; i < local_modes; i++) local_dims[i] = dims[i];
+    MPI_Allreduce(local_dims.data(), global_dims.data(), modes, MPI_UINT64_T,
+                  MPI_MAX, MPI_COMM_WORLD);
+    this->m_global_dims = arma::zeros<UVEC>(modes);
+    for (int i = 0; i < modes; i++) this->m_global_dims[i] = global_dims[i];
+    UVEC start_idxs = arma::zeros<UVEC>(modes);
+    this->m_local_dims = arma::zeros<UVEC>(modes);
+    UVEC tmp_proc_grids = this->m_mpicomm.proc_grids();
+    for (int i = 0; i < modes; i++) {
+      this->m_local_dims[i] =
+          itersplit(this->m_global_dims[i], tmp_proc_grids[i],
+                    this->m_mpicomm.fiber_rank(i));
+      start_idxs[i] = startidx(this->m_global_dims[i], tmp_proc_grids[i],
+                               this->m_mpicomm.fiber_rank(i));
+    }
+    // send every non zero as its subscripts and value to its owner
+    const UWORD nnz = vals.n_elem;
+    const int width = modes + 1;
+    std::vector<int> dest(nnz), coords(modes);
+    std::vector<int> sendcnts(p, 0), recvcnts(p, 0);
+    std::vector<int> sdispls(p, 0), rdispls(p, 0);
+    for (UWORD j = 0; j < nnz; j++) {
+      for (int i = 0; i < modes; i++) {
+        coords[i] = owneridx(subs(i, j), this->m_global_dims[i],
+                             tmp_proc_grids[i]);
+      }
+      dest[j] = this->m_mpicomm.rank(&coords[0]);
+      sendcnts[dest[j]] += width;
+    }
+    MPI_Alltoall(&sendcnts[0], 1, MPI_INT, &recvcnts[0], 1, MPI_INT,
+                 this->m_mpicomm.cart_comm());
+    for (int q = 1; q < p; q++) {
+      sdispls[q] = sdispls[q - 1] + sendcnts[q - 1];
+      rdispls[q] = rdispls[q - 1] + recvcnts[q - 1];
+    }
+    std::vector<double> sendbuf(nnz * width);
+    std::vector<double> recvbuf(rdispls[p - 1] + recvcnts[p - 1]);
+    std::vector<int> pos(sdispls);
+    for (UWORD j = 0; j < nnz; j++) {
+      double *e = &sendbuf[pos[dest[j]]];
+      for (int i = 0; i < modes; i++) e[i] = subs(i, j);
+      e[modes] = vals(j);
+      pos[dest[j]] += width;
+    }
+    subs.clear();
+    vals.clear();
+    MPI_Alltoallv(sendbuf.data(), &sendcnts[0], &sdispls[0], MPI_DOUBLE,
+                  recvbuf.data(), &recvcnts[0], &rdispls[0], MPI_DOUBLE,
+                  this->m_mpicomm.cart_comm());
+    sendbuf.clear();
+    const UWORD local_nnz = recvbuf.size() / width;
+    UMAT local_subs(modes, local_nnz);
+    VEC local_vals(local_nnz);
+    for (UWORD j = 0; j < local_nnz; j++) {
+      const double *e = &recvbuf[j * width];
+      for (int i = 0; i < modes; i++) {
+        local_subs(i, j) = static_cast<UWORD>(e[i]) - start_idxs[i];
+      }
+      local_vals(j) = e[modes];
+    }
+    SparseTensor local_tensor(this->m_local_dims, local_subs, local_vals);
+    local_tensor.set_idx(start_idxs);
+    this->m_A.swap(local_tensor);
+    DISTPRINTINFO("global dims::" << this->m_global_dims
+                                  << "Local Tensor Dims::" << this->m_local_dims
+                                  << "::start_idxs::" << start_idxs
+                                  << "::nnz::" << this->m_A.nnz());
+    return this->m_global_dims;
+  }
+#else
   /*
       Reading from real input file.
       Expecting a .tensor text file and .bin file.
@@ -223,7 +326,7 @@ class DistNTFIO {
       PRINTROOT("file read size ::" << 8.0 * count << " > 2GB" << std::endl);
     }
     MPI_Status status;
-    ret = MPI_File_read_all(fh, &rc.m_data[0], count, MPI_DOUBLE, &status);
+    ret = MPI_File_read_all(fh, rc.m_data.data(), count, MPI_DOUBLE, &status);
     int nread;
     MPI_Get_count(&status, MPI_DOUBLE, &nread);
     if (ret != MPI_SUCCESS) {
@@ -241,6 +344,43 @@ class DistNTFIO {
     swap(this->m_A, rc);
     return this->m_global_dims;
   }
+  /**
+   * Reads the local block of a npy tensor in C or Fortran order. The
+   * root parses the header and the global dimensions come from it.
+   * Every process reads only its block with a subarray view.
+   * @param[in] filename of a npy array with one mode per grid dimension
+   */
+  void read_npy_tensor(const std::string filename) {
+    PRINTROOT("Reading npy tensor" << filename);
+    DistNumPyArray npy(MPI_COMM_WORLD);
+    UVEC tmp_proc_grids = this->m_mpicomm.proc_grids();
+    if (!npy.open(filename) || npy.dims().n_elem != tmp_proc_grids.n_elem) {
+      if (ISROOT) {
+        DISTPRINTINFO("Error: " << filename << " is not a npy array of "
+                                << tmp_proc_grids.n_elem << " modes");
+      }
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    int modes = tmp_proc_grids.n_elem;
+    this->m_global_dims = npy.dims();
+    this->m_local_dims = arma::zeros<UVEC>(modes);
+    UVEC start_idxs = arma::zeros<UVEC>(modes);
+    for (int i = 0; i < modes; i++) {
+      this->m_local_dims[i] = itersplit(this->m_global_dims[i],
+                                        tmp_proc_grids[i],
+                                        this->m_mpicomm.fiber_rank(i));
+      start_idxs[i] = startidx(this->m_global_dims[i], tmp_proc_grids[i],
+                               this->m_mpicomm.fiber_rank(i));
+    }
+    DISTPRINTINFO("global dims::" << this->m_global_dims
+                                  << "Local Tensor Dims::" << this->m_local_dims
+                                  << "::start_idxs::" << start_idxs);
+    Tensor rc(this->m_local_dims, start_idxs);
+    if (!npy.read(filename, start_idxs, this->m_local_dims, rc.data())) {
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    swap(this->m_A, rc);
+  }
   /**
    * Writes distributed tensor.
    * Expecting a .tensor text file and .bin file.
@@ -306,7 +446,7 @@ class DistNTFIO {
     int count = local_tensor.numel();
     assert(count <= std::numeric_limits<int>::max());
     MPI_Status status;
-    ret = MPI_File_write_all(fh, &local_tensor.m_data[0], count, MPI_DOUBLE,
+    ret = MPI_File_write_all(fh, local_tensor.data(), count, MPI_DOUBLE,
                              &status);
     if (ret != MPI_SUCCESS) {
       DISTPRINTINFO("Error: Could not write file " << filename << std::endl);
@@ -320,6 +460,7 @@ class DistNTFIO {
     delete[] lsizes;
     delete[] starts;
   }
+#endif  // ifdef BUILD_SPARSE
 
   /*
    * We need m,n,pr,pc only for rand matrices. If otherwise we are
@@ -346,6 +487,16 @@ class DistNTFIO {
         start_rows[mode] =
             startidx(i_global_dims[mode], i_proc_grids[mode], slice_num);
       }
+#ifdef BUILD_SPARSE
+      // random pattern of the local block. a different seed on every
+      // process like the dense rand_uniform.
+      SparseTensor temp(this->m_local_dims, sparsity, 449 * MPI_RANK + 677);
+      this->m_A.swap(temp);
+      this->m_A.set_idx(start_rows);
+      if (!file_name.compare("rand_lowrank")) {
+        randomLowRank(i_global_dims, this->m_local_dims, start_rows, k);
+      }
+#else
       if (!file_name.compare("rand_uniform")) {
         // Tensor temp(i_global_dims / i_proc_grids);
         Tensor temp(this->m_local_dims, start_rows);
@@ -357,39 +508,60 @@ class DistNTFIO {
         randomLowRank(i_global_dims, this->m_local_dims, start_rows, k);
         this->m_A.set_idx(start_rows);
       }
+#endif
     } else {
-      read_dist_tensor(file_name);
+#ifdef BUILD_SPARSE
+      read_sparse_tensor(file_name);
+#else
+      if (file_name.size() > 4 &&
+          file_name.compare(file_name.size() - 4, 4, ".npy") == 0) {
+        read_npy_tensor(file_name);
+      } else {
+        read_dist_tensor(file_name);
+      }
+#endif
     }
   }
+  /**
+   * Uses MPIIO to write the local rows of a factor into a global column
+   * major npy file. The root writes the header and every process writes
+   * the rows it owns behind it, so no process holds the whole factor.
+   * @param[in] local rows of the factor
+   * @param[in] global row count
+   * @param[in] first global row of the local rows
+   * @param[in] output file name
+   */
+  void writeFactor(const MAT &X, const UWORD global_m, const UWORD row_start,
+                   const std::string &output_file_name) {
+    UVEC shape(2);
+    shape[0] = global_m;
+    shape[1] = X.n_cols;
+    std::string header = npyHeader(shape, true);
+    writeRowBlocks(MPI_COMM_WORLD, output_file_name, header, X, global_m,
+                   row_start);
+  }
+  /**
+   * Writes every factor to output_file_name_mode<i>_<p>.npy with
+   * writeFactor. The small lambda is written by the root as a npy too.
+   */
   void write(const std::string &output_file_name, DistAUNTF *ntfsolver) {
     std::stringstream sw;
     for (unsigned int i = 0; i < ntfsolver->modes(); i++) {
-      sw << output_file_name << "_mode" << i << "_" << MPI_SIZE;
-      MAT factort;
-      if (this->m_mpicomm.fiber_rank(i) == 0) {
-        factort = arma::zeros<MAT>(ntfsolver->rank(), this->m_global_dims[i]);
-      }
-      // This is a convenience barrier
-      MPI_Barrier(MPI_COMM_WORLD);
-      ntfsolver->factor(i, factort.memptr());
-      // if (isparticipating(i) && this->m_mpicomm.fiber_rank(i) == 0) {
-      if (ISROOT) {
-        PRINTROOT("Writing factor " << i << " to " << sw.str());
-        MAT current_factor = factort.t();
-        current_factor.save(sw.str(), arma::raw_ascii);
-      }
-      MPI_Barrier(MPI_COMM_WORLD);
+      sw << output_file_name << "_mode" << i << "_" << MPI_SIZE << ".npy";
+      PRINTROOT("Writing factor " << i << " to " << sw.str());
+      writeFactor(ntfsolver->local_factor(i), this->m_global_dims[i],
+                  ntfsolver->factor_row_start(i), sw.str());
       sw.clear();
       sw.str("");
     }
     sw << output_file_name << "_lambda"
-       << "_" << MPI_SIZE;
+       << "_" << MPI_SIZE << ".npy";
     if (ISROOT) {
-      ntfsolver->lambda().save(sw.str(), arma::raw_ascii);
+      writeNpy(sw.str(), ntfsolver->lambda());
     }
   }
   void writeRandInput() {}
-  const Tensor &A() const { return m_A; }
+  const NTFTENSOR &A() const { return m_A; }
   const NTFMPICommunicator &mpicomm() const { return m_mpicomm; }
   UVEC global_dims() const { return m_global_dims; }
 };
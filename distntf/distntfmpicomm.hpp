@@ -7,6 +7,7 @@
 
 #include <mpi.h>
 #include <vector>
+#include "common/procgrid.hpp"
 namespace planc {
 
 class NTFMPICommunicator {
@@ -73,6 +74,38 @@ class NTFMPICommunicator {
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, reinterpret_cast<int *>(&m_global_rank));
     MPI_Comm_size(MPI_COMM_WORLD, reinterpret_cast<int *>(&m_num_procs));
+    setupGrid();
+  }
+  /**
+   * Chooses the zero entries of i_dims with autoProcGrid before setting
+   * up the communicators. Positive entries are kept. See requestedGrid
+   * for when the drivers ask for a choice.
+   * @param[in] global_dims global size of every mode. Known if i_dims
+   *            has a 0 entry.
+   * @param[in] k low rank
+   * @param[in] ranks_per_node processes on a node. 0 detects it.
+   */
+  NTFMPICommunicator(int argc, char *argv[], const UVEC &i_dims,
+                     const UVEC &global_dims, int k, int ranks_per_node)
+      : m_proc_grids(i_dims) {
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, reinterpret_cast<int *>(&m_global_rank));
+    MPI_Comm_size(MPI_COMM_WORLD, reinterpret_cast<int *>(&m_num_procs));
+    if (m_proc_grids.n_elem > 0 && arma::any(m_proc_grids == 0)) {
+      UVEC grid = autoProcGrid(MPI_COMM_WORLD, global_dims, k, ranks_per_node,
+                               m_proc_grids);
+      if (grid.n_elem == 0) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      m_proc_grids = grid;
+    }
+    setupGrid();
+  }
+
+ private:
+  /// Creates the Cartesian grid of m_proc_grids and its sub communicators
+  void setupGrid() {
     if (m_num_procs != arma::prod(m_proc_grids)) {
       ERR << "number of mpi process and process grid doesn't match";
       MPI_Barrier(MPI_COMM_WORLD);
@@ -125,6 +158,8 @@ class NTFMPICommunicator {
     }
   }
 
+ public:
+
   ~NTFMPICommunicator() {
     MPI_Barrier(MPI_COMM_WORLD);
     int finalized;
@@ -17,19 +17,33 @@ class DistNTFMU : public DistAUNTF {
    * @returns The new updated factor
    */
   MAT update(const int mode) {
-    MAT H(this->m_local_ncp_factors.factor(mode));
+    MAT Ht(this->m_local_ncp_factors_t.factor(mode));
     if (m_nls_sizes[mode] > 0) {
-      MAT temp = H * this->global_gram + EPSILON;
-      MAT rhs = this->ncp_local_mttkrp_t[mode].t();
-      H = (H % rhs) / temp;
+      Ht = update_rows(mode, 0, m_nls_sizes[mode] - 1);
     } else {  // Return unmodified factor
-      H.zeros();
+      Ht.zeros();
     }
+    return Ht;
+  }
+  /// Every row is updated independently given the gram.
+  bool row_separable() const { return true; }
+  /**
+   * MU update of the rows start to end of the factor.
+   * @param[in] Mode of the factor to be updated
+   * @param[in] start first local row
+   * @param[in] end last local row
+   * @returns columns start to end of the transposed factor
+   */
+  MAT update_rows(const int mode, const UWORD start, const UWORD end) {
+    MAT H = this->m_local_ncp_factors.factor(mode).rows(start, end);
+    MAT temp = H * this->global_gram + EPSILON;
+    MAT rhs = this->ncp_local_mttkrp_t[mode].cols(start, end).t();
+    H = (H % rhs) / temp;
     return H.t();
   }
 
  public:
-  DistNTFMU(const Tensor &i_tensor, const int i_k, algotype i_algo,
+  DistNTFMU(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo,
             const UVEC &i_global_dims, const UVEC &i_local_dims,
             const UVEC &i_nls_sizes, const UVEC &i_nls_idxs,
             const NTFMPICommunicator &i_mpicomm)
@@ -200,7 +200,7 @@ class DistNTFNES : public DistAUNTF {
   }
 
  public:
-  DistNTFNES(const Tensor &i_tensor, const int i_k, algotype i_algo,
+  DistNTFNES(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo,
              const UVEC &i_global_dims, const UVEC &i_local_dims,
              const UVEC &i_nls_sizes, const UVEC &i_nls_idxs,
              const NTFMPICommunicator &i_mpicomm)
@@ -3,6 +3,8 @@
 #ifndef DISTNTF_DISTNTFTIME_HPP_
 #define DISTNTF_DISTNTFTIME_HPP_
 
+#include <vector>
+
 namespace planc {
 class DistNTFTime {
  private:
@@ -20,6 +22,16 @@ class DistNTFTime {
   double m_err_compute_duration;
   double m_err_communication_duration;
   double m_trans_duration;
+  // pipelined mode. time blocked in waits and packing chunks.
+  double m_allgather_wait_duration;
+  double m_reducescatter_wait_duration;
+  double m_pack_duration;
+
+  void init_pipeline() {
+    m_allgather_wait_duration = 0;
+    m_reducescatter_wait_duration = 0;
+    m_pack_duration = 0;
+  }
 
  public:
   DistNTFTime(double d, double compute_d, double communication_d,
@@ -38,6 +50,7 @@ class DistNTFTime {
     m_multittv_duration = 0;  // needed only for dimtrees
     m_nnls_duration = 0;
     m_trans_duration = 0;
+    init_pipeline();
   }
   DistNTFTime(double d, double compute_d, double communication_d,
               double trans_d, double allgather_d, double allreduce_d,
@@ -57,7 +70,9 @@ class DistNTFTime {
         m_nnls_duration(nnls_d),
         m_err_compute_duration(err_comp),
         m_err_communication_duration(err_comm),
-        m_trans_duration(trans_d) {}
+        m_trans_duration(trans_d) {
+    init_pipeline();
+  }
   DistNTFTime(double d, double compute_d, double communication_d, double gram_d,
               double krp_d, double mttkrp_d, double multittv_d, double nnls_d,
               double err_comp, double err_comm)
@@ -70,7 +85,13 @@ class DistNTFTime {
         m_multittv_duration(multittv_d),
         m_nnls_duration(nnls_d),
         m_err_compute_duration(err_comp),
-        m_err_communication_duration(err_comm) {}
+        m_err_communication_duration(err_comm) {
+    m_allgather_duration = 0;
+    m_allreduce_duration = 0;
+    m_reducescatter_duration = 0;
+    m_trans_duration = 0;
+    init_pipeline();
+  }
 
   const double duration() const { return m_duration; }
   const double compute_duration() const { return m_compute_duration; }
@@ -92,6 +113,13 @@ class DistNTFTime {
     return m_err_communication_duration;
   }
   const double trans_duration() const { return m_trans_duration; }
+  const double allgather_wait_duration() const {
+    return m_allgather_wait_duration;
+  }
+  const double reducescatter_wait_duration() const {
+    return m_reducescatter_wait_duration;
+  }
+  const double pack_duration() const { return m_pack_duration; }
   void duration(double d) { m_duration += d; }
   void compute_duration(double d) { m_compute_duration += d; }
   void communication_duration(double d) { m_communication_duration += d; }
@@ -104,10 +132,58 @@ class DistNTFTime {
   void multittv_duration(double d) { m_multittv_duration += d; }
   void nnls_duration(double d) { m_nnls_duration += d; }
   void trans_duration(double d) { m_trans_duration += d; }
+  void allgather_wait_duration(double d) { m_allgather_wait_duration += d; }
+  void reducescatter_wait_duration(double d) {
+    m_reducescatter_wait_duration += d;
+  }
+  void pack_duration(double d) { m_pack_duration += d; }
   void err_compute_duration(double d) { m_err_compute_duration += d; }
   void err_communication_duration(double d) {
     m_err_communication_duration += d;
   }
+  /// All the accumulated statistics in a fixed order for checkpoints
+  std::vector<double> values() const {
+    double v[] = {m_duration,
+                  m_compute_duration,
+                  m_communication_duration,
+                  m_allgather_duration,
+                  m_allreduce_duration,
+                  m_reducescatter_duration,
+                  m_gram_duration,
+                  m_krp_duration,
+                  m_mttkrp_duration,
+                  m_multittv_duration,
+                  m_nnls_duration,
+                  m_err_compute_duration,
+                  m_err_communication_duration,
+                  m_trans_duration,
+                  m_allgather_wait_duration,
+                  m_reducescatter_wait_duration,
+                  m_pack_duration};
+    return std::vector<double>(v, v + sizeof(v) / sizeof(v[0]));
+  }
+  /// Restores statistics saved by values(). Ignored if the size differs.
+  void restore(const std::vector<double> &v) {
+    double *d[] = {&m_duration,
+                   &m_compute_duration,
+                   &m_communication_duration,
+                   &m_allgather_duration,
+                   &m_allreduce_duration,
+                   &m_reducescatter_duration,
+                   &m_gram_duration,
+                   &m_krp_duration,
+                   &m_mttkrp_duration,
+                   &m_multittv_duration,
+                   &m_nnls_duration,
+                   &m_err_compute_duration,
+                   &m_err_communication_duration,
+                   &m_trans_duration,
+                   &m_allgather_wait_duration,
+                   &m_reducescatter_wait_duration,
+                   &m_pack_duration};
+    if (v.size() != sizeof(d) / sizeof(d[0])) return;
+    for (unsigned int i = 0; i < v.size(); i++) *d[i] = v[i];
+  }
 };
 }  // namespace planc
 
@@ -57,6 +57,18 @@ class HierNMFDriver {
     this->m_num_k_blocks = 1;
     this->m_globalm = pc->globalm();
     this->m_globaln = pc->globaln();
+#ifndef BUILD_SPARSE
+    // the shape of a npy input overrides -d before the grid is chosen
+    if (this->m_Afile_name.size() > 4 &&
+        this->m_Afile_name.compare(this->m_Afile_name.size() - 4, 4,
+                                   ".npy") == 0) {
+      UVEC shape = npyShape(this->m_Afile_name);
+      if (shape.n_elem == 2) {
+        this->m_globalm = shape[0];
+        this->m_globaln = shape[1];
+      }
+    }
+#endif
     this->m_compute_error = pc->compute_error();
     this->m_outputfile_name = pc->output_file_name();
     pc->printConfig();
@@ -64,8 +76,20 @@ class HierNMFDriver {
 
   void buildTree() {
     std::string rand_prefix("rand_");
+    // the grid is pr x 1, so only pr is chosen. Same conditions as in
+    // distnmf.
+    UVEC global_dims(2);
+    global_dims[0] = this->m_globalm;
+    global_dims[1] = this->m_globaln;
+    UVEC grid(2);
+    grid[0] = this->m_pr;
+    grid[1] = this->m_pc;
+    grid = requestedGrid(grid, pc->proc_grids_given(), global_dims,
+                         gridAgnosticInput(this->m_Afile_name));
     this->mpicomm =
-        new MPICommunicator(this->m_argc, this->m_argv, this->m_pr, this->m_pc);
+        new MPICommunicator(this->m_argc, this->m_argv, grid[0], this->m_pc,
+                            global_dims, this->m_k, 0, false);
+    this->m_pr = this->mpicomm->pr();
 
 #ifdef BUILD_SPARSE
     SP_MAT A;
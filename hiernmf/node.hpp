@@ -148,10 +148,10 @@ class Node {
     UVEC left(A.n_cols, arma::fill::zeros);
     int * recvcnts = new int[this->mpicomm->size()];
     int * displs = new int[this->mpicomm->size()];
-    recvcnts[0] = itersplit(A.n_cols, pc->pr(), 0);
+    recvcnts[0] = itersplit(A.n_cols, this->mpicomm->pr(), 0);
     displs[0] = 0;
     for (int i = 1; i < this->mpicomm->size(); i++) {
-      recvcnts[i] = itersplit(A.n_cols, pc->pr(), i);
+      recvcnts[i] = itersplit(A.n_cols, this->mpicomm->pr(), i);
       displs[i] = displs[i - 1] + recvcnts[i - 1];
     }
     MPI_Allgatherv(lleft.memptr(), lleft.n_elem, MPI_UNSIGNED_LONG_LONG,
@@ -23,13 +23,11 @@ class BPPNMF : public NMF<T> {
   T At;
   MAT giventGiven;
   // designed as if W is given and H is found.
-  // The transpose is the other problem.
+  // The transpose is the other problem. Every chunk is warm started
+  // from the current rows of othermat.
   void updateOtherGivenOneMultipleRHS(const T &input, const MAT &given,
                                       char worh, MAT *othermat, FVEC reg) {
     double t2;
-    UINT numChunks = input.n_cols / ONE_THREAD_MATRIX_SIZE;
-    if (numChunks * ONE_THREAD_MATRIX_SIZE < input.n_cols) numChunks++;
-
     tic();
     MAT giventInput(this->k, input.n_cols);
     // This is WtW
@@ -44,7 +42,7 @@ class BPPNMF : public NMF<T> {
     }
     t2 = toc();
     INFO << "starting " << worh << ". Prereq for " << worh << " took=" << t2
-         << " NumChunks=" << numChunks << std::endl;
+         << std::endl;
 #ifdef _VERBOSE
     INFO << "LHS::" << std::endl
          << giventGiven << std::endl
@@ -53,42 +51,13 @@ class BPPNMF : public NMF<T> {
 #endif
     tic();
 
-// #pragma omp parallel for schedule(dynamic)
-    for (UINT i = 0; i < numChunks; i++) {
-      UINT spanStart = i * ONE_THREAD_MATRIX_SIZE;
-      UINT spanEnd = (i + 1) * ONE_THREAD_MATRIX_SIZE - 1;
-      if (spanEnd > input.n_cols - 1) {
-        spanEnd = input.n_cols - 1;
-      }
-
-      BPPNNLS<MAT, VEC> subProblem(giventGiven,
-                              (MAT)giventInput.cols(spanStart, spanEnd), true);
-#ifdef _VERBOSE
-      // #pragma omp critical
-      {
-        INFO << "Scheduling " << worh << " start=" << spanStart
-             << ", end=" << spanEnd
-             // << ", tid=" << omp_get_thread_num()
-             << std::endl
-             << "LHS ::" << std::endl
-             << giventGiven << std::endl
-             << "RHS ::" << std::endl
-             << (MAT)giventInput.cols(spanStart, spanEnd) << std::endl;
-      }
-#endif
-
-      subProblem.solveNNLS();
-
-#ifdef _VERBOSE
-      INFO << "completed " << worh << " start=" << spanStart
-           << ", end=" << spanEnd
-           // << ", tid=" << omp_get_thread_num() << " cpu=" << sched_getcpu()
-           << " time taken=" << t2 << std::endl;
-#endif
-      (*othermat).rows(spanStart, spanEnd) = subProblem.getSolutionMatrix().t();
-    }
+    MAT othert = othermat->t();
+    UWORD pivots = solveChunkedBPP(giventGiven, giventInput, 0,
+                                   ONE_THREAD_MATRIX_SIZE, &othert);
+    *othermat = othert.t();
     double totalH2 = toc();
-    INFO << worh << " total time taken :" << totalH2 << std::endl;
+    INFO << worh << " total time taken :" << totalH2
+         << " pivots=" << pivots << std::endl;
     giventGiven.clear();
     giventInput.clear();
   }
@@ -3,6 +3,7 @@
 #ifndef NMF_HALS_HPP_
 #define NMF_HALS_HPP_
 
+#include "common/halsupdate.hpp"
 #include "common/nmf.hpp"
 
 namespace planc {
@@ -16,7 +17,8 @@ class HALSNMF : public NMF<T> {
   MAT WtW;
   MAT HtH;
   MAT WtA;
-  MAT AH;
+  MAT HtAt;
+  VEC sqnorms;
 
   /*
    * Collected statistics are
@@ -25,15 +27,17 @@ class HALSNMF : public NMF<T> {
   void allocateMatrices() {
     WtW = arma::zeros<MAT>(this->k, this->k);
     HtH = arma::zeros<MAT>(this->k, this->k);
-    WtA = arma::zeros<MAT>(this->n, this->k);
-    AH = arma::zeros<MAT>(this->m, this->k);
+    WtA = arma::zeros<MAT>(this->k, this->n);
+    HtAt = arma::zeros<MAT>(this->k, this->m);
+    sqnorms = arma::zeros<VEC>(this->k);
   }
   void freeMatrices() {
     this->At.clear();
     WtW.clear();
     HtH.clear();
     WtA.clear();
-    AH.clear();
+    HtAt.clear();
+    sqnorms.clear();
   }
 
  public:
@@ -62,44 +66,25 @@ class HALSNMF : public NMF<T> {
            << std::endl;
       // to avoid divide by zero error.
       tic();
-      double normConst;
-      VEC Hx;
-      for (unsigned int x = 0; x < this->k; x++) {
-        // H(i,:) = max(H(i,:) + WtA(i,:) - WtW_reg(i,:) * H,epsilon);
-        Hx = this->H.col(x) + (((WtA.row(x)).t()) - (this->H * (WtW.col(x))));
-        fixNumericalError<VEC>(&Hx, EPSILON_1EMINUS16, EPSILON_1EMINUS16);
-        normConst = norm(Hx);
-        if (normConst != 0) {
-          this->H.col(x) = Hx;
-        }
-      }
+      // H(:,x) = max(H(:,x) + WtA(x,:)' - H * WtW_reg(:,x),epsilon);
+      halsUpdate(WtW, WtA, false, &this->H, &sqnorms);
       INFO << "Completed H (" << currentIteration << "/"
            << this->num_iterations() << ")"
            << " time =" << toc() << std::endl;
       // update W;
       tic();
-      AH = this->A * this->H;
+      HtAt = this->H.t() * this->At;
       HtH = this->H.t() * this->H;
       this->applyReg(this->regW(), &this->HtH);
       INFO << "starting W Prereq for "
-           << " took=" << toc() << PRINTMATINFO(HtH) << PRINTMATINFO(AH)
+           << " took=" << toc() << PRINTMATINFO(HtH) << PRINTMATINFO(HtAt)
            << std::endl;
       tic();
-      VEC Wx;
-      for (unsigned int x = 0; x < this->k; x++) {
-        // FVEC Wx = W(:,x) + (AHt(:,x)-W*HHt(:,x))/HHtDiag(x);
-
-        // W(:,i) = max(W(:,i) * HHt_reg(i,i) + AHt(:,i) - W * HHt_reg(:,i),
-        //              epsilon);
-        Wx = (this->W.col(x) * HtH(x, x)) +
-             (((AH.col(x))) - (this->W * (HtH.col(x))));
-        fixNumericalError<VEC>(&Wx, EPSILON_1EMINUS16, EPSILON_1EMINUS16);
-        normConst = norm(Wx);
-        if (normConst != 0) {
-          Wx = Wx / normConst;
-          this->W.col(x) = Wx;
-        }
-      }
+      // W(:,x) = max(W(:,x) + (AH(:,x) - W * HHt_reg(:,x)) / HHt_reg(x,x),
+      //              epsilon);
+      // the columns are normalized once after the sweep instead of after
+      // every column. normalize_by_W moves the scale into H.
+      halsUpdate(HtH, HtAt, true, &this->W, &sqnorms);
       this->normalize_by_W();
 
       INFO << "Completed W (" << currentIteration << "/"
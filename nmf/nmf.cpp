@@ -1,6 +1,9 @@
 #include "common/nmf.hpp"
 #include <stdio.h>
+#include <memory>
 #include <string>
+#include "common/mmapio.hpp"
+#include "common/npyio.hpp"
 #include "common/parsecommandline.hpp"
 #include "common/utils.hpp"
 #include "nmf/aoadmm.hpp"
@@ -43,11 +46,57 @@ class NMFDriver {
   static const int kbeta = 0;
 #endif
 
+  /**
+   * Maps a dense input file instead of reading it. Fortran ordered
+   * npy files of doubles and raw column major ".bin" files of exactly
+   * m x n doubles (-d "m n") can be mapped. Everything else is read.
+   * @param[out] mapping that must outlive the matrix using the memory
+   * @return first element of the matrix or NULL if not mappable
+   */
+  double *mapDenseInput(std::shared_ptr<MappedFile> *mapping) {
+    const std::string &fname = this->m_Afile_name;
+    if (fname.size() < 4) return NULL;
+    std::string ext = fname.substr(fname.size() - 4);
+    if (ext == ".npy") {
+      NumPyArray npy;
+      if (!npy.map(fname)) return NULL;
+      delete npy.m_input_tensor;
+      if (npy.dims().n_elem != 2 || !npy.fortran_order()) {
+        WARN << "only fortran ordered 2D npy inputs are mapped" << std::endl;
+        return NULL;
+      }
+      this->m_m = npy.dims()(0);
+      this->m_n = npy.dims()(1);
+      *mapping = npy.mapping();
+      return npy.mapped_data();
+    }
+    if (ext == ".bin" && this->m_m > 0 && this->m_n > 0) {
+      mapping->reset(new MappedFile(fname));
+      // armadillo binary files have a header and are not raw
+      if ((*mapping)->is_open() &&
+          (*mapping)->size() == this->m_m * this->m_n * sizeof(double)) {
+        return (*mapping)->doubles();
+      }
+      mapping->reset();
+    }
+    return NULL;
+  }
+
   template <class NMFTYPE>
   void callNMF() {
 #ifdef BUILD_SPARSE
     SP_MAT A;
 #else
+    std::shared_ptr<MappedFile> mapping;
+    double *mapped = mapDenseInput(&mapping);
+    if (mapped != NULL) {
+      // strict aux memory. A never reallocates away from the mapping.
+      MAT mappedA(mapped, this->m_m, this->m_n, false, true);
+      INFO << "Successfully mapped input matrix A " << PRINTMATINFO(mappedA)
+           << std::endl;
+      runNMF<NMFTYPE>(mappedA);
+      return;
+    }
     MAT A;
 #endif
 
@@ -170,7 +219,17 @@ class NMFDriver {
       INFO << "generated random matrix A " << PRINTMATINFO(A)
            << "(" << t2 << " s)" << std::endl;
     }
+    runNMF<NMFTYPE>(A);
+  }
 
+  /**
+   * Normalizes the input, initializes the factors, runs the algorithm
+   * and saves the factors.
+   * @param[in] A either loaded, generated or mapped input matrix
+   */
+  template <class NMFTYPE, class INPUTMATTYPE>
+  void runNMF(INPUTMATTYPE &A) {
+    double t2;
     // Normalize the input matrix
     if (this->m_input_normalization != NONE) {
       tic();
@@ -0,0 +1,183 @@
+/* Copyright 2016 Ramakrishnan Kannan */
+
+#ifndef NNLS_PASSIVESET_HPP_
+#define NNLS_PASSIVESET_HPP_
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "utils.h"
+
+/**
+ * Bit packed representation of a binary passive set matrix.
+ * Every column of the \f$n \times nrhs\f$ passive set is stored as
+ * \f$\lceil n/64 \rceil\f$ consecutive 64 bit words. For the usual low
+ * ranks (n <= 64) a column is a single word and comparing two passive
+ * sets is a single integer compare.
+ */
+class PackedPassiveSet {
+ private:
+  UWORD m_nbits;   /// number of variables. Rows of the passive set.
+  UWORD m_nwords;  /// words per column
+  UWORD m_ncols;   /// number of right hand sides
+  std::vector<uint64_t> m_words;
+
+ public:
+  /**
+   * Packs the binary matrix. Non zero entries are passive.
+   * @param[in] binary matrix of size \f$n \times nrhs\f$
+   */
+  explicit PackedPassiveSet(const UMAT &PassSet)
+      : m_nbits(PassSet.n_rows),
+        m_nwords((PassSet.n_rows + 63) / 64),
+        m_ncols(PassSet.n_cols),
+        m_words(((PassSet.n_rows + 63) / 64) * PassSet.n_cols, 0) {
+    for (UWORD j = 0; j < m_ncols; j++) {
+      const UWORD *pcol = PassSet.colptr(j);
+      uint64_t *wcol = &m_words[j * m_nwords];
+      for (UWORD i = 0; i < m_nbits; i++) {
+        if (pcol[i]) wcol[i / 64] |= (uint64_t(1) << (i % 64));
+      }
+    }
+  }
+  /// Number of words used per column
+  UWORD nwords() const { return m_nwords; }
+  /// Number of columns
+  UWORD ncols() const { return m_ncols; }
+  /// Returns the packed words of column j
+  const uint64_t *col(const UWORD j) const { return &m_words[j * m_nwords]; }
+  /// Returns true if every variable of every column is passive
+  bool all() const {
+    for (UWORD j = 0; j < m_ncols; j++) {
+      const uint64_t *w = col(j);
+      for (UWORD i = 0; i < m_nwords; i++) {
+        uint64_t full = ~uint64_t(0);
+        if (i == m_nwords - 1 && m_nbits % 64 != 0) {
+          full = (uint64_t(1) << (m_nbits % 64)) - 1;
+        }
+        if (w[i] != full) return false;
+      }
+    }
+    return true;
+  }
+  /// Returns true if columns i and j have the same passive set
+  bool equal(const UWORD i, const UWORD j) const {
+    const uint64_t *wi = col(i);
+    const uint64_t *wj = col(j);
+    for (UWORD w = 0; w < m_nwords; w++) {
+      if (wi[w] != wj[w]) return false;
+    }
+    return true;
+  }
+  /// FNV style hash of the passive set of column j
+  uint64_t hash(const UWORD j) const {
+    const uint64_t *w = col(j);
+    uint64_t h = 1469598103934665603ULL;
+    for (UWORD i = 0; i < m_nwords; i++) {
+      h ^= w[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    return h;
+  }
+  /// Returns the passive (non zero) row indices of column j
+  UVEC indices(const UWORD j) const {
+    const uint64_t *w = col(j);
+    UWORD count = 0;
+    for (UWORD i = 0; i < m_nwords; i++) count += __builtin_popcountll(w[i]);
+    UVEC idx(count);
+    UWORD pos = 0;
+    for (UWORD i = 0; i < m_nwords; i++) {
+      uint64_t word = w[i];
+      while (word) {
+        idx(pos++) = i * 64 + __builtin_ctzll(word);
+        word &= word - 1;
+      }
+    }
+    return idx;
+  }
+  /// Returns the packed words of column j as a key for hash maps
+  std::vector<uint64_t> key(const UWORD j) const {
+    return std::vector<uint64_t>(col(j), col(j) + m_nwords);
+  }
+  /**
+   * Groups the columns that share the same passive set. Uses a hash
+   * of the packed words and only compares the words on a collision,
+   * so grouping is linear in the number of columns.
+   * @param[out] groups. Every entry is the list of column indices that
+   *             have the same passive set.
+   */
+  void group(std::vector<std::vector<UWORD> > *groups) const {
+    std::unordered_map<uint64_t, std::vector<UWORD> > buckets;
+    groups->clear();
+    for (UWORD j = 0; j < m_ncols; j++) {
+      std::vector<UWORD> &candidates = buckets[hash(j)];
+      bool found = false;
+      for (UWORD c = 0; c < candidates.size(); c++) {
+        std::vector<UWORD> &g = (*groups)[candidates[c]];
+        if (equal(g[0], j)) {
+          g.push_back(j);
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        candidates.push_back(groups->size());
+        groups->push_back(std::vector<UWORD>(1, j));
+      }
+    }
+  }
+};
+
+/// Hash functor for the packed passive set keys
+struct PassiveSetHash {
+  size_t operator()(const std::vector<uint64_t> &key) const {
+    uint64_t h = 1469598103934665603ULL;
+    for (UWORD i = 0; i < key.size(); i++) {
+      h ^= key[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    return static_cast<size_t>(h);
+  }
+};
+
+/**
+ * Cache of the upper triangular Cholesky factors of \f$A^TA(P,P)\f$
+ * keyed by the packed passive set P. The factors are only valid for
+ * one Gram matrix, so the owner must clear the cache whenever the
+ * Gram matrix changes. The cache stops growing once it holds
+ * kMaxCachedElements doubles.
+ */
+template <class MATTYPE>
+class PassiveSetCholeskyCache {
+ private:
+  static const UWORD kMaxCachedElements = 1 << 20;
+  std::unordered_map<std::vector<uint64_t>, MATTYPE, PassiveSetHash> m_factors;
+  UWORD m_cached_elements;
+  UWORD m_hits;
+
+ public:
+  PassiveSetCholeskyCache() : m_cached_elements(0), m_hits(0) {}
+  /**
+   * Returns the cached upper Cholesky factor of the given passive set
+   * or NULL if it was never computed.
+   */
+  const MATTYPE *find(const std::vector<uint64_t> &key) {
+    typename std::unordered_map<std::vector<uint64_t>, MATTYPE,
+                                PassiveSetHash>::const_iterator it =
+        m_factors.find(key);
+    if (it == m_factors.end()) return NULL;
+    m_hits++;
+    return &(it->second);
+  }
+  /// Stores a factor unless the cache is full
+  const MATTYPE *insert(const std::vector<uint64_t> &key, const MATTYPE &R) {
+    if (m_cached_elements + R.n_elem > kMaxCachedElements) return NULL;
+    m_cached_elements += R.n_elem;
+    return &(m_factors[key] = R);
+  }
+  /// Number of lookups served from the cache
+  UWORD hits() const { return m_hits; }
+  void clear() {
+    m_factors.clear();
+    m_cached_elements = 0;
+    m_hits = 0;
+  }
+};
+#endif  // NNLS_PASSIVESET_HPP_
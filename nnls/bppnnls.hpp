@@ -9,10 +9,14 @@
 #include <set>
 #include <algorithm>
 #include <iomanip>
-#include "SortBooleanMatrix.hpp"
+#include "PassiveSet.hpp"
 
 template <class MATTYPE, class VECTYPE>
 class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
+    /// Cholesky factors of AtA(P,P) for the passive sets seen so far.
+    /// Valid as long as AtA does not change.
+    PassiveSetCholeskyCache<MATTYPE> cholCache;
+
  public:
     BPPNNLS(MATTYPE input, VECTYPE rhs, bool prodSent = false):
         NNLS<MATTYPE, VECTYPE>(input, rhs, prodSent) {
@@ -20,6 +24,16 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
     BPPNNLS(MATTYPE input, MATTYPE RHS, bool prodSent = false) :
         NNLS<MATTYPE, VECTYPE>(input, RHS, prodSent) {
     }
+    /**
+     * Warm started solver for multiple RHS. initX of size
+     * \f$n \times nrhs\f$ is usually the solution of the previous outer
+     * iteration. Its nonzero pattern is the initial passive set, so late
+     * outer iterations converge in very few pivots.
+     */
+    BPPNNLS(MATTYPE input, MATTYPE RHS, MATTYPE initX,
+            bool prodSent = false) :
+        NNLS<MATTYPE, VECTYPE>(input, RHS, initX, prodSent) {
+    }
     int solveNNLS() {
         int rcIterations = 0;
         if (this->k == 1) {
@@ -69,9 +83,17 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
         UINT MAX_ITERATIONS = this->n * 5;
         bool success = true;
 
-        // Set the initial feasible solution
-        MATTYPE Y = (this->AtA * this->X) - this->AtB;
+        // Set the initial feasible solution. A warm start X is only used
+        // for its passive set. X is the solution on that passive set and
+        // zero outside of it, as in nnlsm_blockpivot.
         UMAT PassiveSet = (this->X > 0);
+        if (arma::accu(PassiveSet) > 0) {
+            this->X = solveNormalEqComb(this->AtA, this->AtB, PassiveSet);
+            fixAbsNumericalError<MATTYPE>(&this->X, EPSILON_1EMINUS12, 0.0);
+        } else {
+            this->X.zeros(this->n, this->k);
+        }
+        MATTYPE Y = (this->AtA * this->X) - this->AtB;
 
         int pbar = 3;
         UROWVEC P(this->k);
@@ -196,60 +218,61 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
      * Fast algorithm for the solution of large-scale non-negativity-constrained least squares problems
      * M. H. Van Benthem and M. R. Keenan, J. Chemometrics 2004; 18: 441-450
      * Motivated out of implementation from Jingu's solveNormalEqComb.m
-     * 
+     *
+     * Columns with the same passive set are grouped by hashing the bit
+     * packed passive set. Every group is solved with the Cholesky factor
+     * of AtA(P,P), which is cached across the BPP iterations of this
+     * solve as the same passive sets keep reappearing.
+     *
      * @param[in] LHS of the system of size \f$n \times n\f$
      * @param[in] RHS of the system of size \f$n \times nrhs\f$
      * @param[in] Binary matrix of size \f$n \times nrhs\f$ representing the Passive Set
      */
-    MATTYPE solveNormalEqComb(MATTYPE AtA, MATTYPE AtB, UMAT PassSet) {
+    MATTYPE solveNormalEqComb(const MATTYPE &AtA, const MATTYPE &AtB,
+                              const UMAT &PassSet) {
         MATTYPE Z;
-        UVEC anyZeros = arma::find(PassSet == 0);
-        if (anyZeros.empty()) {
+        PackedPassiveSet packed(PassSet);
+        if (packed.all()) {
             // Everything is the in the passive set.
             Z = arma::solve(AtA, AtB, arma::solve_opts::likely_sympd);
         } else {
-            UVEC Pv = arma::find(PassSet != 0);
-            Z.resize(AtB.n_rows, AtB.n_cols);
-            Z.zeros();
-            UINT k1 = PassSet.n_cols;
-            if (k1 == 1) {
-                // Single column to solve for.
-                Z(Pv) = arma::solve(AtA(Pv, Pv), AtB(Pv),
-                                arma::solve_opts::likely_sympd);
-            } else {
-                // we have to group passive set columns that are same.
-                // find the correlation matrix of passive set matrix.
-                std::vector<UWORD> sortedIdx, beginIdx;
-                computeCorrelationScore(PassSet, sortedIdx, beginIdx);
-
-                // Go through the groups one at a time
-                for (UINT i = 1; i < beginIdx.size(); i++) {
-                    UWORD sortedBeginIdx = beginIdx[i - 1];
-                    UWORD sortedEndIdx = beginIdx[i];
-
-                    // Create submatrices of indices for solve.
-                    UVEC samePassiveSetCols(std::vector<UWORD>
-                                            (sortedIdx.begin() + sortedBeginIdx,
-                                             sortedIdx.begin() + sortedEndIdx));
-                    UVEC currentPassiveSet = arma::find(
-                            PassSet.col(sortedIdx[sortedBeginIdx]) == 1);
+            Z.zeros(AtB.n_rows, AtB.n_cols);
+            // we have to group passive set columns that are same.
+            std::vector<std::vector<UWORD> > groups;
+            packed.group(&groups);
+
+            // Go through the groups one at a time
+            for (UINT i = 0; i < groups.size(); i++) {
+                UVEC samePassiveSetCols(groups[i]);
+                UVEC currentPassiveSet = packed.indices(groups[i][0]);
+                if (currentPassiveSet.empty()) continue;
 #ifdef _VERBOSE
-                    INFO << "samePassiveSetCols::" << std::endl
-                         <<  samePassiveSetCols << std::endl;
-                    INFO << "currPassiveSet::" << std::endl
-                         << currentPassiveSet << std::endl;
-                    INFO << "AtA::" << std::endl
-                         << AtA(currentPassiveSet, currentPassiveSet)
-                         << std::endl;
-                    INFO << "AtB::" << std::endl
-                         << AtB(currentPassiveSet, samePassiveSetCols)
-                         << std::endl;
+                INFO << "samePassiveSetCols::" << std::endl
+                     <<  samePassiveSetCols << std::endl;
+                INFO << "currPassiveSet::" << std::endl
+                     << currentPassiveSet << std::endl;
 #endif
-                    Z(currentPassiveSet, samePassiveSetCols) = arma::solve(
-                            AtA(currentPassiveSet, currentPassiveSet),
-                            AtB(currentPassiveSet, samePassiveSetCols),
-                            arma::solve_opts::likely_sympd);
+                MATTYPE rhs = AtB(currentPassiveSet, samePassiveSetCols);
+                std::vector<uint64_t> key = packed.key(groups[i][0]);
+                const MATTYPE *R = this->cholCache.find(key);
+                if (R == NULL) {
+                    MATTYPE Rnew;
+                    MATTYPE lhs = AtA(currentPassiveSet, currentPassiveSet);
+                    if (!arma::chol(Rnew, lhs)) {
+                        // not positive definite. fall back to the
+                        // generic solver and do not cache.
+                        Z(currentPassiveSet, samePassiveSetCols) =
+                            arma::solve(lhs, rhs);
+                        continue;
+                    }
+                    R = this->cholCache.insert(key, Rnew);
+                    if (R == NULL) {
+                        Z(currentPassiveSet, samePassiveSetCols) =
+                            cholSolve(Rnew, rhs);
+                        continue;
+                    }
                 }
+                Z(currentPassiveSet, samePassiveSetCols) = cholSolve(*R, rhs);
             }
         }
 #ifdef _VERBOSE
@@ -258,33 +281,57 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
         return Z;
     }
 
-   /**
-    * Passset is a binary matrix where every column represents
-    * one datapoint. The objective is to returns a low triangular
-    * correlation matrix with 1 if the strings are equal. Zero otherwise
-    * 
-    * @param[in] The binary matrix being grouped
-    * @param[in] Reference to the array containing lexicographically sorted
-    *            columns of the binary matrix
-    * @param[in] Running indices of the grouped columns in the sorted index
-    *            array
-    */
-    void computeCorrelationScore(UMAT &PassSet, std::vector<UWORD> &sortedIdx,
-                                 std::vector<UWORD> &beginIndex) {
-        SortBooleanMatrix<UMAT> sbm(PassSet);
-        sortedIdx = sbm.sortIndex();
-        BooleanArrayComparator<UMAT> bac(PassSet);
-        uint beginIdx = 0;
-        beginIndex.clear();
-        beginIndex.push_back(beginIdx);
-        for (uint i = 0; i < sortedIdx.size(); i++) {
-            if (i == sortedIdx.size() - 1 ||
-                    bac(sortedIdx[i], sortedIdx[i + 1]) == true) {
-                beginIdx = i + 1;
-                beginIndex.push_back(beginIdx);
-            }
-        }
+    /**
+     * Solves \f$R^TR Z = B\f$ given the upper triangular Cholesky
+     * factor R through two triangular solves.
+     */
+    MATTYPE cholSolve(const MATTYPE &R, const MATTYPE &B) {
+        MATTYPE Y = arma::solve(arma::trimatl(R.t()), B);
+        return arma::solve(arma::trimatu(R), Y);
     }
 };
 
+/**
+ * Solves the multiple RHS NNLS \f$\min_{X \ge 0} \|AX - B\|_F\f$ from
+ * \f$A^TA\f$ and \f$A^TB\f$ with BPP. The right hand sides are split
+ * into nnls_chunk_size chunks. Every chunk is an independent NNLS, so
+ * the chunks are solved in parallel with a dynamic schedule that balances
+ * their uneven pivot counts, and BLAS is kept single threaded inside each
+ * task. Every chunk is warm started from its columns of X.
+ * @param[in] AtA \f$k \times k\f$ gram
+ * @param[in] AtB \f$k \times\f$ at least first + X->n_cols columns
+ * @param[in] first column of AtB that is the first right hand side
+ * @param[in] maxchunk upper bound on the columns of one chunk
+ * @param[in,out] X \f$k \times nrhs\f$ warm start. Overwritten with the
+ *                solution.
+ * @return total number of BPP pivots over all the chunks
+ */
+inline UWORD solveChunkedBPP(const MAT &AtA, const MAT &AtB,
+                             const UWORD first, const UINT maxchunk, MAT *X) {
+    const UINT nrhs = X->n_cols;
+    if (nrhs == 0) return 0;
+    UINT chunkSize = nnls_chunk_size(nrhs, maxchunk);
+    UINT numChunks = (nrhs + chunkSize - 1) / chunkSize;
+    UWORD pivots = 0;
+    int blasThreads = get_blas_num_threads();
+    set_blas_num_threads(1);
+#pragma omp parallel for schedule(dynamic) reduction(+ : pivots)
+    for (UINT i = 0; i < numChunks; i++) {
+        UINT spanStart = i * chunkSize;
+        UINT spanEnd = std::min((i + 1) * chunkSize, nrhs) - 1;
+        BPPNNLS<MAT, VEC> subProblem(AtA,
+                        (MAT)AtB.cols(first + spanStart, first + spanEnd),
+                        (MAT)X->cols(spanStart, spanEnd), true);
+#ifdef _VERBOSE
+#pragma omp critical
+        INFO << "Scheduling start=" << spanStart << ", end=" << spanEnd
+             << ", tid=" << omp_get_thread_num() << std::endl;
+#endif
+        pivots += subProblem.solveNNLS();
+        X->cols(spanStart, spanEnd) = subProblem.getSolutionMatrix();
+    }
+    set_blas_num_threads(blasThreads);
+    return pivots;
+}
+
 #endif  // NNLS_BPPNNLS_HPP_
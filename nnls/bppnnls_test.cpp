@@ -0,0 +1,46 @@
+/* Copyright 2016 Ramakrishnan Kannan */
+
+#include <armadillo>
+#include "bppnnls.hpp"
+#include "utils.h"
+
+/**
+ * Checks that the warm started BPP converges to the cold start solution.
+ * Warm starts from a strictly positive guess, which has every variable in
+ * the initial passive set, and from the cold start solution itself.
+ */
+int main(int argc, char* argv[]) {
+  arma::arma_rng::set_seed(89);
+  const UWORD m = 60, n = 12, nrhs = 25;
+  MAT A = arma::randn<MAT>(m, n);
+  MAT B = arma::randn<MAT>(m, nrhs);
+  MAT AtA = A.t() * A;
+  MAT AtB = A.t() * B;
+
+  BPPNNLS<MAT, VEC> cold(AtA, AtB, true);
+  cold.solveNNLS();
+  MAT Xcold = cold.getSolutionMatrix();
+
+  MAT positive = arma::randu<MAT>(n, nrhs) + 0.1;
+  BPPNNLS<MAT, VEC> warm(AtA, AtB, positive, true);
+  warm.solveNNLS();
+  MAT Xwarm = warm.getSolutionMatrix();
+
+  BPPNNLS<MAT, VEC> exact(AtA, AtB, Xcold, true);
+  int exact_pivots = exact.solveNNLS();
+  MAT Xexact = exact.getSolutionMatrix();
+
+  double tol = 1e-8 * arma::norm(Xcold, "fro");
+  double warm_err = arma::norm(Xwarm - Xcold, "fro");
+  double exact_err = arma::norm(Xexact - Xcold, "fro");
+  INFO << "warm start from positive guess error::" << warm_err << std::endl;
+  INFO << "warm start from solution error::" << exact_err
+       << " pivots::" << exact_pivots << std::endl;
+  if (Xcold.min() < 0 || warm_err > tol || exact_err > tol ||
+      exact_pivots != 0) {
+    INFO << "FAILED" << std::endl;
+    return EXIT_FAILURE;
+  }
+  INFO << "PASSED" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -107,6 +107,7 @@ class NNLS {
                 // of vec type. Take just the first col
                 // of AtB in this case.
                 this->Atb = RHS.col(0);
+                this->x.zeros(RHS.n_rows);
             } else {
                 this->AtB = RHS;
             }
@@ -150,6 +151,7 @@ class NNLS {
                 // of vec type. Take just the first col
                 // of AtB in this case.
                 this->Atb = RHS.col(0);
+                this->x = initX.col(0);
             } else {
                 this->AtB = RHS;
             }
@@ -7,10 +7,12 @@
 #define MPITOC toc();
 
 #include <cblas.h>
+#include <algorithm>
 #include <armadillo>
 #include <vector>
 #include "common/ncpfactors.hpp"
 #include "common/ntf_utils.hpp"
+#include "common/stopping.hpp"
 #include "common/tensor.hpp"
 #include "dimtree/ddt.hpp"
 
@@ -40,15 +42,13 @@ class AUNTF {
   virtual MAT update(const int mode) = 0;
 
  private:
-  const planc::Tensor &m_input_tensor;
+  const NTFTENSOR &m_input_tensor;
   int m_num_it;
   int m_current_it;
   bool m_compute_error;
 
   const int m_low_rank_k;
-  MAT *ncp_krp;
   const algotype m_updalgo;
-  planc::Tensor *lowranktensor;
   DenseDimensionTree *kdt;
   bool m_enable_dim_tree;
   // needed for acceleration algorithms.
@@ -56,6 +56,8 @@ class AUNTF {
   double m_rel_error;
   double m_normA;
   std::vector<bool> m_stale_mttkrp;
+  StoppingCriterion m_stopping;
+  double m_pgrad_sqnorm;
 
   // Ensure factor is unnormalised when calling this function
   void update_factor_mode(const int &current_mode, const MAT &factor) {
@@ -69,13 +71,13 @@ class AUNTF {
 
     int num_modes = this->m_input_tensor.modes();
     for (int mode = 0; mode < num_modes; mode++) {
-      if (mode != current_mode) this->m_stale_mttkrp[current_mode] = true;
+      if (mode != current_mode) this->m_stale_mttkrp[mode] = true;
     }
   }
   virtual void accelerate() {}
 
  public:
-  AUNTF(const planc::Tensor &i_tensor, const int i_k, algotype i_algo)
+  AUNTF(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo)
       : m_ncp_factors(i_tensor.dimensions(), i_k, false),
         m_input_tensor(i_tensor),
         m_low_rank_k(i_k),
@@ -83,46 +85,52 @@ class AUNTF {
     m_ncp_factors.normalize();
     gram_without_one.zeros(i_k, i_k);
     ncp_mttkrp_t = new MAT[i_tensor.modes()];
-    ncp_krp = new MAT[i_tensor.modes()];
     for (int i = 0; i < i_tensor.modes(); i++) {
-      UWORD current_size = TENSOR_NUMEL / TENSOR_DIM[i];
-      ncp_krp[i].zeros(current_size, i_k);
       ncp_mttkrp_t[i].zeros(i_k, TENSOR_DIM[i]);
       this->m_stale_mttkrp.push_back(true);
     }
-    lowranktensor = new planc::Tensor(i_tensor.dimensions());
     m_compute_error = false;
     m_num_it = 20;
     m_normA = i_tensor.norm();
     // INFO << "Init factors for NCP" << std::endl << "======================";
     // m_ncp_factors.print();
     this->m_enable_dim_tree = false;
+    this->m_pgrad_sqnorm = 0;
   }
   ~AUNTF() {
     for (int i = 0; i < m_input_tensor.modes(); i++) {
-      ncp_krp[i].clear();
       ncp_mttkrp_t[i].clear();
     }
-    delete[] ncp_krp;
     delete[] ncp_mttkrp_t;
     if (this->m_enable_dim_tree) {
       delete kdt;
     }
-    delete lowranktensor;
   }
   NCPFactors &ncp_factors() { return m_ncp_factors; }
   void dim_tree(bool i_dim_tree) {
+#ifdef BUILD_SPARSE
+    if (i_dim_tree) {
+      WARN << "dimension trees need a dense tensor. ignoring." << std::endl;
+    }
+#else
     this->m_enable_dim_tree = i_dim_tree;
     if (i_dim_tree) {
-      this->kdt = new DenseDimensionTree(m_input_tensor, m_ncp_factors,
-                                         m_input_tensor.modes() / 2);
+      this->kdt = new DenseDimensionTree(m_input_tensor, m_ncp_factors);
+      INFO << "KDT Split Mode::" << kdt->split_mode() << std::endl;
     }
+#endif
   }
   double current_error() const { return this->m_rel_error; }
   void num_it(const int i_n) { this->m_num_it = i_n; }
+  /// Stops before num_it when the criterion is met
+  void stopping(const StoppingCriterion &i_stopping) {
+    this->m_stopping = i_stopping;
+  }
   void computeNTF() {
+    if (m_stopping.needs_error()) this->m_compute_error = true;
     for (m_current_it = 0; m_current_it < m_num_it; m_current_it++) {
       INFO << "iter::" << this->m_current_it << std::endl;
+      m_pgrad_sqnorm = 0;
       for (int j = 0; j < this->m_input_tensor.modes(); j++) {
         m_ncp_factors.gram_leave_out_one(j, &gram_without_one);
 #ifdef NTF_VERBOSE
@@ -131,17 +139,13 @@ class AUNTF {
              << gram_without_one << std::endl;
 #endif
         if (this->m_stale_mttkrp[j]) {
-          m_ncp_factors.krp_leave_out_one(j, &ncp_krp[j]);
-#ifdef NTF_VERBOSE
-          INFO << "krp_leave_out_" << j << std::endl << ncp_krp[j] << std::endl;
-#endif
           if (this->m_enable_dim_tree) {
             double multittv_time = 0;
             double mttkrp_time = 0;
             kdt->in_order_reuse_MTTKRP(j, ncp_mttkrp_t[j].memptr(), false,
                                        multittv_time, mttkrp_time);
           } else {
-            m_input_tensor.mttkrp(j, ncp_krp[j], &ncp_mttkrp_t[j]);
+            mttkrp_fused(j, m_input_tensor, m_ncp_factors, &ncp_mttkrp_t[j]);
           }
           this->m_stale_mttkrp[j] = false;
 #ifdef NTF_VERBOSE
@@ -149,6 +153,14 @@ class AUNTF {
                << ncp_mttkrp_t[j] << std::endl;
 #endif
         }
+        if (m_stopping.needs_gradient()) {
+          // gradient of mode j at the current model. lambda is carried
+          // by mode j as the other factors are normalized.
+          MAT current_t = arma::diagmat(m_ncp_factors.lambda()) *
+                          m_ncp_factors.factor(j).t();
+          MAT grad_t = gram_without_one * current_t - ncp_mttkrp_t[j];
+          m_pgrad_sqnorm += projectedGradSqNorm(current_t, grad_t);
+        }
         // MAT factor = update(m_updalgo, gram_without_one, ncp_mttkrp_t[j], j);
         MAT factor = update(j);
 #ifdef NTF_VERBOSE
@@ -164,6 +176,17 @@ class AUNTF {
              << "::" << temp_err << std::endl;
       }
       if (this->m_accelerated) accelerate();
+      if (m_stopping.enabled()) {
+        m_stopping.add(m_stopping.needs_gradient() ? m_pgrad_sqnorm
+                                                   : this->m_rel_error);
+        if (m_stopping.converged()) {
+          INFO << "converged::" << m_stopping.name() << "::it::"
+               << this->m_current_it << "::value::" << m_stopping.last()
+               << std::endl;
+          m_current_it++;
+          break;
+        }
+      }
 #ifdef NTF_VERBOSE
       INFO << "ncp factors" << std::endl;
       m_ncp_factors.print();
@@ -192,30 +215,53 @@ class AUNTF {
     m_ncp_factors.set_lambda(new_factors.lambda());
   }
   int current_it() const { return m_current_it; }
+  /**
+   * Relative error of the current model without forming it.
+   * \f$\|X - M\|^2 = \|X\|^2 - 2 \langle MTTKRP_N, A_N diag(\lambda)
+   * \rangle + \lambda^T (\circledast_i A_i^T A_i) \lambda\f$
+   * where N is the last mode. Right after the last mode update its
+   * mttkrp is still current. Otherwise it is computed again.
+   * Define NTF_NAIVE_ERROR to check against the dense reconstruction.
+   */
   double computeObjectiveError() {
-    // current low rank tensor
-    // UWORD krpsize = arma::prod(this->m_dimensions);
-    // krpsize /= this->m_dimensions[0];
-    // MAT krpleavingzero.zeros(krpsize, this->m_k);
-    // krp_leave_out_one(0, &krpleavingzero);
-    // MAT lowranktensor(this->m_dimensions[0], krpsize);
-    // lowranktensor = this->ncp_factors[0] * trans(krpleavingzero);
-
-    // compute current low rank tensor as above.
-    m_ncp_factors.krp_leave_out_one(0, &ncp_krp[0]);
-    // cblas_dgemm_(const CBLAS_LAYOUT Layout,
-    //              const CBLAS_TRANSPOSE transa,
-    //              const CBLAS_TRANSPOSE transb,
-    //              const MKL_INT m, const MKL_INT n,
-    //              const MKL_INT k, const double alpha,
-    //              const double * a, const MKL_INT lda,
-    //              const double * b, const MKL_INT ldb,
-    //              const double beta, double * c,
-    //              const MKL_INT ldc);
-    // char transa = 'T';
-    // char transb = 'N';
+    int last = this->m_input_tensor.modes() - 1;
+    if (this->m_stale_mttkrp[last]) {
+      mttkrp_fused(last, m_input_tensor, m_ncp_factors, &ncp_mttkrp_t[last]);
+      this->m_stale_mttkrp[last] = false;
+    }
+    VEC lambda = m_ncp_factors.lambda();
+    MAT unnorm_fac_t =
+        arma::diagmat(lambda) * m_ncp_factors.factor(last).t();
+    double inner_product = arma::dot(ncp_mttkrp_t[last], unnorm_fac_t);
+    MAT all_grams;
+    m_ncp_factors.gram_leave_out_one(last, &all_grams);
+    all_grams %= m_ncp_factors.factor(last).t() * m_ncp_factors.factor(last);
+    double sq_norm_model = arma::as_scalar(lambda.t() * all_grams * lambda);
+    double err = this->m_normA - 2 * inner_product + sq_norm_model;
+    err = std::sqrt(std::max(err, 0.0) / this->m_normA);
+#ifdef NTF_NAIVE_ERROR
+    double naive_err = computeNaiveError();
+    INFO << "fast error::" << err << "::naive error::" << naive_err
+         << std::endl;
+    err = naive_err;
+#endif
+    return err;
+  }
+#ifdef NTF_NAIVE_ERROR
+  /**
+   * Debug only. Forms the krp leaving out mode 0 and the full low rank
+   * tensor, each the size of the input, and subtracts.
+   */
+  double computeNaiveError() {
+#ifdef BUILD_SPARSE
+    double err = m_input_tensor.err(m_ncp_factors);
+    return std::sqrt(std::abs(err) / this->m_normA);
+#else
+    MAT krp(TENSOR_NUMEL / TENSOR_DIM[0], this->m_low_rank_k);
+    m_ncp_factors.krp_leave_out_one(0, &krp);
+    planc::Tensor lowranktensor(m_input_tensor.dimensions());
     int m = m_ncp_factors.factor(0).n_rows;
-    int n = ncp_krp[0].n_rows;
+    int n = krp.n_rows;
     int k = m_ncp_factors.factor(0).n_cols;
     int lda = m;
     int ldb = n;
@@ -224,21 +270,15 @@ class AUNTF {
     double beta = 0;
     char nt = 'N';
     char t = 'T';
-
     MAT unnorm_fac =
         m_ncp_factors.factor(0) * arma::diagmat(m_ncp_factors.lambda());
-    // double *output_tensor = new double[ldc * n];
     dgemm_(&nt, &t, &m, &n, &k, &alpha, unnorm_fac.memptr(), &lda,
-           ncp_krp[0].memptr(), &ldb, &beta, &lowranktensor->m_data[0], &ldc);
-    // INFO << "lowrank tensor::" << std::endl;
-    // lowranktensor->print();
-    // for (int i=0; i < ldc*n; i++){
-    //     INFO << i << ":" << output_tensor[i] << std::endl;
-    // }
-    double err = m_input_tensor.err(*lowranktensor);
-    err = std::sqrt(err / this->m_normA);
-    return err;
+           krp.memptr(), &ldb, &beta, lowranktensor.data(), &ldc);
+    double err = m_input_tensor.err(lowranktensor);
+    return std::sqrt(err / this->m_normA);
+#endif
   }
+#endif
   double computeObjectiveError(const NCPFactors &new_factors_t) {
     reset(new_factors_t, true);
     return computeObjectiveError();
@@ -1,33 +1,82 @@
 /* Copyright 2017 Ramakrishnan Kannan */
 
 #include <armadillo>
-#include "ncpfactors.hpp"
-#include "ntf_utils.hpp"
-#include "tensor.hpp"
-#include "utils.h"
-
-int main(int argc, char* argv[]) {
-  int test_order = 5;
-  int low_rank = 2;
-  UVEC dimensions(test_order);
-  FMAT* mttkrps = new FMAT[test_order];
-  // UVEC dimensions(4);
-  for (int i = 0; i < test_order; i++) {
-    dimensions(i) = i + 2;
+#include <string>
+#include "common/ncpfactors.hpp"
+#include "common/ntf_utils.hpp"
+#include "common/tensor.hpp"
+#include "common/utils.h"
+
+/**
+ * Checks the tiled krp and krp_leave_out_one against the full product
+ * formed by the kron of the factor columns, and mttkrp_fused against
+ * mttkrp. The dimensions make the KRPs span several kKRPBlockRows tiles
+ * with a partial last tile.
+ */
+
+static int failures = 0;
+
+static void check(const bool ok, const std::string &what) {
+  if (!ok) {
+    INFO << "FAILED::" << what << std::endl;
+    failures++;
   }
-  // dimensions(3) = 6;
-  PLANC::NCPFactors cpfactors(dimensions, low_rank);
-  cpfactors.print();
-  FMAT krp_2 = cpfactors.krp_leave_out_one(2);
-  cout << "krp" << endl << "------" << endl << krp_2;
-  PLANC::Tensor my_tensor = cpfactors.rankk_tensor();
-  // cout << "input tensor" << endl << "--------" << endl;
-  // my_tensor.print();
-  for (int i = 0; i < test_order; i++) {
-    mttkrps[i] = arma::zeros<FMAT>(dimensions(i), low_rank);
+}
+
+/// KRP of the given modes, first mode fastest, one kron per column
+static MAT krpByKron(const planc::NCPFactors &F, const UVEC &modes) {
+  UWORD rows = 1;
+  for (UWORD i = 0; i < modes.n_elem; i++) rows *= F.factor(modes[i]).n_rows;
+  MAT out(rows, F.rank());
+  for (int n = 0; n < F.rank(); n++) {
+    VEC col = F.factor(modes[0]).col(n);
+    for (UWORD i = 1; i < modes.n_elem; i++) {
+      col = arma::kron(F.factor(modes[i]).col(n), col);
+    }
+    out.col(n) = col;
   }
+  return out;
+}
+
+int main(int argc, char *argv[]) {
+  const int test_order = 5;
+  const int low_rank = 3;
+  UVEC dimensions(test_order);
+  for (int i = 0; i < test_order; i++) dimensions(i) = i + 5;
+  planc::NCPFactors cpfactors(dimensions, low_rank, false);
+  planc::Tensor my_tensor;
+  cpfactors.rankk_tensor(my_tensor);
+
   for (int i = 0; i < test_order; i++) {
-    mttkrp(i, my_tensor, cpfactors, &mttkrps[i]);
-    cout << "mttkrp " << i << endl << "---------" << endl << mttkrps[i];
+    MAT expected = krpByKron(cpfactors, cpfactors.leave_out_one(i));
+    MAT tiled = cpfactors.krp_leave_out_one(i);
+    double tol = 1e-12 * arma::norm(expected, "fro");
+    check(tiled.n_rows == expected.n_rows &&
+              arma::norm(tiled - expected, "fro") <= tol,
+          "krp_leave_out_one mode " + std::to_string(i));
+
+    MAT full(dimensions(i), low_rank);
+    my_tensor.mttkrp(i, expected, &full);
+    MAT fused;
+    mttkrp_fused(i, my_tensor, cpfactors, &fused);
+    tol = 1e-10 * arma::norm(full, "fro");
+    check(fused.n_rows == static_cast<UWORD>(low_rank) &&
+              arma::norm(fused.t() - full, "fro") <= tol,
+          "mttkrp_fused mode " + std::to_string(i));
   }
+
+  // any subset of the modes in any order
+  UVEC subset(3);
+  subset(0) = 3;
+  subset(1) = 0;
+  subset(2) = 4;
+  MAT expected = krpByKron(cpfactors, subset);
+  MAT tiled(expected.n_rows, low_rank);
+  cpfactors.krp(subset, &tiled);
+  check(arma::norm(tiled - expected, "fro") <=
+            1e-12 * arma::norm(expected, "fro"),
+        "krp of a subset of the modes");
+
+  INFO << (failures ? "FAILED" : "PASSED") << std::endl;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
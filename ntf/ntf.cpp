@@ -3,8 +3,10 @@
 #include <iostream>
 #include "common/utils.h"
 #include "common/ncpfactors.hpp"
+#include "common/npyio.hpp"
 #include "common/ntf_utils.hpp"
 #include "common/parsecommandline.hpp"
+#include "common/sparsetensor.hpp"
 #include "common/tensor.hpp"
 #include "ntf/ntfanlsbpp.hpp"
 #include "ntf/ntfaoadmm.hpp"
@@ -20,20 +22,51 @@ class NTFDriver {
  public:
   template <class NTFTYPE>
   void callNTF(planc::ParseCommandLine pc) {
-    int test_modes = pc.num_modes();
-    UVEC dimensions(test_modes);
-    Tensor my_tensor(pc.dimensions());
     std::string rand_prefix("rand_");
     std::string filename = pc.input_file_name();
     std::cout << "Input filename = " << filename << std::endl;
-    if (!filename.empty() &&
-        filename.compare(0, rand_prefix.size(), rand_prefix) != 0) {
-      my_tensor.read(pc.input_file_name());
-      my_tensor.print();
+    bool is_file = !filename.empty() &&
+                   filename.compare(0, rand_prefix.size(), rand_prefix) != 0;
+#ifdef BUILD_SPARSE
+    SparseTensor my_tensor;
+    if (is_file) {
+      my_tensor.read(filename);
+    } else {
+      SparseTensor temp(pc.dimensions(), pc.sparsity(), 103);
+      my_tensor.swap(temp);
+    }
+    INFO << "input tensor::dims::" << my_tensor.dimensions().t()
+         << "::nnz::" << my_tensor.nnz() << std::endl;
+#else
+    Tensor my_tensor(pc.dimensions());
+    if (is_file) {
+      // map the input instead of reading it. Fall back to a read.
+      bool mapped = false;
+      if (filename.size() > 4 &&
+          filename.compare(filename.size() - 4, 4, ".npy") == 0) {
+        NumPyArray npy;
+        mapped = npy.map(filename);
+        if (mapped) {
+          my_tensor.swap(*npy.m_input_tensor);
+          delete npy.m_input_tensor;
+        } else {
+          npy.load(filename);
+          my_tensor.swap(*npy.m_input_tensor);
+          delete npy.m_input_tensor;
+        }
+      } else {
+        mapped = my_tensor.map(filename);
+        if (!mapped) my_tensor.read(filename);
+      }
+      INFO << "input tensor " << (mapped ? "mapped" : "read")
+           << "::dims::" << my_tensor.dimensions().t();
     }
+#endif
     NTFTYPE ntfsolver(my_tensor, pc.lowrankk(), pc.lucalgo());
     ntfsolver.num_it(pc.iterations());
     ntfsolver.compute_error(pc.compute_error());
+    ntfsolver.stopping(StoppingCriterion(pc.stop_policy(), pc.tolerance(),
+                                         pc.stop_window()));
     if (pc.dim_tree()) {
       ntfsolver.dim_tree(true);
     }
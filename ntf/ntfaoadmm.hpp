@@ -77,7 +77,7 @@ class NTFAOADMM : public AUNTF {
   }
 
  public:
-  NTFAOADMM(const Tensor &i_tensor, const int i_k, algotype i_algo)
+  NTFAOADMM(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo)
       : AUNTF(i_tensor, i_k, i_algo),
         m_ncp_aux(i_tensor.dimensions(), i_k, false),
         m_ncp_aux_t(i_tensor.dimensions(), i_k, true),
@@ -29,7 +29,7 @@ class NTFHALS : public AUNTF {
   }
 
  public:
-  NTFHALS(const Tensor &i_tensor, const int i_k, algotype i_algo)
+  NTFHALS(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo)
       : AUNTF(i_tensor, i_k, i_algo) {}
 };  // class NTFHALS
 
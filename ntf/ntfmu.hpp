@@ -16,7 +16,7 @@ class NTFMU : public AUNTF {
   }
 
  public:
-  NTFMU(const Tensor &i_tensor, const int i_k, algotype i_algo)
+  NTFMU(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo)
       : AUNTF(i_tensor, i_k, i_algo) {}
 };  // class NTFMU
 }  // namespace planc
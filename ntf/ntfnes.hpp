@@ -166,7 +166,7 @@ class NTFNES : public AUNTF {
   }
 
  public:
-  NTFNES(const Tensor &i_tensor, const int i_k, algotype i_algo)
+  NTFNES(const NTFTENSOR &i_tensor, const int i_k, algotype i_algo)
       : AUNTF(i_tensor, i_k, i_algo),
         m_prox_t(i_tensor.dimensions(), i_k, true),
         m_acc_t(i_tensor.dimensions(), i_k, true),
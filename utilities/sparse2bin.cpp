@@ -0,0 +1,81 @@
+/* Copyright 2016 Ramakrishnan Kannan */
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "common/sparsebinary.hpp"
+
+/*
+ * Converts a zero indexed coordinate file "i j v" into the binary sparse
+ * container read collectively by the 2D distnmf sparse input. The input
+ * is streamed, so the matrix is never held in memory, and the output can
+ * be read on any processor grid.
+ * Compile as g++ -O3 -std=c++11 sparse2bin.cpp -I/path/to/planc
+ */
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 5) {
+    std::cout << "Usage : sparse2bin inputcoordfile outputfile [m n]"
+              << std::endl;
+    return -1;
+  }
+  std::ifstream in(argv[1]);
+  if (!in.is_open()) {
+    std::cerr << "Could not open input file " << argv[1] << std::endl;
+    return -1;
+  }
+  std::ofstream out(argv[2], std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Could not open output file " << argv[2] << std::endl;
+    return -1;
+  }
+  // placeholder header. rewritten once nnz and the dimensions are known.
+  planc::SparseBinaryHeader hdr = planc::SparseBinaryLayout::header(0, 0, 0);
+  out.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+
+  const size_t kBatch = 1 << 16;
+  std::vector<planc::SparseBinaryEntry> batch;
+  batch.reserve(kBatch);
+  uint64_t m = 0, n = 0, nnz = 0;
+  planc::SparseBinaryEntry e;
+  while (in >> e.row >> e.col >> e.value) {
+    m = std::max(m, e.row + 1);
+    n = std::max(n, e.col + 1);
+    batch.push_back(e);
+    if (batch.size() == kBatch) {
+      out.write(reinterpret_cast<const char *>(&batch[0]),
+                batch.size() * sizeof(e));
+      nnz += batch.size();
+      batch.clear();
+    }
+  }
+  if (!batch.empty()) {
+    out.write(reinterpret_cast<const char *>(&batch[0]),
+              batch.size() * sizeof(e));
+    nnz += batch.size();
+  }
+  if (argc == 5) {
+    uint64_t given_m = atoll(argv[3]);
+    uint64_t given_n = atoll(argv[4]);
+    if (given_m < m || given_n < n) {
+      std::cerr << "entries up to " << m << "x" << n << " do not fit in "
+                << given_m << "x" << given_n << std::endl;
+      return -1;
+    }
+    m = given_m;
+    n = given_n;
+  }
+  hdr = planc::SparseBinaryLayout::header(m, n, nnz);
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  out.close();
+  if (!out) {
+    std::cerr << "Could not write output file " << argv[2] << std::endl;
+    return -1;
+  }
+  std::cout << "input matrix A::" << m << "x" << n << "::nnz::" << nnz
+            << std::endl;
+  return 0;
+}